@@ -0,0 +1,44 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/aio.h
+ * @brief       Kernel AIO system calls, which glibc does not wrap
+ */
+
+#ifndef SDMUXCTRL_AIO_H
+#define SDMUXCTRL_AIO_H
+
+#include <linux/aio_abi.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static inline int ioSetup(unsigned int nr, aio_context_t *ctx) {
+    return syscall(__NR_io_setup, nr, ctx);
+}
+
+static inline int ioDestroy(aio_context_t ctx) {
+    return syscall(__NR_io_destroy, ctx);
+}
+
+static inline int ioSubmit(aio_context_t ctx, long nr, struct iocb **cbs) {
+    return syscall(__NR_io_submit, ctx, nr, cbs);
+}
+
+static inline int ioGetEvents(aio_context_t ctx, long minNr, long nr, struct io_event *events) {
+    return syscall(__NR_io_getevents, ctx, minNr, nr, events, NULL);
+}
+
+#endif // SDMUXCTRL_AIO_H
@@ -0,0 +1,44 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/backend.cpp
+ * @brief       Selection of the hardware access backend
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "backend.h"
+
+static const CCBackend *selectBackend() {
+    const char *name = getenv(SDMUX_BACKEND_ENV);
+
+    if (name == NULL || *name == '\0' || strcmp(name, ftdiBackend.name) == 0)
+        return &ftdiBackend;
+
+    if (strcmp(name, simBackend.name) == 0)
+        return &simBackend;
+
+    fprintf(stderr, "Unknown backend %s, using %s\n", name, ftdiBackend.name);
+    return &ftdiBackend;
+}
+
+const CCBackend *getBackend() {
+    static const CCBackend *backend = selectBackend();
+
+    return backend;
+}
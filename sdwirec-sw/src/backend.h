@@ -0,0 +1,78 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/backend.h
+ * @brief       Interface between device logic and the hardware access layer
+ *
+ * All USB and FTDI operations used by the device logic go through a backend. Devices are always represented by
+ * a libftdi context, but the simulated backend never attaches it to real hardware.
+ */
+
+#ifndef SDMUXCTRL_BACKEND_H
+#define SDMUXCTRL_BACKEND_H
+
+#include <poll.h>
+#include <stddef.h>
+
+#include <vector>
+
+#include <libftdi1/ftdi.h>
+
+#include "sysfs.h"
+
+#define SDMUX_BACKEND_ENV       "SDMUX_BACKEND"
+#define SDMUX_SIM_DEVICES_ENV   "SDMUX_SIM_DEVICES"
+#define SDMUX_SIM_LATENCY_ENV   "SDMUX_SIM_LATENCY"
+
+// Called for every device matching the watched vendor and product which is plugged in or out
+typedef void (*CCHotplugCallback)(const CCUsbDevice *dev, bool arrived);
+
+/*
+ * Functions returning int follow libftdi conventions: negative value on error with the error string of the context
+ * set, zero or positive value on success.
+ */
+struct CCBackend {
+    const char *name;
+    bool simulated;
+
+    int (*enumerate)(int vendor, int product, std::vector<CCUsbDevice> &devices);
+    int (*openBusAddr)(struct ftdi_context *ftdi, int busnum, int devnum);
+    int (*openDescIndex)(struct ftdi_context *ftdi, int vendor, int product, const char *serial, unsigned int index);
+    int (*getPort)(struct ftdi_context *ftdi, char *port, size_t size, int *busnum, int *devnum);
+    int (*readProduct)(struct ftdi_context *ftdi, char *product, int len);
+    int (*readEeprom)(struct ftdi_context *ftdi);
+    int (*decodeEeprom)(struct ftdi_context *ftdi);
+    int (*getEepromProduct)(struct ftdi_context *ftdi, char *product, int len);
+    int (*setBitmode)(struct ftdi_context *ftdi, unsigned char mask, unsigned char mode);
+    int (*readData)(struct ftdi_context *ftdi, unsigned char *pins);
+    int (*readPins)(struct ftdi_context *ftdi, unsigned char *pins);
+    int (*writeData)(struct ftdi_context *ftdi, unsigned char pins);
+    void (*close)(struct ftdi_context *ftdi);
+
+    // Hotplug notifications are delivered from handleEvents(), which should be called when any of the event
+    // descriptors becomes readable. watch() fails when hotplug is not supported.
+    int (*watch)(int vendor, int product, CCHotplugCallback callback);
+    int (*getEventFds)(std::vector<struct pollfd> &fds);
+    int (*handleEvents)(int timeoutMs);
+    void (*unwatch)();
+};
+
+extern const CCBackend ftdiBackend;
+extern const CCBackend simBackend;
+
+const CCBackend *getBackend();
+
+#endif // SDMUXCTRL_BACKEND_H
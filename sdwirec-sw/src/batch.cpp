@@ -0,0 +1,187 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/batch.cpp
+ * @brief       Execution of many commands in one process
+ *
+ * Each line of the batch file holds sd-mux-ctrl options describing one command, e.g. "--ts -e odroid_u3_1".
+ * Devices given with --device-serial or --device-id on the command line are used for lines that do not select
+ * any. "wait <ms>" line pauses execution. Empty lines and lines starting with '#' are skipped.
+ * Devices are opened once and kept open until the end of the batch. Result of every line is printed to stdout as
+ * a JSON object in a separate line.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <popt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "batch.h"
+#include "cli.h"
+#include "daemon.h"
+#include "json.h"
+#include "pool.h"
+#include "timing.h"
+
+#define WAIT_CMD        "wait"
+#define MAX_WAIT_MS     (UINT_MAX / 1000)      // Longest wait whose microseconds fit useconds_t
+
+// Name of the commands and the device they address are stored in name and selector for the timings log
+static int runLine(const char *line, CCOptionValue options[], FILE *out, std::string &name, char *selector) {
+    CCOptionValue lineOptions[CCO_MAX];
+    CCCommand cmd = CCC_None;
+    std::vector<CCAction> actions;
+    const char **argv, **lineArgv;
+    char args[64];
+    int argc, arg, ret;
+    CCPoolDevice *dev;
+
+    if (strncmp(line, WAIT_CMD " ", sizeof(WAIT_CMD)) == 0) {
+        double start = getTimeMs();
+        char *end;
+        long ms;
+
+        errno = 0;
+        ms = strtol(line + sizeof(WAIT_CMD), &end, 10);
+        if (errno != 0 || end == line + sizeof(WAIT_CMD) || *end != '\0' || ms < 0 || ms > MAX_WAIT_MS) {
+            fprintf(stderr, "Invalid wait time: %s\n", line);
+            return EXIT_FAILURE;
+        }
+
+        usleep((useconds_t)ms * 1000);
+        recordPhase(CCP_Delay, start);
+        return EXIT_SUCCESS;
+    }
+
+    if (poptParseArgvString(line, &argc, &lineArgv) < 0) {
+        fprintf(stderr, "Unable to parse: %s\n", line);
+        return EXIT_FAILURE;
+    }
+
+    argv = (const char **)malloc((argc + 2) * sizeof(char *));
+    argv[0] = "sd-mux-ctrl";
+    memcpy(argv + 1, lineArgv, (argc + 1) * sizeof(char *));
+
+    memcpy(lineOptions, options, sizeof(lineOptions));
+    ret = parseArguments(argc + 1, argv, &cmd, &actions, &arg, args, sizeof(args), lineOptions);
+    free(argv);
+    free(lineArgv);
+    if (ret != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    // Device id given in the line takes precedence over serial number given on the command line
+    if (lineOptions[CCO_DeviceId].argn != options[CCO_DeviceId].argn
+            && lineOptions[CCO_DeviceSerial].args == options[CCO_DeviceSerial].args)
+        lineOptions[CCO_DeviceSerial].args = NULL;
+
+    if (actions.empty() || !arePoolActions(actions)) {
+        fprintf(stderr, "Command not supported in batch mode: %s\n", line);
+        return EXIT_FAILURE;
+    }
+
+    name = getActionsName(actions);
+    if (getSelector(lineOptions, selector, SELECTOR_SIZE) != EXIT_SUCCESS)
+        selector[0] = '\0';
+
+    if (!options[CCO_Direct].argn) {
+        ret = daemonRequestActions(actions, lineOptions, out);
+        if (ret != CCD_NOT_HANDLED)
+            return ret;
+    }
+
+    dev = getPoolDevice(lineOptions);
+    if (dev == NULL)
+        return EXIT_FAILURE;
+
+    ret = executeActions(dev, actions, lineOptions, out);
+    if (ret != EXIT_SUCCESS)
+        dropPoolDevice(dev);
+
+    return ret;
+}
+
+int runBatch(CCOptionValue options[]) {
+    const char *file = options[CCO_BatchFile].args;
+    char *line = NULL, *output, selector[SELECTOR_SIZE];
+    size_t lineSize = 0, outputSize;
+    int lineNo = 0, ret = EXIT_SUCCESS, rc;
+    std::vector<CCPhaseTime> phases;
+    std::string name;
+    double start, end;
+    ssize_t len;
+    FILE *in, *out;
+
+    in = strcmp(file, "-") == 0 ? stdin : fopen(file, "r");
+    if (in == NULL) {
+        fprintf(stderr, "Unable to open batch file %s\n", file);
+        return EXIT_FAILURE;
+    }
+
+    while ((len = getline(&line, &lineSize, in)) >= 0) {
+        lineNo++;
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (strspn(line, " \t") == (size_t)len || line[strspn(line, " \t")] == '#')
+            continue;
+
+        out = open_memstream(&output, &outputSize);
+        if (out == NULL) {
+            ret = EXIT_FAILURE;
+            break;
+        }
+
+        name.clear();
+        phases.clear();
+        setPhaseLog(&phases);
+        start = getTimeMs();
+        rc = runLine(line, options, out, name, selector);
+        end = getTimeMs();
+        setPhaseLog(NULL);
+        fclose(out);
+
+        printf("{\"line\": %d, \"command\": ", lineNo);
+        printJsonString(stdout, line);
+        printf(", \"rc\": %d, \"time_ms\": %.3f, \"output\": ", rc, end - start);
+        printJsonString(stdout, output);
+        if (options[CCO_Timings].argn) {
+            printf(", ");
+            printPhaseFields(stdout, phases, start, end);
+        }
+        printf("}\n");
+        if (!name.empty())
+            logPhases(name.c_str(), selector, rc, phases, start, end);
+        fflush(stdout);
+        free(output);
+
+        if (rc != EXIT_SUCCESS) {
+            ret = EXIT_FAILURE;
+            break;
+        }
+    }
+
+    free(line);
+    if (in != stdin)
+        fclose(in);
+    closePool();
+
+    return ret;
+}
@@ -0,0 +1,247 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/bench.cpp
+ * @brief       Switching latency benchmark
+ *
+ * Repeatedly executes commands on the given devices, each time opening and closing the device just like a single
+ * invocation of sd-mux-ctrl does, and reports latency percentiles of every phase and of whole commands. Works with
+ * simulated devices as well (SDMUX_BACKEND=sim).
+ */
+
+#include <math.h>
+#include <popt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "daemon.h"
+#include "device.h"
+#include "fanout.h"
+#include "json.h"
+#include "pool.h"
+#include "timing.h"
+
+#define DEFAULT_ITERATIONS      20
+#define DEFAULT_COMMANDS        "ts,dut,status"
+
+struct CCSamples {
+    std::string name;
+    std::vector<double> values;
+};
+
+static double getPercentile(const std::vector<double> &sorted, double percentile) {
+    size_t rank = (size_t)ceil(percentile / 100.0 * sorted.size());
+
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void printSamples(std::vector<CCSamples> &samples, bool json, const char *label) {
+    bool first = true;
+
+    for (size_t i = 0; i < samples.size(); i++) {
+        std::vector<double> &v = samples[i].values;
+        if (v.empty())
+            continue;
+        std::sort(v.begin(), v.end());
+
+        if (json) {
+            printf("%s\n    ", first ? "" : ",");
+            printJsonString(stdout, samples[i].name.c_str());
+            printf(": {\"count\": %zu, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}", v.size(),
+                   getPercentile(v, 50), getPercentile(v, 90), getPercentile(v, 99), v.back());
+        } else {
+            if (first)
+                printf("%-10s  %7s  %10s  %10s  %10s  %10s\n", label, "Count", "p50 [ms]", "p90 [ms]", "p99 [ms]",
+                       "max [ms]");
+            printf("%-10s  %7zu  %10.3f  %10.3f  %10.3f  %10.3f\n", samples[i].name.c_str(), v.size(),
+                   getPercentile(v, 50), getPercentile(v, 90), getPercentile(v, 99), v.back());
+        }
+        first = false;
+    }
+}
+
+static int parseCommands(const char *list, std::vector<CCCommand> &commands) {
+    while (*list != '\0') {
+        size_t len = strcspn(list, ",");
+        std::string name(list, len);
+        CCCommand cmd = getCommandFromName(name.c_str());
+
+        if (cmd == CCC_None) {
+            fprintf(stderr, "Unknown command: %s\n", name.c_str());
+            return EXIT_FAILURE;
+        }
+        commands.push_back(cmd);
+        list += len + (list[len] == ',');
+    }
+
+    if (commands.empty()) {
+        fprintf(stderr, "No commands specified\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Executes the command the same way sd-mux-ctrl --direct does and records timing of all its phases
+static int runCommand(CCCommand cmd, CCOptionValue options[], FILE *out, std::vector<CCPhaseTime> &phases) {
+    CCPoolDevice dev;
+    int ret;
+
+    setPhaseLog(&phases);
+    dev.ftdi = prepareDevice(options, &dev.pins, &dev.deviceType);
+    if (dev.ftdi == NULL) {
+        setPhaseLog(NULL);
+        return EXIT_FAILURE;
+    }
+
+    ret = executeCommand(&dev, cmd, options, out);
+    closeDevice(dev.ftdi);
+    setPhaseLog(NULL);
+
+    return ret;
+}
+
+int main(int argc, const char **argv) {
+    CCOptionValue options[CCO_MAX], devOptions[CCO_MAX];
+    std::vector<std::string> serials;
+    std::vector<CCCommand> commands;
+    std::vector<CCSamples> phaseSamples(CCP_MAX), commandSamples;
+    std::vector<CCPhaseTime> phases;
+    char *commandList = NULL;
+    int iterations = DEFAULT_ITERATIONS, failures = 0, c, ret = EXIT_FAILURE;
+    bool json;
+    FILE *out = NULL;
+    double start;
+
+    memset(&options, 0, sizeof(options));
+    options[CCO_DeviceId].argn = -1;
+    options[CCO_Vendor].argn = SAMSUNG_VENDOR;
+    options[CCO_Product].argn = PRODUCT;
+
+    struct poptOption optionsTable[] = {
+            { "device-serial", 'e', POPT_ARG_STRING, &options[CCO_DeviceSerial].args, 'e',
+                    "comma separated list of serial numbers of devices to use", NULL },
+            { "all", '\0', POPT_ARG_NONE, NULL, 'A', "use all connected devices", NULL },
+            { "vendor", 'x', POPT_ARG_INT, &options[CCO_Vendor].argn, 'x', "use devices with given vendor id", NULL },
+            { "product", 'a', POPT_ARG_INT, &options[CCO_Product].argn, 'a', "use devices with given product id",
+                    NULL },
+            { "iterations", 'n', POPT_ARG_INT, &iterations, 'n', "number of times each command is executed", NULL },
+            { "commands", 'c', POPT_ARG_STRING, &commandList, 'c',
+                    "comma separated list of commands: dut, ts, status, tick, init, dyper1, dyper2", NULL },
+            { "tick-time", 'm', POPT_ARG_INT, &options[CCO_TickTime].argn, 'm', "set time delay for 'tick' command",
+                    NULL },
+            { "eeprom-detect", '\0', POPT_ARG_NONE, NULL, 'E', "detect device type from EEPROM contents", NULL },
+            { "format", '\0', POPT_ARG_STRING, &options[CCO_Format].args, 'F', "output format: \"text\" or \"json\"",
+                    NULL },
+            POPT_AUTOHELP
+            { NULL, 0, 0, NULL, 0, NULL, NULL }
+    };
+
+    poptContext optCon = poptGetContext(NULL, argc, argv, optionsTable, 0);
+    while ((c = poptGetNextOpt(optCon)) >= 0) {
+        switch (c) {
+            case 'A':
+                options[CCO_All].argn = 1;
+                break;
+            case 'E':
+                options[CCO_EepromDetect].argn = 1;
+                break;
+        }
+    }
+
+    if (c < -1) {
+        fprintf(stderr, "%s: %s\n", poptBadOption(optCon, POPT_BADOPTION_NOALIAS), poptStrerror(c));
+        goto finish_him;
+    }
+
+    if (checkFormat(options) != EXIT_SUCCESS
+            || parseCommands(commandList != NULL ? commandList : DEFAULT_COMMANDS, commands) != EXIT_SUCCESS)
+        goto finish_him;
+    json = isJsonFormat(options);
+
+    if (options[CCO_DeviceSerial].args == NULL && !options[CCO_All].argn) {
+        fprintf(stderr, "No devices specified, use --device-serial or --all\n");
+        goto finish_him;
+    }
+    if (getTargetSerials(options, serials) != EXIT_SUCCESS)
+        goto finish_him;
+    if (serials.empty()) {
+        fprintf(stderr, "No devices found\n");
+        goto finish_him;
+    }
+
+    out = fopen("/dev/null", "w");
+    if (out == NULL) {
+        fprintf(stderr, "Unable to open /dev/null\n");
+        goto finish_him;
+    }
+
+    for (int i = 0; i < CCP_MAX; i++)
+        phaseSamples[i].name = getPhaseName((CCPhase)i);
+    commandSamples.resize(commands.size());
+    for (size_t i = 0; i < commands.size(); i++)
+        commandSamples[i].name = getCommandName(commands[i]);
+
+    for (int i = 0; i < iterations; i++) {
+        for (size_t d = 0; d < serials.size(); d++) {
+            for (size_t j = 0; j < commands.size(); j++) {
+                memcpy(devOptions, options, sizeof(devOptions));
+                devOptions[CCO_DeviceSerial].args = (char *)serials[d].c_str();
+                devOptions[CCO_DyPer].args = (char *)(i % 2 ? "off" : "on");
+
+                phases.clear();
+                start = getTimeMs();
+                if (runCommand(commands[j], devOptions, out, phases) != EXIT_SUCCESS) {
+                    failures++;
+                    continue;
+                }
+                commandSamples[j].values.push_back(getTimeMs() - start);
+                for (size_t k = 0; k < phases.size(); k++)
+                    phaseSamples[phases[k].phase].values.push_back(phases[k].end - phases[k].start);
+            }
+        }
+    }
+
+    if (json) {
+        printf("{\n  \"iterations\": %d,\n  \"devices\": %zu,\n  \"failures\": %d,\n  \"phases\": {",
+               iterations, serials.size(), failures);
+        printSamples(phaseSamples, true, NULL);
+        printf("\n  },\n  \"commands\": {");
+        printSamples(commandSamples, true, NULL);
+        printf("\n  }\n}\n");
+    } else {
+        printf("Devices: %zu, iterations: %d, failures: %d\n\n", serials.size(), iterations, failures);
+        printSamples(phaseSamples, false, "Phase");
+        printf("\n");
+        printSamples(commandSamples, false, "Command");
+    }
+
+    ret = failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+finish_him:
+    if (out != NULL)
+        fclose(out);
+    free(commandList);
+    poptFreeContext(optCon);
+
+    return ret;
+}
@@ -0,0 +1,243 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/blockdev.cpp
+ * @brief       Lookup of the block device of the card reader sharing a hub with the FTDI chip
+ *
+ * SDWire and SD-MUX put the FTDI chip and the card reader of a Microchip USB2640 behind its internal USB hub, so the
+ * block device of the card is the one attached to the card reader plugged into another port of the same hub. Kernel
+ * uevents tell when block devices come and go or a card is detected; a fake sysfs tree given with SDMUX_SYSFS_ROOT is
+ * scanned periodically instead.
+ */
+
+#include <dirent.h>
+#include <limits.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "blockdev.h"
+#include "sysfs.h"
+#include "timing.h"
+
+#define BLOCKDEV_AMBIGUOUS      -1
+
+struct CCCardReader {
+    CCDeviceType deviceType;
+    int vendor;
+    int product;
+};
+
+// Card readers built into the devices, USB-MUX has none
+static const CCCardReader cardReaders[] = {
+    { CCDT_SDMUX, USB2640_VENDOR, USB2640_READER_PRODUCT },
+    { CCDT_SDWIRE, USB2640_VENDOR, USB2640_READER_PRODUCT },
+};
+
+static const CCCardReader *getCardReader(CCDeviceType deviceType) {
+    for (size_t i = 0; i < sizeof(cardReaders) / sizeof(cardReaders[0]); i++) {
+        if (cardReaders[i].deviceType == deviceType)
+            return &cardReaders[i];
+    }
+
+    return NULL;
+}
+
+int checkCardReader(const char *port, CCDeviceType deviceType) {
+    if (getCardReader(deviceType) == NULL) {
+        fprintf(stderr, "Device at port %s has no card reader\n", port);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Finds the USB device the disk is attached to through one of its interfaces, provided it is plugged directly into
+ * another port of the hub the FTDI chip is plugged into. Disks behind hubs chained to the internal one are not taken.
+ */
+static bool getSiblingPort(const char *path, const char *hub, const char *port, char *sibling, size_t siblingLen) {
+    size_t hubLen = strlen(hub), len;
+    const char *c, *next;
+
+    for (c = strchr(path, '/'); c != NULL; c = next) {
+        c++;
+        len = strcspn(c, "/");
+        next = strchr(c, '/');
+        if (len <= hubLen + 1 || strncmp(c, hub, hubLen) != 0 || c[hubLen] != '.'
+                || strspn(c + hubLen + 1, "0123456789") != len - hubLen - 1)
+            continue;
+        if (strlen(port) == len && strncmp(c, port, len) == 0)
+            continue;
+        // Interface of the device follows it, e.g. "1-2.2/1-2.2:1.0"
+        if (next == NULL || strncmp(next + 1, c, len) != 0 || next[len + 1] != ':' || len >= siblingLen)
+            continue;
+
+        snprintf(sibling, siblingLen, "%.*s", (int)len, c);
+        return true;
+    }
+
+    return false;
+}
+
+static bool isCardReader(const char *port, const CCCardReader *reader) {
+    int vendor, product;
+
+    return readUsbAttributeInt(port, "idVendor", 16, &vendor) == EXIT_SUCCESS
+            && readUsbAttributeInt(port, "idProduct", 16, &product) == EXIT_SUCCESS
+            && vendor == reader->vendor && product == reader->product;
+}
+
+static void getDeviceName(const char *entry, char *name, size_t len) {
+    char attr[PATH_MAX], buf[512];
+    const char *devName;
+
+    snprintf(attr, sizeof(attr), "%s/%s/uevent", SYSFS_BLOCK_DEVICES, entry);
+    if (readSysfsAttribute(attr, buf, sizeof(buf)) == EXIT_SUCCESS && strstr(buf, "DEVNAME=") != NULL) {
+        devName = strstr(buf, "DEVNAME=") + strlen("DEVNAME=");
+        snprintf(name, len, "/dev/%.*s", (int)strcspn(devName, "\n"), devName);
+    } else {
+        snprintf(name, len, "/dev/%s", entry);
+    }
+}
+
+// Fails with BLOCKDEV_AMBIGUOUS if more than one disk is found, as the card cannot be told apart then
+static int scanBlockDevices(const char *hub, const char *port, const CCCardReader *reader, char *devPath,
+                            size_t len) {
+    char path[PATH_MAX], resolved[PATH_MAX], attr[PATH_MAX], buf[512], sibling[PORT_PATH_SIZE];
+    char other[BLOCKDEV_PATH_SIZE];
+    struct dirent *entry;
+    int found = 0;
+    DIR *dir;
+
+    snprintf(path, sizeof(path), "%s/%s", getSysfsRoot(), SYSFS_BLOCK_DEVICES);
+    dir = opendir(path);
+    if (dir == NULL)
+        return EXIT_FAILURE;
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        // Whole disk only, and only once a card is inserted
+        snprintf(attr, sizeof(attr), "%s/%s/partition", SYSFS_BLOCK_DEVICES, entry->d_name);
+        if (readSysfsAttribute(attr, buf, sizeof(buf)) == EXIT_SUCCESS)
+            continue;
+        snprintf(attr, sizeof(attr), "%s/%s/size", SYSFS_BLOCK_DEVICES, entry->d_name);
+        if (readSysfsAttribute(attr, buf, sizeof(buf)) != EXIT_SUCCESS || atoll(buf) <= 0)
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s/%s", getSysfsRoot(), SYSFS_BLOCK_DEVICES, entry->d_name);
+        if (realpath(path, resolved) == NULL || !getSiblingPort(resolved, hub, port, sibling, sizeof(sibling))
+                || !isCardReader(sibling, reader))
+            continue;
+
+        getDeviceName(entry->d_name, found == 0 ? devPath : other, found == 0 ? len : sizeof(other));
+        if (++found == 2)
+            fprintf(stderr, "Both %s and %s are behind the hub of port %s, the card cannot be told apart\n", devPath,
+                    other, port);
+    }
+    closedir(dir);
+
+    if (found > 1)
+        return BLOCKDEV_AMBIGUOUS;
+
+    return found == 1 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int getHub(const char *port, char *hub, size_t len) {
+    getParentPort(port, hub, len);
+    if (strncmp(hub, "usb", 3) == 0) {
+        fprintf(stderr, "Device at port %s is not behind a hub, its card reader cannot be told apart\n", port);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int openUeventSocket() {
+    struct sockaddr_nl addr;
+    int fd;
+
+    // Uevents describe the real sysfs only
+    if (getenv(SDMUX_SYSFS_ROOT_ENV) != NULL)
+        return -1;
+
+    fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1; // Kernel events
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int waitForBlockDevice(const char *port, CCDeviceType deviceType, int timeoutMs, char *devPath, size_t len) {
+    const CCCardReader *reader = getCardReader(deviceType);
+    double deadline = getTimeMs() + timeoutMs;
+    char hub[PORT_PATH_SIZE], buf[4096];
+    struct pollfd pfd;
+    int ret = EXIT_FAILURE, scan, wait;
+
+    if (checkCardReader(port, deviceType) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    if (getHub(port, hub, sizeof(hub)) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    // Socket is opened before the first scan, so no event in between is missed
+    pfd.fd = openUeventSocket();
+    pfd.events = POLLIN;
+
+    while ((scan = scanBlockDevices(hub, port, reader, devPath, len)) != EXIT_SUCCESS) {
+        if (scan == BLOCKDEV_AMBIGUOUS)
+            goto finish_him;
+
+        wait = timeoutMs >= 0 ? (int)(deadline - getTimeMs()) : -1;
+        if (timeoutMs >= 0 && wait <= 0) {
+            fprintf(stderr, "No block device appeared behind port %s\n", port);
+            goto finish_him;
+        }
+
+        if (pfd.fd < 0) {
+            usleep((wait < 0 || wait > BLOCKDEV_POLL_MS ? BLOCKDEV_POLL_MS : wait) * 1000);
+            continue;
+        }
+
+        if (poll(&pfd, 1, wait) > 0) {
+            // Any event is a reason to look again, their contents do not matter
+            while (recv(pfd.fd, buf, sizeof(buf), 0) > 0)
+                ;
+        }
+    }
+    ret = EXIT_SUCCESS;
+
+finish_him:
+    if (pfd.fd >= 0)
+        close(pfd.fd);
+
+    return ret;
+}
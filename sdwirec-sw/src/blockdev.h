@@ -0,0 +1,42 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/blockdev.h
+ * @brief       Lookup of the block device of the card reader sharing a hub with the FTDI chip
+ */
+
+#ifndef SDMUXCTRL_BLOCKDEV_H
+#define SDMUXCTRL_BLOCKDEV_H
+
+#include <stddef.h>
+
+#include "common.h"
+
+#define SYSFS_BLOCK_DEVICES     "class/block"
+#define BLOCKDEV_POLL_MS        500
+#define BLOCKDEV_PATH_SIZE      64
+#define USB2640_VENDOR          0x0424
+#define USB2640_READER_PRODUCT  0x4050
+
+// USB-MUX and devices of unknown type have no card reader
+int checkCardReader(const char *port, CCDeviceType deviceType);
+/*
+ * Waits until the card reader plugged into the hub of the device at the given port shows a single disk. Fails for
+ * devices without a card reader and if more than one disk is found.
+ */
+int waitForBlockDevice(const char *port, CCDeviceType deviceType, int timeoutMs, char *devPath, size_t len);
+
+#endif // SDMUXCTRL_BLOCKDEV_H
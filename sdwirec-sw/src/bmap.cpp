@@ -0,0 +1,232 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/bmap.cpp
+ * @brief       Block maps of images in the format of bmaptool
+ *
+ * Block map files are small and generated by a tool, so they are parsed by looking for the few elements of interest
+ * instead of with a full XML parser.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#include "bmap.h"
+#include "image.h"
+
+static int readFile(const char *path, std::string &content) {
+    char buf[4096];
+    size_t n;
+    FILE *file;
+
+    file = fopen(path, "re");
+    if (file == NULL) {
+        fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0 && content.size() < BMAP_MAX_FILE_SIZE)
+        content.append(buf, n);
+
+    fclose(file);
+
+    if (content.size() >= BMAP_MAX_FILE_SIZE) {
+        fprintf(stderr, "%s is too large for a block map\n", path);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Returns the text of the element with surrounding whitespace removed, or false if it is missing
+static bool getElement(const std::string &content, const char *name, std::string &value, size_t *valuePos) {
+    std::string open = std::string("<") + name + ">", close = std::string("</") + name + ">";
+    size_t start, end;
+
+    start = content.find(open);
+    if (start == std::string::npos)
+        return false;
+    start += open.size();
+    end = content.find(close, start);
+    if (end == std::string::npos)
+        return false;
+
+    while (start < end && strchr(" \t\r\n", content[start]) != NULL)
+        start++;
+    while (end > start && strchr(" \t\r\n", content[end - 1]) != NULL)
+        end--;
+
+    value = content.substr(start, end - start);
+    if (valuePos != NULL)
+        *valuePos = start;
+
+    return true;
+}
+
+static bool getNumber(const std::string &content, const char *name, uint64_t *number) {
+    std::string value;
+    char *end;
+
+    if (!getElement(content, name, value, NULL) || value.empty())
+        return false;
+
+    errno = 0;
+    *number = strtoull(value.c_str(), &end, 10);
+
+    return errno == 0 && *end == '\0';
+}
+
+static std::string getAttribute(const std::string &tag, const char *name) {
+    std::string key = std::string(name) + "=\"";
+    size_t start, end;
+
+    start = tag.find(key);
+    if (start == std::string::npos)
+        return "";
+    start += key.size();
+    end = tag.find('"', start);
+
+    return end == std::string::npos ? "" : tag.substr(start, end - start);
+}
+
+// Checksum of the file is calculated with its own value replaced by zeros
+static int checkFileChecksum(const char *path, std::string content, const std::string &value, size_t valuePos) {
+    unsigned char expected[SHA256_DIGEST_SIZE], actual[SHA256_DIGEST_SIZE];
+    CCSha256 sha;
+
+    if (sha256FromHex(value.c_str(), expected) != EXIT_SUCCESS) {
+        fprintf(stderr, "%s: invalid BmapFileChecksum\n", path);
+        return EXIT_FAILURE;
+    }
+
+    content.replace(valuePos, value.size(), value.size(), '0');
+    sha256Init(&sha);
+    sha256Update(&sha, content.data(), content.size());
+    sha256Final(&sha, actual);
+
+    if (memcmp(expected, actual, sizeof(actual)) != 0) {
+        fprintf(stderr, "%s is corrupted, its checksum does not match\n", path);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int parseRanges(const char *path, const std::string &content, bool sha256, CCBmap *bmap) {
+    size_t pos = 0, tagEnd, end;
+    unsigned long long first, last;
+    CCBmapRange range;
+    std::string tag, text, checksum;
+    char extra;
+    int n;
+
+    bmap->mappedBytes = 0;
+
+    while ((pos = content.find("<Range", pos)) != std::string::npos) {
+        tagEnd = content.find('>', pos);
+        end = tagEnd == std::string::npos ? tagEnd : content.find("</Range>", tagEnd);
+        if (end == std::string::npos) {
+            fprintf(stderr, "%s: unterminated Range element\n", path);
+            return EXIT_FAILURE;
+        }
+        tag = content.substr(pos, tagEnd - pos);
+        text = content.substr(tagEnd + 1, end - tagEnd - 1);
+        pos = end;
+
+        n = sscanf(text.c_str(), " %llu - %llu %c", &first, &last, &extra);
+        if (n == 1 && sscanf(text.c_str(), " %llu %c", &first, &extra) == 1)
+            last = first;
+        else if (n != 2) {
+            fprintf(stderr, "%s: invalid range \"%s\"\n", path, text.c_str());
+            return EXIT_FAILURE;
+        }
+
+        if (first > last || last >= bmap->blocksCount
+                || (!bmap->ranges.empty() && first <= bmap->ranges.back().last)) {
+            fprintf(stderr, "%s: range %llu-%llu is out of order or out of the image\n", path, first, last);
+            return EXIT_FAILURE;
+        }
+
+        range.first = first;
+        range.last = last;
+        checksum = getAttribute(tag, "chksum");
+        range.hasChecksum = sha256 && !checksum.empty();
+        if (range.hasChecksum && sha256FromHex(checksum.c_str(), range.checksum) != EXIT_SUCCESS) {
+            fprintf(stderr, "%s: invalid checksum of range %llu-%llu\n", path, first, last);
+            return EXIT_FAILURE;
+        }
+
+        bmap->ranges.push_back(range);
+        bmap->mappedBytes += getBmapRangeEnd(bmap, &range) - getBmapRangeStart(bmap, &range);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int loadBmap(const char *path, CCBmap *bmap) {
+    std::string content, checksumType, fileChecksum;
+    uint64_t blockSize;
+    size_t fileChecksumPos;
+    bool sha256;
+
+    if (readFile(path, content) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    if (content.find("<bmap") == std::string::npos || !getNumber(content, "ImageSize", &bmap->imageSize)
+            || !getNumber(content, "BlockSize", &blockSize) || !getNumber(content, "BlocksCount", &bmap->blocksCount)) {
+        fprintf(stderr, "%s is not a valid block map\n", path);
+        return EXIT_FAILURE;
+    }
+
+    // Mapped ranges are written in whole blocks, which must fit the buffers and O_DIRECT alignment
+    if (blockSize < BMAP_MIN_BLOCK_SIZE || blockSize > IMAGE_BUFFER_SIZE || (blockSize & (blockSize - 1)) != 0) {
+        fprintf(stderr, "%s: unsupported block size %llu\n", path, (unsigned long long)blockSize);
+        return EXIT_FAILURE;
+    }
+    bmap->blockSize = blockSize;
+
+    if (bmap->blocksCount != (bmap->imageSize + blockSize - 1) / blockSize) {
+        fprintf(stderr, "%s: BlocksCount does not match ImageSize\n", path);
+        return EXIT_FAILURE;
+    }
+
+    sha256 = getElement(content, "ChecksumType", checksumType, NULL) && checksumType == "sha256";
+    if (!sha256)
+        fprintf(stderr, "%s: checksums of type %s are not verified\n", path,
+                checksumType.empty() ? "sha1" : checksumType.c_str());
+
+    if (sha256 && getElement(content, "BmapFileChecksum", fileChecksum, &fileChecksumPos)
+            && checkFileChecksum(path, content, fileChecksum, fileChecksumPos) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    bmap->ranges.clear();
+
+    return parseRanges(path, content, sha256, bmap);
+}
+
+uint64_t getBmapRangeStart(const CCBmap *bmap, const CCBmapRange *range) {
+    return range->first * bmap->blockSize;
+}
+
+uint64_t getBmapRangeEnd(const CCBmap *bmap, const CCBmapRange *range) {
+    uint64_t end = (range->last + 1) * bmap->blockSize;
+
+    return end < bmap->imageSize ? end : bmap->imageSize;
+}
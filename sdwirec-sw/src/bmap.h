@@ -0,0 +1,57 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/bmap.h
+ * @brief       Block maps of images in the format of bmaptool
+ */
+
+#ifndef SDMUXCTRL_BMAP_H
+#define SDMUXCTRL_BMAP_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "sha256.h"
+
+#define BMAP_MAX_FILE_SIZE      (16 << 20)
+#define BMAP_MIN_BLOCK_SIZE     512
+
+struct CCBmapRange {
+    uint64_t first;         // First and last block of the range, inclusive
+    uint64_t last;
+    bool hasChecksum;
+    unsigned char checksum[SHA256_DIGEST_SIZE];
+};
+
+struct CCBmap {
+    uint64_t imageSize;
+    uint32_t blockSize;
+    uint64_t blocksCount;
+    uint64_t mappedBytes;
+    std::vector<CCBmapRange> ranges;    // Sorted and not overlapping
+};
+
+/*
+ * Range checksums and the checksum of the bmap file itself are verified only for SHA-256 (bmap format 2.0 and later).
+ * Checksums of older SHA-1 block maps are ignored.
+ */
+int loadBmap(const char *path, CCBmap *bmap);
+// Byte offsets of the range, the last block is cut at the end of the image
+uint64_t getBmapRangeStart(const CCBmap *bmap, const CCBmapRange *range);
+uint64_t getBmapRangeEnd(const CCBmap *bmap, const CCBmapRange *range);
+
+#endif // SDMUXCTRL_BMAP_H
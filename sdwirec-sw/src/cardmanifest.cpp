@@ -0,0 +1,200 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/cardmanifest.cpp
+ * @brief       Manifests of chunks last written to the card of each device
+ *
+ * The card is reachable only through the mux, so whatever was written to it last is known, unless the DUT has
+ * modified it since. Card readers do not pass CID of the card over USB, so the card is told by its size, and
+ * modifications are looked for in the chunks most likely to change: the partition table and superblocks at the start
+ * of each partition, which file systems update whenever they are mounted read-write, along with a few chunks picked
+ * at random.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/fs.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "cardmanifest.h"
+#include "partition.h"
+#include "xxhash.h"
+
+#define CARD_MANIFEST_SUFFIX    ".manifest"
+#define CARD_MANIFEST_MAGIC     "sd-mux-ctrl-card 1"
+#define CARD_MANIFEST_UNKNOWN   "-"
+
+// Serial numbers are set by users, so anything but a plain file name is replaced
+static std::string getManifestPath(const char *dir, const char *serial) {
+    std::string name = serial;
+
+    for (size_t i = 0; i < name.size(); i++) {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '-' && name[i] != '_')
+            name[i] = '_';
+    }
+
+    return std::string(dir) + "/" + name + CARD_MANIFEST_SUFFIX;
+}
+
+int getCardSize(int fd, uint64_t *size) {
+    struct stat st;
+
+    if (fstat(fd, &st) < 0)
+        return EXIT_FAILURE;
+
+    if (S_ISBLK(st.st_mode))
+        return ioctl(fd, BLKGETSIZE64, size) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    *size = st.st_size;
+
+    return EXIT_SUCCESS;
+}
+
+int loadCardManifest(const char *dir, const char *serial, CCCardManifest *manifest) {
+    char line[64];
+    unsigned long long cardSize, size, chunk;
+    uint64_t hash;
+    FILE *f;
+    int ret = EXIT_FAILURE;
+
+    f = fopen(getManifestPath(dir, serial).c_str(), "re");
+    if (f == NULL)
+        return EXIT_FAILURE;
+
+    if (fgets(line, sizeof(line), f) == NULL || strcmp(line, CARD_MANIFEST_MAGIC "\n") != 0
+            || fscanf(f, "card-size %llu\nsize %llu\nchunk %llu\n", &cardSize, &size, &chunk) != 3
+            || chunk != CARD_MANIFEST_CHUNK)
+        goto finish_him;
+
+    manifest->cardSize = cardSize;
+    manifest->size = size;
+    manifest->hashes.clear();
+    manifest->known.clear();
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strcmp(line, CARD_MANIFEST_UNKNOWN "\n") == 0)
+            hash = 0;
+        else if (sscanf(line, "%" SCNx64, &hash) != 1)
+            goto finish_him;
+        manifest->hashes.push_back(hash);
+        manifest->known.push_back(strcmp(line, CARD_MANIFEST_UNKNOWN "\n") != 0);
+    }
+
+    if (manifest->hashes.size() == (size + CARD_MANIFEST_CHUNK - 1) / CARD_MANIFEST_CHUNK)
+        ret = EXIT_SUCCESS;
+
+finish_him:
+    fclose(f);
+    return ret;
+}
+
+// Manifest is replaced at once, so it is never read half written
+int storeCardManifest(const char *dir, const char *serial, const CCCardManifest *manifest) {
+    std::string path = getManifestPath(dir, serial), tmpPath = path + ".tmp";
+    FILE *f;
+
+    mkdir(dir, 0755);
+    f = fopen(tmpPath.c_str(), "we");
+    if (f == NULL) {
+        fprintf(stderr, "Unable to store manifest of the card of %s: %s\n", serial, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    fprintf(f, CARD_MANIFEST_MAGIC "\ncard-size %llu\nsize %llu\nchunk %d\n", (unsigned long long)manifest->cardSize,
+            (unsigned long long)manifest->size, CARD_MANIFEST_CHUNK);
+    for (size_t i = 0; i < manifest->hashes.size(); i++) {
+        if (manifest->known[i])
+            fprintf(f, "%016" PRIx64 "\n", manifest->hashes[i]);
+        else
+            fprintf(f, CARD_MANIFEST_UNKNOWN "\n");
+    }
+
+    if (fclose(f) != 0 || rename(tmpPath.c_str(), path.c_str()) < 0) {
+        fprintf(stderr, "Unable to store manifest of the card of %s: %s\n", serial, strerror(errno));
+        unlink(tmpPath.c_str());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int removeCardManifest(const char *dir, const char *serial) {
+    if (unlink(getManifestPath(dir, serial).c_str()) < 0 && errno != ENOENT) {
+        fprintf(stderr, "Unable to remove manifest of the card of %s: %s\n", serial, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Only whole chunks are compared, the partial one at the end of the image cannot be read with O_DIRECT
+static bool isChunkUnchanged(int fd, const CCCardManifest *manifest, size_t chunk, unsigned char *buffer) {
+    uint64_t offset = (uint64_t)chunk * CARD_MANIFEST_CHUNK;
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < CARD_MANIFEST_CHUNK) {
+        n = pread(fd, buffer + done, CARD_MANIFEST_CHUNK - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+
+    return xxh64(buffer, CARD_MANIFEST_CHUNK, 0) == manifest->hashes[chunk];
+}
+
+static bool isWholeChunk(const CCCardManifest *manifest, size_t chunk) {
+    return chunk < manifest->hashes.size() && manifest->known[chunk]
+            && (uint64_t)(chunk + 1) * CARD_MANIFEST_CHUNK <= manifest->size;
+}
+
+bool isCardUnchanged(int fd, const CCCardManifest *manifest, unsigned char *buffer) {
+    std::vector<CCPartition> partitions;
+    size_t wholeChunks = manifest->size / CARD_MANIFEST_CHUNK, chunk;
+    unsigned seed = time(NULL) ^ getpid();
+    uint64_t cardSize;
+
+    if (getCardSize(fd, &cardSize) != EXIT_SUCCESS || cardSize != manifest->cardSize)
+        return false;
+
+    // Without the partition table the file systems cannot be checked
+    if (!isWholeChunk(manifest, 0) || !isChunkUnchanged(fd, manifest, 0, buffer))
+        return false;
+
+    parsePartitionTable(buffer, CARD_MANIFEST_CHUNK, partitions);
+    for (size_t i = 0; i < partitions.size(); i++) {
+        chunk = partitions[i].start / CARD_MANIFEST_CHUNK;
+        if (isWholeChunk(manifest, chunk) && !isChunkUnchanged(fd, manifest, chunk, buffer))
+            return false;
+    }
+
+    for (int i = 0; i < CARD_MANIFEST_SAMPLES && wholeChunks > 0; i++) {
+        chunk = rand_r(&seed) % wholeChunks;
+        if (isWholeChunk(manifest, chunk) && !isChunkUnchanged(fd, manifest, chunk, buffer))
+            return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,52 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/cardmanifest.h
+ * @brief       Manifests of chunks last written to the card of each device
+ */
+
+#ifndef SDMUXCTRL_CARDMANIFEST_H
+#define SDMUXCTRL_CARDMANIFEST_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#define CARD_MANIFEST_CHUNK     (256 << 10)     // Unit of manifest hashes, the same as of --delta
+#define CARD_MANIFEST_SAMPLES   16              // Chunks read at random to tell whether the card has been modified
+
+struct CCCardManifest {
+    uint64_t cardSize;
+    uint64_t size;                  // Bytes of the image written
+    std::vector<uint64_t> hashes;   // XXH64 of each CARD_MANIFEST_CHUNK bytes, the last chunk may be shorter
+    std::vector<bool> known;        // Chunks holding skipped blocks are not known
+};
+
+int getCardSize(int fd, uint64_t *size);
+
+int loadCardManifest(const char *dir, const char *serial, CCCardManifest *manifest);
+int storeCardManifest(const char *dir, const char *serial, const CCCardManifest *manifest);
+// Manifest is removed before the card is written, so an interrupted write never leaves a stale one behind
+int removeCardManifest(const char *dir, const char *serial);
+
+/*
+ * Reads the first chunk of the card, the first chunk of each partition found in it and CARD_MANIFEST_SAMPLES chunks
+ * at random and compares them with the manifest. Buffer of CARD_MANIFEST_CHUNK bytes has to be aligned for O_DIRECT.
+ */
+bool isCardUnchanged(int fd, const CCCardManifest *manifest, unsigned char *buffer);
+
+#endif // SDMUXCTRL_CARDMANIFEST_H
@@ -0,0 +1,35 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/cli.h
+ * @brief       Command line handling shared by sd-mux-ctrl modes
+ */
+
+#ifndef SDMUXCTRL_CLI_H
+#define SDMUXCTRL_CLI_H
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "common.h"
+#include "pool.h"
+
+// Every command found is appended to actions in the order of appearance, *cmd is set to the last one
+int parseArguments(int argc, const char **argv, CCCommand *cmd, std::vector<CCAction> *actions, int *arg, char *args,
+                   size_t argsLen, CCOptionValue options[]);
+
+#endif // SDMUXCTRL_CLI_H
@@ -0,0 +1,126 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/common.h
+ * @brief       Definitions shared by all sd-mux-ctrl modules
+ */
+
+#ifndef SDMUXCTRL_COMMON_H
+#define SDMUXCTRL_COMMON_H
+
+#define PRODUCT 0x6001
+#define SAMSUNG_VENDOR 0x04e8
+
+// SDMUX specific definitions
+#define SOCKET_SEL      (0x01 << 0x00)
+#define USB_SEL         (0x01 << 0x03)
+#define POWER_SW_OFF    (0x01 << 0x02)
+#define POWER_SW_ON     (0x01 << 0x04)
+#define DYPER1          (0x01 << 0x05)
+#define DYPER2          (0x01 << 0x06)
+
+// USBMUX specific definitions
+#define UM_SOCKET_SEL	(0x01 << 0x00)
+#define UM_DEVICE_PWR	(0x01 << 0x01)
+#define UM_DUT_LED		(0x01 << 0x02)
+#define UM_GP_LED		(0x01 << 0x03)
+
+#define CCDT_SDMUX_STR  "sd-mux"
+#define CCDT_SDWIRE_STR "sd-wire"
+#define CCDT_USBMUX_STR "usb-mux"
+
+#define STRING_SIZE     128
+
+enum CCCommand {
+    CCC_List,
+    CCC_DUT,
+    CCC_TS,
+    CCC_Tick,
+    CCC_Pins,
+    CCC_Info,
+    CCC_ShowSerial,
+    CCC_SetSerial,
+    CCC_Init,
+    CCC_Status,
+    CCC_DyPer1,
+    CCC_DyPer2,
+    CCC_Daemon,
+    CCC_Batch,
+    CCC_WaitFor,
+    CCC_Flash,
+    CCC_None
+};
+
+enum Target {
+    T_DUT,
+    T_TS
+};
+
+enum CCDeviceType {
+    CCDT_SDMUX,
+    CCDT_SDWIRE,
+	CCDT_USBMUX,
+    CCDT_MAX
+};
+
+enum CCFeature {
+    CCF_SDMUX,
+    CCF_POWERSWITCH,
+    CCF_USBMUX,
+    CCF_DYPERS,
+    CCF_MAX
+};
+
+enum CCOption {
+    CCO_DeviceId,
+    CCO_DeviceSerial,
+    CCO_TickTime,
+    CCO_BitsInvert,
+    CCO_Vendor,
+    CCO_Product,
+    CCO_DyPer,
+    CCO_DeviceType,
+    CCO_Socket,
+    CCO_Direct,
+    CCO_EepromDetect,
+    CCO_Format,
+    CCO_BatchFile,
+    CCO_All,
+    CCO_Jobs,
+    CCO_Timings,
+    CCO_MetricsPort,
+    CCO_Timeout,
+    CCO_WaitBlockdev,
+    CCO_FlashImage,
+    CCO_Blockdev,
+    CCO_Bmap,
+    CCO_Sparse,
+    CCO_Discard,
+    CCO_Delta,
+    CCO_Verify,
+    CCO_ImageCache,
+    CCO_ImageCacheSize,
+    CCO_CardManifest,
+    CCO_Partition,
+    CCO_MAX
+};
+
+union CCOptionValue {
+    int argn;
+    char *args;
+};
+
+#endif // SDMUXCTRL_COMMON_H
@@ -0,0 +1,794 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/daemon.cpp
+ * @brief       sd-mux-ctrld - long running controller keeping devices open
+ *
+ * The daemon opens each device on its first request and keeps the ftdi context, device type and pin state
+ * for all following ones. Switching sequences of all devices run concurrently from the daemon's event loop, and
+ * the client is answered once its sequence finishes. Clients talk to it over a UNIX stream socket, one request
+ * per connection. Requests are read without blocking from the event loop and handled once their whole line arrived:
+ *
+ *   request:  "<command> <serial|#id> <argument>\n"
+ *   response: command output followed by "rc <exit code>\n"
+ *
+ * Besides the commands, "list - -" returns the device inventory and "state <serial|#id> -" returns device type and
+ * pin state read without touching the bitmode.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "daemon.h"
+#include "device.h"
+#include "inventory.h"
+#include "metrics.h"
+#include "pool.h"
+#include "sequencer.h"
+#include "timing.h"
+
+#define REQUEST_SIZE            512
+#define REQUEST_TIMEOUT_MS      1000    // Clients which do not send their request in time are dropped
+#define RESPONSE_TIMEOUT_MS     1000
+#define RESPONSE_MARGIN_MS      5000    // Time the daemon gets on top of the tick time of a request to respond
+#define LIST_REQUEST            "list"
+#define STATE_REQUEST           "state"
+
+struct CCDaemonCommand {
+    CCCommand cmd;
+    const char *name;
+};
+
+static const CCDaemonCommand daemonCommands[] = {
+        { CCC_DUT, "dut" },
+        { CCC_TS, "ts" },
+        { CCC_Status, "status" },
+        { CCC_Tick, "tick" },
+        { CCC_Init, "init" },
+        { CCC_DyPer1, "dyper1" },
+        { CCC_DyPer2, "dyper2" },
+};
+
+enum CCClientState {
+    CCCS_Reading,
+    CCCS_Complete,
+    CCCS_Closed
+};
+
+// Connection whose request is being read, without blocking the event loop
+struct CCDaemonClient {
+    int fd;
+    bool metrics;           // HTTP client of the metrics endpoint
+    std::string request;
+    double deadline;
+};
+
+struct CCDaemonRequest {
+    CCSequence seq;
+    CCPoolDevice *dev;
+    CCCommand cmd;
+    int fd;
+};
+
+static volatile sig_atomic_t terminateDaemon = 0;
+
+const char *getCommandName(CCCommand cmd) {
+    for (size_t i = 0; i < sizeof(daemonCommands) / sizeof(daemonCommands[0]); i++) {
+        if (daemonCommands[i].cmd == cmd)
+            return daemonCommands[i].name;
+    }
+    return NULL;
+}
+
+CCCommand getCommandFromName(const char *name) {
+    for (size_t i = 0; i < sizeof(daemonCommands) / sizeof(daemonCommands[0]); i++) {
+        if (strcmp(daemonCommands[i].name, name) == 0)
+            return daemonCommands[i].cmd;
+    }
+    return CCC_None;
+}
+
+const char *getSocketPath(CCOptionValue options[]) {
+    const char *path = options[CCO_Socket].args;
+
+    if (path == NULL)
+        path = getenv(SDMUX_SOCKET_ENV);
+    if (path == NULL || *path == '\0')
+        path = SDMUX_DEFAULT_SOCKET;
+
+    return path;
+}
+
+static int fillAddress(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return EXIT_FAILURE;
+    }
+    strcpy(addr->sun_path, path);
+    return EXIT_SUCCESS;
+}
+
+static int connectDaemon(const char *path) {
+    struct sockaddr_un addr;
+    int fd;
+
+    if (fillAddress(path, &addr) != EXIT_SUCCESS)
+        return -1;
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// Returns CCD_NOT_HANDLED if there is no daemon, otherwise output of the request is stored in response. A daemon
+// which does not finish its response within the tick time of the request and a margin is given up on.
+static int sendRequest(CCOptionValue options[], const char *request, std::string &response, int *rc) {
+    int period = options[CCO_TickTime].argn > 0 ? options[CCO_TickTime].argn : DEFAULT_PERIOD;
+    double deadline = getTimeMs() + period + RESPONSE_MARGIN_MS;
+    char buf[REQUEST_SIZE];
+    struct pollfd pfd;
+    size_t lineStart;
+    ssize_t n;
+    int fd, wait;
+
+    fd = connectDaemon(getSocketPath(options));
+    if (fd < 0)
+        return CCD_NOT_HANDLED;
+
+    dprintf(fd, "%s\n", request);
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    for (;;) {
+        wait = (int)(deadline - getTimeMs());
+        if (wait <= 0 || (n = poll(&pfd, 1, wait)) == 0) {
+            fprintf(stderr, "sd-mux-ctrld did not respond to '%s' in time\n", request);
+            close(fd);
+            return EXIT_FAILURE;
+        }
+        if (n > 0 && (n = read(fd, buf, sizeof(buf))) == 0)
+            break;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Connection to sd-mux-ctrld failed: %s\n", strerror(errno));
+            close(fd);
+            return EXIT_FAILURE;
+        }
+        response.append(buf, n);
+    }
+    close(fd);
+
+    lineStart = response.rfind("rc ");
+    if (lineStart == std::string::npos || (lineStart > 0 && response[lineStart - 1] != '\n')) {
+        fprintf(stderr, "Invalid response from sd-mux-ctrld\n");
+        return EXIT_FAILURE;
+    }
+
+    *rc = atoi(response.c_str() + lineStart + 3);
+    response.resize(lineStart);
+
+    return EXIT_SUCCESS;
+}
+
+int daemonRequest(CCCommand cmd, CCOptionValue options[], FILE *out) {
+    const char *name = getCommandName(cmd);
+    char selector[SELECTOR_SIZE], request[REQUEST_SIZE];
+    std::string response;
+    double start;
+    int ret, rc;
+
+    if (name == NULL)
+        return CCD_NOT_HANDLED;
+
+    if (getSelector(options, selector, sizeof(selector)) != EXIT_SUCCESS)
+        return CCD_NOT_HANDLED; // Let the regular path report the missing device
+
+    if (cmd == CCC_DyPer1 || cmd == CCC_DyPer2) {
+        snprintf(request, sizeof(request), "%s %s %s", name, selector, options[CCO_DyPer].args);
+    } else {
+        snprintf(request, sizeof(request), "%s %s %d", name, selector, options[CCO_TickTime].argn);
+    }
+
+    start = getTimeMs();
+    ret = sendRequest(options, request, response, &rc);
+    if (ret != EXIT_SUCCESS)
+        return ret;
+    recordPhase(CCP_Daemon, start);
+
+    fwrite(response.data(), 1, response.size(), out);
+    if (rc != EXIT_SUCCESS)
+        fprintf(stderr, "sd-mux-ctrld failed to execute '%s' on %s, see its log for details.\n", name, selector);
+
+    return rc;
+}
+
+// Device fields are sent tab separated, one device per line
+static void printInventory(FILE *out) {
+    std::vector<CCUsbDevice> devices;
+
+    getInventory(devices);
+    for (size_t i = 0; i < devices.size(); i++) {
+        fprintf(out, "%s\t%d\t%d\t%x\t%x\t%s\t%s\t%s\n", devices[i].port, devices[i].busnum, devices[i].devnum,
+                devices[i].vendor, devices[i].product, devices[i].manufacturer, devices[i].description,
+                devices[i].serial);
+    }
+}
+
+// Copies the field up to the next tab or end of line and moves past it
+static const char *readField(const char *p, char *buf, size_t len) {
+    size_t n = strcspn(p, "\t\n");
+
+    snprintf(buf, len, "%.*s", (int)n, p);
+
+    return p[n] == '\t' ? p + n + 1 : p + n;
+}
+
+int daemonListDevices(CCOptionValue options[], std::vector<CCUsbDevice> &devices) {
+    std::string response;
+    char number[16];
+    const char *p;
+    CCUsbDevice dev;
+    int ret, rc;
+
+    ret = sendRequest(options, LIST_REQUEST " - -", response, &rc);
+    if (ret != EXIT_SUCCESS)
+        return ret;
+    if (rc != EXIT_SUCCESS)
+        return CCD_NOT_HANDLED; // Let the regular path enumerate devices
+
+    for (p = response.c_str(); *p != '\0'; p += *p == '\n') {
+        p = readField(p, dev.port, sizeof(dev.port));
+        p = readField(p, number, sizeof(number));
+        dev.busnum = atoi(number);
+        p = readField(p, number, sizeof(number));
+        dev.devnum = atoi(number);
+        p = readField(p, number, sizeof(number));
+        dev.vendor = strtol(number, NULL, 16);
+        p = readField(p, number, sizeof(number));
+        dev.product = strtol(number, NULL, 16);
+        p = readField(p, dev.manufacturer, sizeof(dev.manufacturer));
+        p = readField(p, dev.description, sizeof(dev.description));
+        p = readField(p, dev.serial, sizeof(dev.serial));
+        // Skip whatever a newer daemon might add
+        p += strcspn(p, "\n");
+        devices.push_back(dev);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int daemonReadState(CCOptionValue options[], CCDeviceType *deviceType, unsigned char *pins) {
+    char selector[SELECTOR_SIZE], request[REQUEST_SIZE], type[16];
+    std::string response;
+    unsigned int value;
+    double start;
+    int ret, rc;
+
+    if (getSelector(options, selector, sizeof(selector)) != EXIT_SUCCESS)
+        return CCD_NOT_HANDLED;
+
+    snprintf(request, sizeof(request), STATE_REQUEST " %s -", selector);
+    start = getTimeMs();
+    ret = sendRequest(options, request, response, &rc);
+    if (ret != EXIT_SUCCESS)
+        return ret;
+    recordPhase(CCP_Daemon, start);
+
+    if (rc != EXIT_SUCCESS) {
+        fprintf(stderr, "sd-mux-ctrld failed to read state of %s, see its log for details.\n", selector);
+        return rc;
+    }
+
+    if (sscanf(response.c_str(), "%15s %x", type, &value) != 2 || getDeviceTypeFromString(type) == CCDT_MAX) {
+        fprintf(stderr, "Invalid response from sd-mux-ctrld\n");
+        return EXIT_FAILURE;
+    }
+    *deviceType = getDeviceTypeFromString(type);
+    *pins = value;
+
+    return EXIT_SUCCESS;
+}
+
+// Sends the actions one by one, the daemon keeps the device open between them
+int daemonRequestActions(const std::vector<CCAction> &actions, CCOptionValue options[], FILE *out) {
+    int ret;
+
+    for (size_t i = 0; i < actions.size(); i++) {
+        applyAction(actions[i], options);
+        ret = daemonRequest(actions[i].cmd, options, out);
+        if (ret == CCD_NOT_HANDLED && i > 0) {
+            fprintf(stderr, "sd-mux-ctrld went away before '%s' was executed\n", getCommandName(actions[i].cmd));
+            return EXIT_FAILURE;
+        }
+        if (ret != EXIT_SUCCESS)
+            return ret;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static void onSequenceDone(CCSequence *seq) {
+    CCDaemonRequest *req = (CCDaemonRequest *)seq->data;
+    const char *device = req->dev->selector.c_str();
+
+    observeSequence(device, req->cmd, getTimeMs() - seq->start);
+    countCommand(device, req->cmd, seq->ret);
+
+    req->dev->busy = false;
+    if (seq->ret != EXIT_SUCCESS && req->dev->ftdi->error_str != NULL)
+        countError(device, req->dev->ftdi->error_str);
+    if (seq->ret != EXIT_SUCCESS || req->dev->stale)
+        dropPoolDevice(req->dev);
+
+    dprintf(req->fd, "rc %d\n", seq->ret);
+    close(req->fd);
+    delete req;
+}
+
+/*
+ * Pins are read as they are, even while a sequence of the device is in progress. A device which is not in the pool
+ * is only opened for the read, neither switched into bitbang mode nor kept open.
+ */
+static int printState(const char *selector, CCOptionValue options[], FILE *out) {
+    CCOptionValue reqOptions[CCO_MAX];
+    struct ftdi_context *ftdi;
+    CCDeviceType deviceType;
+    CCPoolDevice *dev;
+    unsigned char pins;
+    int ret;
+
+    memcpy(reqOptions, options, sizeof(reqOptions));
+    if (applySelector(selector, reqOptions) != EXIT_SUCCESS) {
+        fprintf(stderr, "Invalid device selector: %s\n", selector);
+        return EXIT_FAILURE;
+    }
+
+    dev = findPoolDevice(selector);
+    if (dev != NULL) {
+        if (readPinState(dev->ftdi, &pins) != EXIT_SUCCESS) {
+            if (!dev->busy)
+                dropPoolDevice(dev);
+            return EXIT_FAILURE;
+        }
+        deviceType = dev->deviceType;
+    } else {
+        ftdi = openDevice(reqOptions, &deviceType);
+        if (ftdi == NULL)
+            return EXIT_FAILURE;
+        ret = readPinState(ftdi, &pins);
+        closeDevice(ftdi);
+        if (ret != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+    }
+
+    fprintf(out, "%s 0x%02x\n", getDeviceTypeName(deviceType), pins);
+
+    return EXIT_SUCCESS;
+}
+
+// Returns true if the client is left waiting for completion of a sequence
+static bool handleClient(int fd, const char *request, CCOptionValue options[], CCSequencer *sequencer) {
+    char name[16], selector[SELECTOR_SIZE], arg[32];
+    CCOptionValue reqOptions[CCO_MAX];
+    std::vector<CCPhaseTime> phases;
+    CCDaemonRequest *req;
+    CCPoolDevice *dev;
+    CCCommand cmd;
+    double start;
+    FILE *out;
+    int ret = EXIT_FAILURE;
+
+    out = fdopen(dup(fd), "w");
+    if (out == NULL)
+        return false;
+
+    if (sscanf(request, "%15s %129s %31s", name, selector, arg) != 3) {
+        fprintf(stderr, "Malformed request: %s", request);
+        goto finish_him;
+    }
+
+    if (strcmp(name, LIST_REQUEST) == 0) {
+        if (isInventoryRunning()) {
+            printInventory(out);
+            ret = EXIT_SUCCESS;
+        }
+        goto finish_him;
+    }
+
+    if (strcmp(name, STATE_REQUEST) == 0) {
+        ret = printState(selector, options, out);
+        goto finish_him;
+    }
+
+    cmd = getCommandFromName(name);
+    if (cmd == CCC_None) {
+        fprintf(stderr, "Unknown command: %s\n", name);
+        goto finish_him;
+    }
+
+    memcpy(reqOptions, options, sizeof(reqOptions));
+    if (applySelector(selector, reqOptions) != EXIT_SUCCESS) {
+        fprintf(stderr, "Invalid device selector: %s\n", selector);
+        goto finish_him;
+    }
+    reqOptions[CCO_TickTime].argn = atoi(arg);
+    reqOptions[CCO_DyPer].args = arg;
+
+    // Device is opened unless it is in the pool already, which is told by the phases recorded
+    setPhaseLog(&phases);
+    start = getTimeMs();
+    dev = getPoolDevice(reqOptions);
+    setPhaseLog(NULL);
+    if (dev == NULL) {
+        countCommand(selector, cmd, EXIT_FAILURE);
+        countError(selector, "unable to open device");
+        goto finish_him;
+    }
+    if (!phases.empty())
+        observeOpen(selector, getTimeMs() - start);
+
+    if (dev->busy) {
+        fprintf(stderr, "Device %s is busy\n", selector);
+        countCommand(selector, cmd, EXIT_FAILURE);
+        goto finish_him;
+    }
+
+    // Error string is not cleared by libftdi, so forget errors reported for previous requests
+    dev->ftdi->error_str = NULL;
+
+    if (isSequenceCommand(cmd)) {
+        req = new CCDaemonRequest();
+        if (buildSequence(dev, cmd, reqOptions, &req->seq) != EXIT_SUCCESS) {
+            delete req;
+            goto finish_him;
+        }
+        req->dev = dev;
+        req->cmd = cmd;
+        req->fd = fd;
+        req->seq.done = onSequenceDone;
+        req->seq.data = req;
+        dev->busy = true;
+
+        fclose(out);
+        sequencerAdd(sequencer, &req->seq);
+        return true;
+    }
+
+    ret = executeCommand(dev, cmd, reqOptions, out);
+    countCommand(selector, cmd, ret);
+    if (ret != EXIT_SUCCESS) {
+        if (dev->ftdi->error_str != NULL)
+            countError(selector, dev->ftdi->error_str);
+        // Device might have been unplugged or reset. Start from scratch on the next request.
+        dropPoolDevice(dev);
+    }
+
+finish_him:
+    fprintf(out, "rc %d\n", ret);
+    fclose(out);
+
+    return false;
+}
+
+// Requests end with their line, HTTP requests of the metrics endpoint with the empty line after the header
+static size_t getRequestEnd(const CCDaemonClient *client) {
+    size_t end;
+
+    if (!client->metrics) {
+        end = client->request.find('\n');
+        return end != std::string::npos ? end + 1 : end;
+    }
+
+    end = client->request.find("\r\n\r\n");
+    if (end != std::string::npos)
+        return end + 4;
+    end = client->request.find("\n\n");
+    return end != std::string::npos ? end + 2 : end;
+}
+
+// Reads whatever has arrived, the request is complete once it ends or fills the buffer
+static CCClientState readRequest(CCDaemonClient *client) {
+    char buf[REQUEST_SIZE];
+    size_t end;
+    ssize_t n;
+
+    for (;;) {
+        n = read(client->fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return CCCS_Reading;
+        if (n <= 0)
+            return CCCS_Closed;
+
+        client->request.append(buf, n);
+        end = getRequestEnd(client);
+        if (end != std::string::npos) {
+            client->request.resize(end);
+            return CCCS_Complete;
+        }
+        if (client->request.size() >= REQUEST_SIZE - 1) {
+            client->request.resize(REQUEST_SIZE - 1);
+            return CCCS_Complete;
+        }
+    }
+}
+
+static void acceptClient(int listenFd, bool metrics, std::vector<CCDaemonClient> &clients) {
+    CCDaemonClient client;
+
+    client.fd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (client.fd < 0)
+        return;
+
+    client.metrics = metrics;
+    client.deadline = getTimeMs() + REQUEST_TIMEOUT_MS;
+    clients.push_back(client);
+}
+
+// Responses are short, so they are written at once, but a client which does not read them is not waited for long
+static void setResponseMode(int fd) {
+    struct timeval timeout = { RESPONSE_TIMEOUT_MS / 1000, 0 };
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+static void handleMetricsClient(int fd);
+
+/*
+ * Clients whose request has arrived completely are served, the ones which have gone away or have not sent their
+ * request in time are dropped. Revents of the clients start at the given index of fds.
+ */
+static void handleClients(std::vector<CCDaemonClient> &clients, const std::vector<struct pollfd> &fds, size_t first,
+                          CCOptionValue options[], CCSequencer *sequencer) {
+    std::vector<CCDaemonClient> waiting;
+    CCClientState state;
+    double now = getTimeMs();
+
+    for (size_t i = 0; i < clients.size(); i++) {
+        CCDaemonClient &client = clients[i];
+
+        state = fds[first + i].revents != 0 ? readRequest(&client) : CCCS_Reading;
+        if (state == CCCS_Reading && now < client.deadline) {
+            waiting.push_back(client);
+            continue;
+        }
+
+        if (state == CCCS_Complete) {
+            setResponseMode(client.fd);
+            if (client.metrics)
+                handleMetricsClient(client.fd);
+            // Client is answered once its sequence finishes
+            else if (handleClient(client.fd, client.request.c_str(), options, sequencer))
+                continue;
+        }
+        close(client.fd);
+    }
+
+    clients.swap(waiting);
+}
+
+// Wakes the event loop up for the earliest deadline of a client still sending its request
+static int getPollTimeout(const std::vector<CCDaemonClient> &clients) {
+    int timeout = getInventoryTimeout(), left;
+    double now = getTimeMs();
+
+    for (size_t i = 0; i < clients.size(); i++) {
+        left = clients[i].deadline > now ? (int)(clients[i].deadline - now) + 1 : 0;
+        if (timeout < 0 || left < timeout)
+            timeout = left;
+    }
+
+    return timeout;
+}
+
+// Whatever is asked for, the answer is the same
+static void handleMetricsClient(int fd) {
+    FILE *out;
+
+    out = fdopen(dup(fd), "w");
+    if (out == NULL)
+        return;
+
+    fprintf(out, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n");
+    printMetrics(out);
+    fclose(out);
+}
+
+static int listenMetrics(int port) {
+    struct sockaddr_in addr;
+    int fd, on = 1;
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to create metrics socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+        fprintf(stderr, "Unable to listen on port %d: %s\n", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void onHotplug(const CCUsbDevice *dev, bool arrived) {
+    fprintf(stderr, "Device %s %s port %s\n", dev->serial, arrived ? "plugged into" : "unplugged from", dev->port);
+    if (arrived)
+        return;
+
+    dropUnpluggedDevices(dev);
+}
+
+static void onTerminate(int) {
+    terminateDaemon = 1;
+}
+
+int runDaemon(CCOptionValue options[]) {
+    const char *path = getSocketPath(options);
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    struct pollfd pfd[3];
+    std::vector<struct pollfd> fds;
+    std::vector<CCDaemonClient> clients;
+    CCSequencer sequencer;
+    bool inventoryEvent;
+    int fd, client, metricsFd = -1;
+    nfds_t nfds = 2;
+    size_t firstClient;
+
+    if (fillAddress(path, &addr) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    client = connectDaemon(path);
+    if (client >= 0) {
+        close(client);
+        fprintf(stderr, "sd-mux-ctrld is already running on %s\n", path);
+        return EXIT_FAILURE;
+    }
+    unlink(path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to create socket: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || chmod(path, 0660) < 0 || listen(fd, 16) < 0) {
+        fprintf(stderr, "Unable to listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onTerminate;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(stderr, "sd-mux-ctrld listening on %s\n", path);
+
+    if (options[CCO_MetricsPort].argn > 0) {
+        metricsFd = listenMetrics(options[CCO_MetricsPort].argn);
+        if (metricsFd < 0) {
+            close(fd);
+            unlink(path);
+            return EXIT_FAILURE;
+        }
+        fprintf(stderr, "Metrics available at http://127.0.0.1:%d/metrics\n", options[CCO_MetricsPort].argn);
+    }
+
+    if (sequencerInit(&sequencer) != EXIT_SUCCESS) {
+        if (metricsFd >= 0)
+            close(metricsFd);
+        close(fd);
+        unlink(path);
+        return EXIT_FAILURE;
+    }
+
+    if (startInventory(options[CCO_Vendor].argn, options[CCO_Product].argn, onHotplug) != EXIT_SUCCESS)
+        fprintf(stderr, "Device inventory is not available\n");
+
+    pfd[0].fd = fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = sequencer.timerFd;
+    pfd[1].events = POLLIN;
+    if (metricsFd >= 0) {
+        pfd[2].fd = metricsFd;
+        pfd[2].events = POLLIN;
+        nfds = 3;
+    }
+    while (!terminateDaemon) {
+        fds.assign(pfd, pfd + nfds);
+        getInventoryFds(fds);
+        firstClient = fds.size();
+        for (size_t i = 0; i < clients.size(); i++) {
+            struct pollfd clientFd = { clients[i].fd, POLLIN, 0 };
+            fds.push_back(clientFd);
+        }
+        if (poll(fds.data(), fds.size(), getPollTimeout(clients)) < 0)
+            continue;
+
+        inventoryEvent = getInventoryTimeout() == 0;
+        for (size_t i = nfds; i < firstClient; i++)
+            inventoryEvent = inventoryEvent || fds[i].revents != 0;
+        if (isInventoryRunning() && inventoryEvent)
+            handleInventoryEvents(0);
+
+        if (fds[1].revents & POLLIN)
+            sequencerDispatch(&sequencer);
+
+        handleClients(clients, fds, firstClient, options, &sequencer);
+
+        if (fds[0].revents & POLLIN)
+            acceptClient(fd, false, clients);
+        if (nfds > 2 && (fds[2].revents & POLLIN))
+            acceptClient(metricsFd, true, clients);
+    }
+
+    for (size_t i = 0; i < clients.size(); i++)
+        close(clients[i].fd);
+
+    // Let sequences in progress finish, so relays are not left with their coils powered
+    while (!sequencer.active.empty()) {
+        if (poll(&pfd[1], 1, -1) > 0)
+            sequencerDispatch(&sequencer);
+    }
+    sequencerClose(&sequencer);
+
+    closePool();
+    stopInventory();
+
+    if (metricsFd >= 0)
+        close(metricsFd);
+    close(fd);
+    unlink(path);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,47 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/daemon.h
+ * @brief       sd-mux-ctrld - long running controller keeping devices open
+ */
+
+#ifndef SDMUXCTRL_DAEMON_H
+#define SDMUXCTRL_DAEMON_H
+
+#include <stdio.h>
+
+#include <vector>
+
+#include "common.h"
+#include "pool.h"
+#include "sysfs.h"
+
+#define SDMUX_DEFAULT_SOCKET    "/run/sd-mux-ctrl.sock"
+#define SDMUX_SOCKET_ENV        "SDMUX_CTRL_SOCKET"
+
+// Returned by daemonRequest() when there is no daemon to talk to or the command is not handled by it.
+#define CCD_NOT_HANDLED         -1
+
+const char *getCommandName(CCCommand cmd);
+CCCommand getCommandFromName(const char *name);
+const char *getSocketPath(CCOptionValue options[]);
+int runDaemon(CCOptionValue options[]);
+int daemonRequest(CCCommand cmd, CCOptionValue options[], FILE *out);
+int daemonListDevices(CCOptionValue options[], std::vector<CCUsbDevice> &devices);
+int daemonReadState(CCOptionValue options[], CCDeviceType *deviceType, unsigned char *pins);
+int daemonRequestActions(const std::vector<CCAction> &actions, CCOptionValue options[], FILE *out);
+
+#endif // SDMUXCTRL_DAEMON_H
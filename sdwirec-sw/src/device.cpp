@@ -0,0 +1,370 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/device.cpp
+ * @brief       Operations on opened sd-mux devices
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "backend.h"
+#include "device.h"
+#include "inventory.h"
+#include "json.h"
+#include "pathcache.h"
+#include "pinshadow.h"
+#include "sysfs.h"
+#include "timing.h"
+
+CCDeviceType getDeviceTypeFromString(const char *deviceTypeStr) {
+    if (strcmp(CCDT_SDMUX_STR, deviceTypeStr) == 0) {
+        return CCDT_SDMUX;
+    }
+
+    if (strcmp(CCDT_SDWIRE_STR, deviceTypeStr) == 0) {
+        return CCDT_SDWIRE;
+    }
+
+    if (strcmp(CCDT_USBMUX_STR, deviceTypeStr) == 0) {
+        return CCDT_USBMUX;
+    }
+
+    return CCDT_MAX;
+}
+
+const char *getDeviceTypeName(CCDeviceType deviceType) {
+    switch (deviceType) {
+    case CCDT_SDMUX:
+        return CCDT_SDMUX_STR;
+    case CCDT_SDWIRE:
+        return CCDT_SDWIRE_STR;
+    case CCDT_USBMUX:
+        return CCDT_USBMUX_STR;
+    default:
+        return NULL;
+    }
+}
+
+bool hasFeature(CCDeviceType deviceType, CCFeature feature) {
+    static const bool featureMatrix[CCDT_MAX][CCF_MAX] = {
+            {true, true, true, true},           // SD-MUX features
+            {true, false, false, false},        // SDWire features
+			{false, false, true, false},        // SDWire features
+    };
+
+    if (deviceType >= CCDT_MAX || feature >= CCF_MAX)
+        return false;
+
+    return featureMatrix[deviceType][feature];
+}
+
+int readEeprom(struct ftdi_context *ftdi) {
+    double start = getTimeMs();
+    int fret;
+
+    fret = getBackend()->readEeprom(ftdi);
+    recordPhase(CCP_Eeprom, start);
+    if (fret < 0) {
+        fprintf(stderr, "Unable to read ftdi eeprom: %d (%s)\n", fret, ftdi_get_error_string(ftdi));
+        return EXIT_FAILURE;
+    }
+
+    fret = getBackend()->decodeEeprom(ftdi);
+    if (fret < 0) {
+        fprintf(stderr, "Unable to decode ftdi eeprom: %d (%s)\n", fret, ftdi_get_error_string(ftdi));
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+struct ftdi_context* openDevice(CCOptionValue options[], CCDeviceType *deviceType) {
+    struct ftdi_context *ftdi = NULL;
+    int fret;
+    char product[STRING_SIZE + 1];
+    CCDeviceType tmpDeviceType;
+    CCDevicePath devPath;
+    std::vector<CCUsbDevice> usbDevices;
+    CCUsbDevice usbDevice;
+    bool cached = false;
+    double start;
+
+    if ((options[CCO_DeviceSerial].args == NULL) && (options[CCO_DeviceId].argn < 0)) {
+        fprintf(stderr, "No serial number or device id provided!\n");
+        return NULL;
+    }
+
+    if ((ftdi = ftdi_new()) == 0) {
+        fprintf(stderr, "ftdi_new failed\n");
+        return NULL;
+    }
+
+    start = getTimeMs();
+    if (options[CCO_DeviceSerial].args != NULL) {
+        if (isInventoryRunning()) {
+            cached = findInventoryDevice(options[CCO_DeviceSerial].args, &usbDevice)
+                    && getDeviceTypeFromString(usbDevice.description) != CCDT_MAX;
+            if (cached) {
+                devPath.busnum = usbDevice.busnum;
+                devPath.devnum = usbDevice.devnum;
+                devPath.deviceType = getDeviceTypeFromString(usbDevice.description);
+            }
+        } else {
+            cached = findDevicePath(options[CCO_DeviceSerial].args, options[CCO_Vendor].argn,
+                                    options[CCO_Product].argn, &devPath);
+        }
+        recordPhase(CCP_Enumerate, start);
+        start = getTimeMs();
+        if (cached) {
+            fret = getBackend()->openBusAddr(ftdi, devPath.busnum, devPath.devnum);
+            cached = fret >= 0;
+        }
+        if (!cached) {
+            fret = getBackend()->openDescIndex(ftdi, options[CCO_Vendor].argn, options[CCO_Product].argn,
+                                               options[CCO_DeviceSerial].args, 0);
+            if (fret >= 0 && getDevicePath(ftdi, options[CCO_DeviceSerial].args, &devPath) == EXIT_SUCCESS)
+                storeDevicePath(&devPath);
+        }
+    } else if (getBackend()->enumerate(options[CCO_Vendor].argn, options[CCO_Product].argn,
+                                       usbDevices) == EXIT_SUCCESS) {
+        recordPhase(CCP_Enumerate, start);
+        // Use the same order as --list does
+        if ((size_t)options[CCO_DeviceId].argn >= usbDevices.size()) {
+            fprintf(stderr, "There is no device with id %d\n", options[CCO_DeviceId].argn);
+            goto error;
+        }
+        start = getTimeMs();
+        fret = getBackend()->openBusAddr(ftdi, usbDevices[options[CCO_DeviceId].argn].busnum,
+                                         usbDevices[options[CCO_DeviceId].argn].devnum);
+    } else {
+        fret = getBackend()->openDescIndex(ftdi, options[CCO_Vendor].argn, options[CCO_Product].argn, NULL,
+                                           options[CCO_DeviceId].argn);
+    }
+    recordPhase(CCP_Open, start);
+    if (fret < 0) {
+        fprintf(stderr, "Unable to open ftdi device: %d (%s)\n", fret, ftdi_get_error_string(ftdi));
+        goto error;
+    }
+
+    if (deviceType != NULL && cached && !options[CCO_EepromDetect].argn) {
+        // Type has just been verified against sysfs along with the cache entry, or comes from the inventory
+        *deviceType = devPath.deviceType;
+    } else if (deviceType != NULL) {
+        // The product string read straight from the USB descriptor is the same as the one stored in the EEPROM,
+        // but it costs a single control transfer instead of reading the whole EEPROM.
+        fret = -1;
+        if (!options[CCO_EepromDetect].argn) {
+            start = getTimeMs();
+            fret = getBackend()->readProduct(ftdi, product, sizeof(product));
+            recordPhase(CCP_Detect, start);
+        }
+        if (fret < 0) {
+            if (readEeprom(ftdi) != EXIT_SUCCESS)
+                goto error;
+            getBackend()->getEepromProduct(ftdi, product, sizeof(product));
+        }
+        tmpDeviceType = getDeviceTypeFromString(product);
+        if (tmpDeviceType == CCDT_MAX) {
+            fprintf(stderr, "Invalid device type. Device probably not configured!\n");
+            goto error;
+        }
+        *deviceType = tmpDeviceType;
+    }
+
+    return ftdi;
+
+error:
+    closeDevice(ftdi);
+
+    return NULL;
+}
+
+void closeDevice(struct ftdi_context *ftdi) {
+    double start = getTimeMs();
+
+    closePinShadow(ftdi);
+    getBackend()->close(ftdi);
+    ftdi_free(ftdi);
+    recordPhase(CCP_Close, start);
+}
+
+int writePins(struct ftdi_context *ftdi, unsigned char pins) {
+    double start = getTimeMs();
+    int f = getBackend()->writeData(ftdi, pins);
+    recordPhase(CCP_Write, start);
+    if (f < 0) {
+        fprintf(stderr,"write failed for 0x%x, error %d (%s)\n", pins, f, ftdi_get_error_string(ftdi));
+        invalidatePinShadow(ftdi);
+        return EXIT_FAILURE;
+    }
+    setPinShadow(ftdi, pins);
+    return EXIT_SUCCESS;
+}
+
+struct ftdi_context* prepareDevice(CCOptionValue options[], unsigned char *pins, CCDeviceType *deviceType) {
+    struct ftdi_context *ftdi;
+    double start;
+    int f;
+
+    ftdi = openDevice(options, deviceType);
+    if (ftdi == NULL) {
+        return NULL;
+    }
+
+    if (*deviceType == CCDT_SDWIRE || *deviceType == CCDT_USBMUX) {
+        return ftdi; // None of the following steps need to be performed for this type of device.
+    }
+
+    start = getTimeMs();
+    f = getBackend()->setBitmode(ftdi, 0xFF, BITMODE_BITBANG);
+    recordPhase(CCP_Bitmode, start);
+    if (f < 0) {
+        fprintf(stderr, "Unable to enable bitbang mode: %d (%s)\n", f, ftdi_get_error_string(ftdi));
+        closeDevice(ftdi);
+        return NULL;
+    }
+
+    // The pin state is read back from the device only if no write since it has been plugged in is known
+    openPinShadow(ftdi);
+    if (pins != NULL && !getPinShadow(ftdi, pins)) {
+        start = getTimeMs();
+        f = getBackend()->readData(ftdi, pins);
+        recordPhase(CCP_Read, start);
+        if (f < 0) {
+            fprintf(stderr,"read failed, error %d (%s)\n", f, ftdi_get_error_string(ftdi));
+            closeDevice(ftdi);
+            return NULL;
+        }
+        setPinShadow(ftdi, *pins);
+    }
+
+    return ftdi;
+}
+
+int switchDyPer(struct ftdi_context *ftdi, CCDeviceType deviceType, unsigned char *pins, CCCommand cmd,
+                const char *state) {
+    bool switchOn;
+    int dyper;
+
+    if (!hasFeature(deviceType, CCF_DYPERS)) {
+        fprintf(stderr,"DyPers are not available on this device.\n");
+        return EXIT_FAILURE;
+    }
+
+    #define STRON "ON"
+    #define STROFF "OFF"
+
+    if (strcasecmp(STRON, state) == 0) {
+      switchOn = true;
+    } else if (strcasecmp(STROFF, state) == 0) {
+      switchOn = false;
+    } else {
+      fprintf(stderr,"Invalid DyPer argument! Use \"on\" or \"off\".\n");
+      return EXIT_FAILURE;
+    }
+
+    dyper = cmd == CCC_DyPer1 ? DYPER1 : DYPER2;
+    *pins = switchOn ? *pins | dyper : *pins & ~dyper;
+
+    return writePins(ftdi, *pins);
+}
+
+int readPinState(struct ftdi_context *ftdi, unsigned char *pins) {
+    double start = getTimeMs();
+    int f = getBackend()->readPins(ftdi, pins);
+
+    recordPhase(CCP_Read, start);
+    if (f != 0) {
+        fprintf(stderr, "Error reading pins state.\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static bool isInitialized(CCDeviceType deviceType, unsigned char pins) {
+    if (deviceType == CCDT_SDWIRE)
+        return true;
+    if (deviceType == CCDT_USBMUX)
+        return pins != 0xff;
+    return (pins & POWER_SW_ON) && (pins & POWER_SW_OFF);
+}
+
+void printPinStatus(CCDeviceType deviceType, unsigned char pins, FILE *out) {
+    if (!isInitialized(deviceType, pins)) {
+        fprintf(out, "Device not initialized!\n");
+        return;
+    }
+
+    if (deviceType == CCDT_SDWIRE) {
+        fprintf(out, "SD connected to: %s\n", pins & SOCKET_SEL ? "TS" : "DUT");
+    } else if (deviceType == CCDT_USBMUX) {
+        fprintf(out, "SD connected to: %s\n", pins & UM_SOCKET_SEL ? "TS" : "DUT");
+    } else {
+        // Currently only old SD-MUX is the other device so do the job in its style.
+        fprintf(out, "USB connected to: %s\n", pins & USB_SEL ? "TS" : "DUT");
+        fprintf(out, "SD connected to: %s\n", pins & SOCKET_SEL ? "TS" : "DUT");
+    }
+}
+
+static void printStateField(FILE *out, const char *name, const char *value) {
+    fprintf(out, ", \"%s\": ", name);
+    if (value != NULL) {
+        printJsonString(out, value);
+    } else {
+        fprintf(out, "null");
+    }
+}
+
+// Prints fields of a JSON object; ports and jumpers the device does not have are null
+void printPinStatusJson(CCDeviceType deviceType, unsigned char pins, FILE *out) {
+    bool initialized = isInitialized(deviceType, pins);
+    const char *sd = NULL, *usb = NULL, *dyper1 = NULL, *dyper2 = NULL;
+
+    if (initialized && deviceType == CCDT_SDMUX) {
+        sd = pins & SOCKET_SEL ? "TS" : "DUT";
+        usb = pins & USB_SEL ? "TS" : "DUT";
+        dyper1 = pins & DYPER1 ? "on" : "off";
+        dyper2 = pins & DYPER2 ? "on" : "off";
+    } else if (initialized && deviceType == CCDT_SDWIRE) {
+        sd = pins & SOCKET_SEL ? "TS" : "DUT";
+    } else if (initialized && deviceType == CCDT_USBMUX) {
+        usb = pins & UM_SOCKET_SEL ? "TS" : "DUT";
+    }
+
+    fprintf(out, "\"type\": ");
+    printJsonString(out, getDeviceTypeName(deviceType));
+    fprintf(out, ", \"initialized\": %s", initialized ? "true" : "false");
+    printStateField(out, "sd", sd);
+    printStateField(out, "usb", usb);
+    printStateField(out, "dyper1", dyper1);
+    printStateField(out, "dyper2", dyper2);
+}
+
+int printStatus(struct ftdi_context *ftdi, CCDeviceType deviceType, unsigned char pins, FILE *out) {
+    // SD-MUX pins are known since the device has been prepared, others are driven through CBUS and read here
+    if (deviceType != CCDT_SDMUX && readPinState(ftdi, &pins) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    printPinStatus(deviceType, pins, out);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,57 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/device.h
+ * @brief       Operations on opened sd-mux devices
+ */
+
+#ifndef SDMUXCTRL_DEVICE_H
+#define SDMUXCTRL_DEVICE_H
+
+#include <stdio.h>
+
+#include <libftdi1/ftdi.h>
+
+#include "common.h"
+
+CCDeviceType getDeviceTypeFromString(const char *deviceTypeStr);
+const char *getDeviceTypeName(CCDeviceType deviceType);
+bool hasFeature(CCDeviceType deviceType, CCFeature feature);
+
+struct ftdi_context* openDevice(CCOptionValue options[], CCDeviceType *deviceType);
+int readEeprom(struct ftdi_context *ftdi);
+struct ftdi_context* prepareDevice(CCOptionValue options[], unsigned char *pins, CCDeviceType *deviceType);
+void closeDevice(struct ftdi_context *ftdi);
+
+int writePins(struct ftdi_context *ftdi, unsigned char pins);
+
+/*
+ * Following functions work on a device already set up by prepareDevice(). They update *pins so the caller
+ * may keep the device open and issue further requests without reading the pin state back.
+ */
+int switchDyPer(struct ftdi_context *ftdi, CCDeviceType deviceType, unsigned char *pins, CCCommand cmd,
+                const char *state);
+int printStatus(struct ftdi_context *ftdi, CCDeviceType deviceType, unsigned char pins, FILE *out);
+
+/*
+ * Read-only access working on a device just opened by openDevice(). Pin state is read as it is, without switching
+ * the device into bitbang mode, and then decoded according to the device type.
+ */
+int readPinState(struct ftdi_context *ftdi, unsigned char *pins);
+void printPinStatus(CCDeviceType deviceType, unsigned char pins, FILE *out);
+void printPinStatusJson(CCDeviceType deviceType, unsigned char pins, FILE *out);
+
+#endif // SDMUXCTRL_DEVICE_H
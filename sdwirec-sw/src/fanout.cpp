@@ -0,0 +1,298 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/fanout.cpp
+ * @brief       Execution of a command on many devices at once
+ *
+ * Devices are given as a comma separated list of serial numbers or with --all. Worker threads open the devices in
+ * parallel, then switching sequences of all of them are driven together by a single sequencer, so their delays
+ * overlap instead of adding up. Status is read without switching devices into bitbang mode, so polling it does not
+ * disturb them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <thread>
+
+#include "backend.h"
+#include "daemon.h"
+#include "device.h"
+#include "fanout.h"
+#include "json.h"
+#include "pool.h"
+#include "sequencer.h"
+#include "sysfs.h"
+#include "timing.h"
+
+struct CCFanOutResult {
+    std::string serial;
+    std::string output;
+    int rc;
+    double start;
+    double timeMs;
+    CCPoolDevice dev;
+    CCSequence seq;
+    bool pending;
+    std::vector<CCPhaseTime> phases;
+    bool hasState;
+    CCDeviceType deviceType;
+    unsigned char pins;
+};
+
+bool isFanOut(CCOptionValue options[]) {
+    return options[CCO_All].argn || (options[CCO_DeviceSerial].args != NULL
+            && strchr(options[CCO_DeviceSerial].args, ',') != NULL);
+}
+
+int getTargetSerials(CCOptionValue options[], std::vector<std::string> &serials) {
+    if (options[CCO_All].argn) {
+        std::vector<CCUsbDevice> devices;
+
+        if (getBackend()->enumerate(options[CCO_Vendor].argn, options[CCO_Product].argn, devices) != EXIT_SUCCESS) {
+            fprintf(stderr, "Unable to enumerate devices, sysfs is not available\n");
+            return EXIT_FAILURE;
+        }
+        for (size_t i = 0; i < devices.size(); i++) {
+            if (devices[i].serial[0] != '\0' && getDeviceTypeFromString(devices[i].description) != CCDT_MAX)
+                serials.push_back(devices[i].serial);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    for (const char *s = options[CCO_DeviceSerial].args; *s != '\0'; ) {
+        size_t len = strcspn(s, ",");
+        if (len > 0)
+            serials.push_back(std::string(s, len));
+        s += len;
+        if (*s == ',')
+            s++;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static void onSequenceDone(CCSequence *seq) {
+    CCFanOutResult *result = (CCFanOutResult *)seq->data;
+
+    result->rc = seq->ret;
+    result->timeMs += getTimeMs() - seq->start;
+}
+
+// Opens the device and either executes the command or prepares its sequence to be run along with other devices
+static int prepareOnDevice(CCCommand cmd, CCOptionValue options[], CCFanOutResult *result, FILE *out) {
+    int ret;
+
+    if (!options[CCO_Direct].argn) {
+        ret = daemonRequest(cmd, options, out);
+        if (ret != CCD_NOT_HANDLED)
+            return ret;
+    }
+
+    result->dev.ftdi = prepareDevice(options, &result->dev.pins, &result->dev.deviceType);
+    if (result->dev.ftdi == NULL)
+        return EXIT_FAILURE;
+
+    if (isSequenceCommand(cmd)) {
+        ret = buildSequence(&result->dev, cmd, options, &result->seq);
+        if (ret == EXIT_SUCCESS) {
+            result->seq.done = onSequenceDone;
+            result->seq.data = result;
+            result->seq.phases = &result->phases;
+            result->pending = true;
+            return ret;
+        }
+    } else {
+        ret = executeCommand(&result->dev, cmd, options, out);
+    }
+
+    closeDevice(result->dev.ftdi);
+    result->dev.ftdi = NULL;
+
+    return ret;
+}
+
+static int readStateOnDevice(CCOptionValue options[], CCFanOutResult *result, FILE *out) {
+    struct ftdi_context *ftdi;
+    int ret = CCD_NOT_HANDLED;
+
+    if (!options[CCO_Direct].argn)
+        ret = daemonReadState(options, &result->deviceType, &result->pins);
+
+    if (ret == CCD_NOT_HANDLED) {
+        ftdi = openDevice(options, &result->deviceType);
+        if (ftdi == NULL)
+            return EXIT_FAILURE;
+        ret = readPinState(ftdi, &result->pins);
+        closeDevice(ftdi);
+    }
+
+    if (ret != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    result->hasState = true;
+    printPinStatus(result->deviceType, result->pins, out);
+
+    return EXIT_SUCCESS;
+}
+
+static void worker(CCCommand cmd, CCOptionValue options[], std::vector<CCFanOutResult> *results,
+                   std::atomic<size_t> *next) {
+    CCOptionValue devOptions[CCO_MAX];
+    char *output;
+    size_t i, outputSize;
+    FILE *out;
+
+    while ((i = (*next)++) < results->size()) {
+        CCFanOutResult &result = (*results)[i];
+
+        memcpy(devOptions, options, sizeof(devOptions));
+        devOptions[CCO_DeviceSerial].args = (char *)result.serial.c_str();
+        devOptions[CCO_DeviceId].argn = -1;
+
+        out = open_memstream(&output, &outputSize);
+        if (out == NULL) {
+            result.rc = EXIT_FAILURE;
+            continue;
+        }
+
+        setPhaseLog(&result.phases);
+        result.start = getTimeMs();
+        if (cmd == CCC_Status) {
+            result.rc = readStateOnDevice(devOptions, &result, out);
+        } else {
+            result.rc = prepareOnDevice(cmd, devOptions, &result, out);
+        }
+        result.timeMs = getTimeMs() - result.start;
+        setPhaseLog(NULL);
+
+        fclose(out);
+        result.output = output;
+        free(output);
+    }
+}
+
+static void printResults(const std::vector<CCFanOutResult> &results, CCOptionValue options[]) {
+    size_t width = strlen("Device");
+
+    // One object per line, as in batch mode, so results of several commands form a single stream
+    if (isJsonFormat(options)) {
+        for (size_t i = 0; i < results.size(); i++) {
+            printf("{\"serial\": ");
+            printJsonString(stdout, results[i].serial.c_str());
+            printf(", \"rc\": %d, \"time_ms\": %.3f, \"output\": ", results[i].rc, results[i].timeMs);
+            printJsonString(stdout, results[i].output.c_str());
+            if (results[i].hasState) {
+                printf(", ");
+                printPinStatusJson(results[i].deviceType, results[i].pins, stdout);
+            }
+            printf("}\n");
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < results.size(); i++) {
+        const char *line = results[i].output.c_str();
+        while (*line != '\0') {
+            size_t len = strcspn(line, "\n");
+            printf("%s: %.*s\n", results[i].serial.c_str(), (int)len, line);
+            line += len + (line[len] == '\n');
+        }
+        if (results[i].serial.size() > width)
+            width = results[i].serial.size();
+    }
+
+    printf("%-*s  %-6s  %10s\n", (int)width, "Device", "Result", "Time [ms]");
+    for (size_t i = 0; i < results.size(); i++) {
+        printf("%-*s  %-6s  %10.1f\n", (int)width, results[i].serial.c_str(),
+               results[i].rc == EXIT_SUCCESS ? "OK" : "FAILED", results[i].timeMs);
+    }
+}
+
+int runOnDevices(CCCommand cmd, CCOptionValue options[]) {
+    std::vector<std::string> serials;
+    std::vector<CCFanOutResult> results;
+    std::vector<std::thread> workers;
+    std::vector<CCSequence *> sequences;
+    std::atomic<size_t> next(0);
+    size_t jobs;
+    int ret = EXIT_SUCCESS;
+
+    if (!isPoolCommand(cmd)) {
+        fprintf(stderr, "This command cannot be executed on many devices at once\n");
+        return EXIT_FAILURE;
+    }
+
+    if (checkFormat(options) != EXIT_SUCCESS || getTargetSerials(options, serials) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    results.resize(serials.size());
+    for (size_t i = 0; i < serials.size(); i++) {
+        results[i].serial = serials[i];
+        results[i].rc = EXIT_FAILURE;
+        results[i].timeMs = 0;
+        results[i].dev.ftdi = NULL;
+        results[i].pending = false;
+        results[i].hasState = false;
+    }
+
+    jobs = options[CCO_Jobs].argn > 0 ? options[CCO_Jobs].argn : MAX_JOBS;
+    if (jobs > results.size())
+        jobs = results.size();
+
+    for (size_t i = 0; i < jobs; i++)
+        workers.push_back(std::thread(worker, cmd, options, &results, &next));
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+
+    for (size_t i = 0; i < results.size(); i++) {
+        if (results[i].pending)
+            sequences.push_back(&results[i].seq);
+    }
+    runSequences(sequences);
+
+    for (size_t i = 0; i < results.size(); i++) {
+        if (results[i].dev.ftdi != NULL) {
+            setPhaseLog(&results[i].phases);
+            closeDevice(results[i].dev.ftdi);
+            setPhaseLog(NULL);
+        }
+    }
+
+    printResults(results, options);
+
+    for (size_t i = 0; i < results.size(); i++) {
+        CCFanOutResult &result = results[i];
+        double end = result.start + result.timeMs;
+
+        // Devices are closed after sequences of all of them finish
+        if (!result.phases.empty() && result.phases.back().end > end)
+            end = result.phases.back().end;
+
+        if (options[CCO_Timings].argn)
+            printPhases(stderr, result.serial.c_str(), result.phases, result.start, end, isJsonFormat(options));
+        logPhases(getCommandName(cmd), result.serial.c_str(), result.rc, result.phases, result.start, end);
+    }
+
+    for (size_t i = 0; i < results.size(); i++) {
+        if (results[i].rc != EXIT_SUCCESS)
+            ret = EXIT_FAILURE;
+    }
+
+    return ret;
+}
@@ -0,0 +1,1190 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/flash.cpp
+ * @brief       Writing images to the SD card
+ *
+ * The image is read and decompressed on a separate thread into a ring of aligned buffers, which are written to the
+ * card with O_DIRECT and kernel AIO, FLASH_QUEUE_DEPTH of them at once. Decompression, reading and USB writes thus
+ * overlap and the card reader never idles unless decompression is slower than the card. Targets not supporting
+ * O_DIRECT (e.g. files on tmpfs), or all targets if SDMUX_FLASH_DIRECT is set to 0, are written through the page cache,
+ * and when AIO is not available buffers are written synchronously. Unaligned tail of the image is written without
+ * O_DIRECT.
+ *
+ * Each buffer is written as runs of blocks. Blocks left out of the block map given with --bmap and, with --sparse,
+ * blocks holding only zeros are skipped and optionally discarded. Checksums of mapped ranges are verified as the image
+ * streams by, so a corrupted image is reported even though the card has already been partially written.
+ *
+ * With --delta the card is read ahead of writing each buffer and chunks of the card and of the image are hashed on
+ * all cores. Chunks which are the same are not written. Reading is synchronous, because a card reader executes one
+ * command at a time anyway, while writes of previous buffers are still in flight.
+ *
+ * With --verify chunks of each buffer are hashed before it is written and the card is read back once it is flushed.
+ *
+ * With --card-manifest hashes of chunks written to the card of each device are stored after writing. Next time the
+ * image is compared with them instead of the card, unless a few chunks read from the card show it has been modified.
+ *
+ * With --partition only buffers of the image overlapping the partition are read and only its blocks are written,
+ * provided the card is partitioned the same way as the image.
+ *
+ * Many targets are written at once by a writer thread each, all of them reading buffers of a single image stream.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <linux/fs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "aio.h"
+#include "bmap.h"
+#include "cardmanifest.h"
+#include "flash.h"
+#include "hashpool.h"
+#include "imagecache.h"
+#include "partition.h"
+#include "sysfs.h"
+#include "timing.h"
+#include "verify.h"
+
+#define MOUNTS_FILE             "/proc/self/mounts"
+#define FLASH_AIO_UNSUPPORTED   -1
+#define FLASH_DELTA_CHUNKS      (IMAGE_BUFFER_SIZE / FLASH_DELTA_CHUNK)
+#define FLASH_VERIFY_CHUNKS     (IMAGE_BUFFER_SIZE / (HASH_MAX_CHUNK_BLOCKS * BMAP_MIN_BLOCK_SIZE))
+
+// State shared by writers of all targets
+struct CCFlashShared {
+    CCOptionValue *options;
+    CCImageStream stream;
+    CCHashPool pool;
+    const CCBmap *bmap;
+    const uint64_t *cachedHashes;   // Manifest of the image found in the cache
+    std::vector<CCPartition> partitions;
+    bool partition;                 // Only the range of the partition given with --partition is written
+    CCImageRange range;
+};
+
+enum CCBlockAction {
+    CCBA_Write = 0,
+    CCBA_Skip,          // Not needed, may be discarded
+    CCBA_Keep,          // Already on the card
+    CCBA_Outside        // Outside of the partition being written
+};
+
+struct CCFlashRun {
+    size_t start;       // Offset in the buffer
+    size_t len;
+};
+
+struct CCFlashSlot {
+    CCImageBuffer *buffer;
+    struct iocb cbs[FLASH_MAX_RUNS];
+    int pending;
+};
+
+struct CCFlashWriter {
+    const char *target;
+    int fd;
+    bool direct;
+    bool blockDevice;
+    bool regularFile;
+    aio_context_t aio;
+    bool async;
+    CCImageStream *stream;
+    CCFlashSlot slots[FLASH_QUEUE_DEPTH];
+    CCFlashStats *stats;
+    const CCImageRange *range;      // Blocks outside of it are left as they are
+    uint64_t start;                 // Offset of the first buffer
+    uint64_t end;                   // End of the last buffer
+    // Selection of blocks to write
+    size_t blockSize;
+    bool sparse;
+    const CCBmap *bmap;
+    size_t mapRange;
+    size_t checksumRange;
+    CCSha256 checksum;
+    // Skipped blocks waiting to be discarded together
+    bool discard;
+    uint64_t discardStart;
+    uint64_t discardLen;
+    // Chunks of the buffer to be written in delta mode
+    bool delta;
+    CCHashPool *pool;
+    unsigned char *card;
+    size_t chunkSize;
+    bool changed[FLASH_DELTA_CHUNKS];
+    uint64_t imageHashes[FLASH_DELTA_CHUNKS];
+    uint64_t cardHashes[FLASH_DELTA_CHUNKS];
+    const CCCardManifest *lastWritten;  // Chunks known to be on the card, compared instead of reading it
+    // Chunks written to the card, stored with --card-manifest
+    CCCardManifest *written;
+    // Hashes of IMAGE_CACHE_CHUNK chunks of a cached image
+    const uint64_t *cachedHashes;
+    // Hashes of written blocks to compare the card with after writing
+    CCVerifyMap *verifyMap;
+    uint64_t verifySkipped[FLASH_VERIFY_CHUNKS];
+};
+
+// Disk a partition belongs to, block devices which are no partitions are disks themselves
+static dev_t getDiskDev(dev_t dev) {
+    char attr[64], buf[32];
+    unsigned int maj, min;
+
+    snprintf(attr, sizeof(attr), "dev/block/%u:%u/partition", major(dev), minor(dev));
+    if (readSysfsAttribute(attr, buf, sizeof(buf)) != EXIT_SUCCESS)
+        return dev;
+
+    snprintf(attr, sizeof(attr), "dev/block/%u:%u/../dev", major(dev), minor(dev));
+    if (readSysfsAttribute(attr, buf, sizeof(buf)) != EXIT_SUCCESS || sscanf(buf, "%u:%u", &maj, &min) != 2)
+        return dev;
+
+    return makedev(maj, min);
+}
+
+// Mount sources are compared by device number, so symlinks such as /dev/disk/by-id/... are resolved
+static bool isMountedDev(dev_t dev) {
+    char source[256];
+    struct stat st;
+    bool mounted = false;
+    FILE *mounts;
+
+    mounts = fopen(MOUNTS_FILE, "re");
+    if (mounts == NULL)
+        return false;
+
+    while (fscanf(mounts, "%255s %*[^\n]", source) == 1) {
+        if (source[0] == '/' && stat(source, &st) == 0 && S_ISBLK(st.st_mode) &&
+            (st.st_rdev == dev || getDiskDev(st.st_rdev) == dev)) {
+            mounted = true;
+            break;
+        }
+    }
+    fclose(mounts);
+
+    return mounted;
+}
+
+// Refuses to overwrite a mounted disk or any of its partitions
+static bool isMounted(const char *target) {
+    struct stat st;
+    int fd;
+
+    if (stat(target, &st) < 0 || !S_ISBLK(st.st_mode))
+        return false;
+
+    // Kernel refuses exclusive opens of a disk whose partitions are mounted or otherwise claimed
+    fd = open(target, O_RDONLY | O_EXCL | O_CLOEXEC);
+    if (fd >= 0) {
+        close(fd);
+        return false;
+    }
+    if (errno == EBUSY)
+        return true;
+
+    return isMountedDev(st.st_rdev);
+}
+
+static int writeFull(int fd, const unsigned char *buf, size_t len, off_t offset) {
+    ssize_t n;
+
+    while (len > 0) {
+        n = pwrite(fd, buf, len, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return EXIT_FAILURE;
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Character devices such as /dev/null, handy for measuring decompression alone, cannot be flushed
+static int flushTarget(int fd, const char *target) {
+    if (fsync(fd) < 0 && errno != EINVAL) {
+        fprintf(stderr, "Unable to flush %s: %s\n", target, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Buffers are aligned, so the block is checked a word at a time
+static bool isZeroBlock(const unsigned char *data, size_t len) {
+    const uint64_t *words = (const uint64_t *)data;
+    uint64_t acc = 0;
+
+    for (size_t i = 0; i < len / sizeof(uint64_t); i += 8) {
+        for (size_t j = 0; j < 8; j++)
+            acc |= words[i + j];
+        if (acc != 0)
+            return false;
+    }
+
+    return true;
+}
+
+static int openWriter(const char *target, CCImageStream *stream, CCFlashWriter *writer) {
+    int mode = writer->delta || writer->range != NULL ? O_RDWR : O_WRONLY;
+    const char *direct = getenv(SDMUX_FLASH_DIRECT_ENV);
+    struct stat st;
+
+    writer->target = target;
+    writer->stream = stream;
+    writer->direct = direct == NULL || strcmp(direct, "0") != 0;
+    if (writer->direct) {
+        writer->fd = open(target, mode | O_DIRECT | O_CLOEXEC);
+        if (writer->fd < 0 && errno == EINVAL)
+            writer->direct = false;
+    }
+    if (!writer->direct)
+        writer->fd = open(target, mode | O_CLOEXEC);
+    if (writer->fd < 0) {
+        fprintf(stderr, "Unable to open %s: %s\n", target, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (fstat(writer->fd, &st) == 0) {
+        writer->blockDevice = S_ISBLK(st.st_mode);
+        writer->regularFile = S_ISREG(st.st_mode);
+    }
+
+    writer->aio = 0;
+    writer->async = ioSetup(FLASH_QUEUE_DEPTH * FLASH_MAX_RUNS, &writer->aio) == 0;
+    if (!writer->async)
+        writer->aio = 0;
+
+    if (writer->delta && posix_memalign((void **)&writer->card, IMAGE_ALIGNMENT, IMAGE_BUFFER_SIZE) != 0) {
+        writer->card = NULL;
+        fprintf(stderr, "Unable to allocate card buffer\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static void issueDiscard(CCFlashWriter *writer) {
+    uint64_t range[2] = { writer->discardStart, writer->discardLen };
+    int ret = -1;
+
+    if (writer->discardLen == 0)
+        return;
+
+    // Holes punched into files stand in for discarded blocks when testing with a file
+    if (writer->blockDevice)
+        ret = ioctl(writer->fd, BLKDISCARD, range);
+    else if (writer->regularFile)
+        ret = fallocate(writer->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, range[0], range[1]);
+    else
+        errno = EOPNOTSUPP;
+
+    if (ret == 0) {
+        writer->stats->discardedBytes += writer->discardLen;
+    } else {
+        fprintf(stderr, "Unable to discard blocks of %s: %s, skipped blocks are left as they are\n", writer->target,
+                strerror(errno));
+        writer->discard = false;
+    }
+    writer->discardLen = 0;
+}
+
+static void skipBlocks(CCFlashWriter *writer, uint64_t offset, uint64_t len) {
+    writer->stats->skippedBytes += len;
+
+    if (!writer->discard)
+        return;
+
+    if (writer->discardLen > 0 && writer->discardStart + writer->discardLen == offset) {
+        writer->discardLen += len;
+        return;
+    }
+
+    issueDiscard(writer);
+    writer->discardStart = offset;
+    writer->discardLen = len;
+}
+
+static bool isMappedBlock(CCFlashWriter *writer, uint64_t offset) {
+    const std::vector<CCBmapRange> &ranges = writer->bmap->ranges;
+    uint64_t block = offset / writer->bmap->blockSize;
+
+    while (writer->mapRange < ranges.size() && ranges[writer->mapRange].last < block)
+        writer->mapRange++;
+
+    return writer->mapRange < ranges.size() && ranges[writer->mapRange].first <= block;
+}
+
+// Ranges may span many buffers, so their checksums are calculated incrementally
+static int verifyChecksums(CCFlashWriter *writer, const CCImageBuffer *buffer) {
+    const std::vector<CCBmapRange> &ranges = writer->bmap->ranges;
+    uint64_t bufferEnd = buffer->offset + buffer->len, start, end, from, to;
+    unsigned char digest[SHA256_DIGEST_SIZE];
+
+    while (writer->checksumRange < ranges.size()) {
+        const CCBmapRange &range = ranges[writer->checksumRange];
+
+        start = getBmapRangeStart(writer->bmap, &range);
+        end = getBmapRangeEnd(writer->bmap, &range);
+        if (start >= bufferEnd)
+            break;
+
+        // Stream of a partition starts in the middle of the image, so ranges before it cannot be checked
+        if (start < buffer->offset && buffer->index == 0) {
+            writer->checksumRange++;
+            continue;
+        }
+
+        if (range.hasChecksum) {
+            if (start >= buffer->offset)
+                sha256Init(&writer->checksum);
+            from = start > buffer->offset ? start : buffer->offset;
+            to = end < bufferEnd ? end : bufferEnd;
+            sha256Update(&writer->checksum, buffer->data + (from - buffer->offset), to - from);
+        }
+        if (end > bufferEnd)
+            break;
+
+        if (range.hasChecksum) {
+            sha256Final(&writer->checksum, digest);
+            if (memcmp(digest, range.checksum, sizeof(digest)) != 0) {
+                fprintf(stderr, "Checksum of blocks %llu-%llu does not match the block map, the image is corrupted\n",
+                        (unsigned long long)range.first, (unsigned long long)range.last);
+                return EXIT_FAILURE;
+            }
+        }
+        writer->checksumRange++;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Bridges the smallest gaps until there are at most maxRuns runs
+static void coalesceRuns(std::vector<CCFlashRun> &runs, size_t blockSize, size_t maxRuns) {
+    size_t gap = blockSize, n;
+
+    while (runs.size() > maxRuns) {
+        n = 0;
+        for (size_t i = 1; i < runs.size(); i++) {
+            if (runs[i].start - (runs[n].start + runs[n].len) <= gap)
+                runs[n].len = runs[i].start + runs[i].len - runs[n].start;
+            else
+                runs[++n] = runs[i];
+        }
+        runs.resize(n + 1);
+        gap *= 2;
+    }
+}
+
+// Reads the part of the card the buffer is going to be written to, less at the end of the card
+static ssize_t readCard(CCFlashWriter *writer, uint64_t offset, size_t len) {
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < len) {
+        n = pread(writer->fd, writer->card + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            fprintf(stderr, "Unable to read %s at offset %llu: %s\n", writer->target,
+                    (unsigned long long)(offset + done), strerror(errno));
+            return -1;
+        }
+        if (n == 0)
+            break;
+        done += n;
+    }
+
+    return done;
+}
+
+static bool isKnownChunk(const CCCardManifest *manifest, size_t chunk) {
+    return chunk < manifest->hashes.size() && manifest->known[chunk];
+}
+
+static int findChangedChunks(CCFlashWriter *writer, const CCImageBuffer *buffer, size_t len) {
+    size_t chunks = (len + writer->chunkSize - 1) / writer->chunkSize, first = buffer->offset / writer->chunkSize, end;
+    const CCCardManifest *lastWritten = writer->lastWritten;
+    double start;
+    ssize_t n = len;
+
+    if (lastWritten == NULL) {
+        start = getTimeMs();
+        n = readCard(writer, buffer->offset, len);
+        writer->stats->cardReadMs += getTimeMs() - start;
+        if (n < 0)
+            return EXIT_FAILURE;
+    }
+
+    start = getTimeMs();
+    // Manifest hash of the last chunk covers the partial block at the end of the image, so the chunk is rewritten
+    if (writer->cachedHashes != NULL && writer->chunkSize == IMAGE_CACHE_CHUNK)
+        memcpy(writer->imageHashes, writer->cachedHashes + buffer->offset / IMAGE_CACHE_CHUNK,
+               chunks * sizeof(uint64_t));
+    else
+        hashChunks(writer->pool, buffer->data, len, writer->chunkSize, writer->imageHashes, NULL, 0);
+    if (lastWritten == NULL)
+        hashChunks(writer->pool, writer->card, n, writer->chunkSize, writer->cardHashes, NULL, 0);
+    writer->stats->hashMs += getTimeMs() - start;
+
+    for (size_t c = 0; c < chunks; c++) {
+        end = (c + 1) * writer->chunkSize < len ? (c + 1) * writer->chunkSize : len;
+        // Chunks the card ends in or before are written
+        if (lastWritten != NULL)
+            writer->changed[c] = !isKnownChunk(lastWritten, first + c)
+                    || writer->imageHashes[c] != lastWritten->hashes[first + c];
+        else
+            writer->changed[c] = end > (size_t)n || writer->imageHashes[c] != writer->cardHashes[c];
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static bool isOutside(const CCFlashWriter *writer, uint64_t offset) {
+    return writer->range != NULL && (offset < writer->range->start || offset >= writer->range->end);
+}
+
+static CCBlockAction getBlockAction(CCFlashWriter *writer, const CCImageBuffer *buffer, size_t pos) {
+    if (isOutside(writer, buffer->offset + pos))
+        return CCBA_Outside;
+    if (writer->bmap != NULL && !isMappedBlock(writer, buffer->offset + pos))
+        return CCBA_Skip;
+    if (writer->sparse && isZeroBlock(buffer->data + pos, writer->blockSize))
+        return CCBA_Skip;
+    if (writer->delta && !writer->changed[pos / writer->chunkSize])
+        return CCBA_Keep;
+
+    return CCBA_Write;
+}
+
+// Partial block at the end of the image is written along with the buffer unless it goes around O_DIRECT
+static bool hasTailRun(const CCFlashWriter *writer, const CCImageBuffer *buffer) {
+    return buffer->len % writer->blockSize != 0 && writer->range == NULL && !writer->direct;
+}
+
+// Selects blocks of the buffer to be written, the partial block at the end of the image is always written
+static int getRuns(CCFlashWriter *writer, const CCImageBuffer *buffer, std::vector<CCFlashRun> &runs,
+                   std::vector<CCBlockAction> &actions) {
+    size_t blocks = buffer->len / writer->blockSize * writer->blockSize, pos, end = 0;
+
+    runs.clear();
+    actions.resize(blocks / writer->blockSize);
+
+    if (writer->delta && findChangedChunks(writer, buffer, blocks) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    for (pos = 0; pos < blocks; pos += writer->blockSize) {
+        actions[pos / writer->blockSize] = getBlockAction(writer, buffer, pos);
+        if (actions[pos / writer->blockSize] != CCBA_Write)
+            continue;
+
+        if (!runs.empty() && runs.back().start + runs.back().len == pos) {
+            runs.back().len += writer->blockSize;
+        } else {
+            CCFlashRun run = { pos, writer->blockSize };
+            runs.push_back(run);
+        }
+    }
+
+    // Runs have to fit into a single submission along with the partial block added to them by processBuffer()
+    coalesceRuns(runs, writer->blockSize, hasTailRun(writer, buffer) ? FLASH_MAX_RUNS - 1 : FLASH_MAX_RUNS);
+    for (size_t i = 0; i < runs.size(); i++) {
+        for (pos = runs[i].start; pos < runs[i].start + runs[i].len; pos += writer->blockSize)
+            actions[pos / writer->blockSize] = CCBA_Write;
+    }
+
+    // Blocks in gaps bridged by coalescing are written, so only what is left is skipped or kept
+    for (size_t i = 0; i <= runs.size(); i++) {
+        for (pos = end; pos < (i < runs.size() ? runs[i].start : blocks); pos += writer->blockSize) {
+            if (actions[pos / writer->blockSize] == CCBA_Skip)
+                skipBlocks(writer, buffer->offset + pos, writer->blockSize);
+            else if (actions[pos / writer->blockSize] == CCBA_Keep)
+                writer->stats->unchangedBytes += writer->blockSize;
+        }
+        if (i < runs.size())
+            end = runs[i].start + runs[i].len;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Skipped blocks hold anything after writing, so they are left out of verification along with blocks outside of the
+// partition
+static void recordVerification(CCFlashWriter *writer, const CCImageBuffer *buffer,
+                               const std::vector<CCBlockAction> &actions) {
+    size_t chunkBlocks = writer->verifyMap->chunkSize / writer->blockSize, block;
+    size_t chunks = (buffer->len + writer->verifyMap->chunkSize - 1) / writer->verifyMap->chunkSize;
+
+    for (size_t c = 0; c < chunks; c++) {
+        writer->verifySkipped[c] = 0;
+        for (size_t b = 0; b < chunkBlocks; b++) {
+            block = c * chunkBlocks + b;
+            if (block < actions.size() && (actions[block] == CCBA_Skip || actions[block] == CCBA_Outside))
+                writer->verifySkipped[c] |= (uint64_t)1 << b;
+        }
+    }
+
+    recordVerifyHashes(writer->verifyMap, writer->pool, buffer->data, buffer->len, buffer->offset,
+                       writer->verifySkipped, writer->verifyMap->chunkSize == IMAGE_CACHE_CHUNK
+                       && writer->cachedHashes != NULL ? writer->cachedHashes + buffer->offset / IMAGE_CACHE_CHUNK
+                                                       : NULL);
+}
+
+/*
+ * Chunks holding skipped blocks may hold anything after writing, so they are recorded as unknown. Chunks outside of the
+ * partition keep what the previous manifest says about them.
+ */
+static void recordWrittenChunks(CCFlashWriter *writer, const CCImageBuffer *buffer,
+                                const std::vector<CCBlockAction> &actions) {
+    size_t chunkBlocks = writer->chunkSize / writer->blockSize, first = buffer->offset / writer->chunkSize, block;
+    size_t chunks = (buffer->len + writer->chunkSize - 1) / writer->chunkSize, outside;
+    const uint64_t *hashes = writer->imageHashes;
+    double start;
+    bool known;
+
+    // Hashes found by --delta do not cover the partial block at the end of the image
+    if (writer->cachedHashes != NULL && writer->chunkSize == IMAGE_CACHE_CHUNK) {
+        hashes = writer->cachedHashes + first;
+    } else if (!writer->delta || buffer->len % writer->blockSize != 0) {
+        start = getTimeMs();
+        hashChunks(writer->pool, buffer->data, buffer->len, writer->chunkSize, writer->imageHashes, NULL, 0);
+        writer->stats->hashMs += getTimeMs() - start;
+    }
+
+    if (writer->written->hashes.size() < first + chunks) {
+        writer->written->hashes.resize(first + chunks);
+        writer->written->known.resize(first + chunks);
+    }
+    for (size_t c = 0; c < chunks; c++) {
+        known = true;
+        outside = 0;
+        for (size_t b = 0; b < chunkBlocks; b++) {
+            block = c * chunkBlocks + b;
+            if (block < actions.size() && actions[block] == CCBA_Skip)
+                known = false;
+            if (block < actions.size() && actions[block] == CCBA_Outside)
+                outside++;
+        }
+        if (outside == chunkBlocks)
+            continue;
+        writer->written->hashes[first + c] = hashes[c];
+        writer->written->known[first + c] = known && outside == 0;
+    }
+}
+
+// Waits for at least one write in flight and returns buffers written completely to the ring
+static int reapWriter(CCFlashWriter *writer) {
+    struct io_event events[FLASH_QUEUE_DEPTH * FLASH_MAX_RUNS];
+    int ret = EXIT_SUCCESS, n;
+
+    do {
+        n = ioGetEvents(writer->aio, 1, FLASH_QUEUE_DEPTH * FLASH_MAX_RUNS, events);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        fprintf(stderr, "Waiting for writes to %s failed: %s\n", writer->target, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < n; i++) {
+        CCFlashSlot *slot = &writer->slots[events[i].data];
+        struct iocb *cb = (struct iocb *)(uintptr_t)events[i].obj;
+
+        if (events[i].res != (__s64)cb->aio_nbytes) {
+            fprintf(stderr, "Write to %s at offset %lld failed: %s\n", writer->target, (long long)cb->aio_offset,
+                    events[i].res < 0 ? strerror(-events[i].res) : "short write");
+            ret = EXIT_FAILURE;
+        }
+        if (--slot->pending == 0) {
+            releaseImageBuffer(writer->stream, slot->buffer);
+            slot->buffer = NULL;
+        }
+    }
+
+    return ret;
+}
+
+static int getFreeSlot(CCFlashWriter *writer) {
+    for (;;) {
+        for (int i = 0; i < FLASH_QUEUE_DEPTH; i++) {
+            if (writer->slots[i].buffer == NULL)
+                return i;
+        }
+
+        if (reapWriter(writer) != EXIT_SUCCESS)
+            return -1;
+    }
+}
+
+static int submitRuns(CCFlashWriter *writer, int i, CCImageBuffer *buffer, const std::vector<CCFlashRun> &runs) {
+    CCFlashSlot *slot = &writer->slots[i];
+    struct iocb *cbs[FLASH_MAX_RUNS];
+    size_t submitted = 0;
+    int n;
+
+    for (size_t r = 0; r < runs.size(); r++) {
+        struct iocb *cb = &slot->cbs[r];
+
+        memset(cb, 0, sizeof(*cb));
+        cb->aio_data = i;
+        cb->aio_lio_opcode = IOCB_CMD_PWRITE;
+        cb->aio_fildes = writer->fd;
+        cb->aio_buf = (__u64)(uintptr_t)(buffer->data + runs[r].start);
+        cb->aio_nbytes = runs[r].len;
+        cb->aio_offset = buffer->offset + runs[r].start;
+        cbs[r] = cb;
+    }
+
+    slot->buffer = buffer;
+    slot->pending = runs.size();
+
+    while (submitted < runs.size()) {
+        n = ioSubmit(writer->aio, runs.size() - submitted, cbs + submitted);
+        if (n <= 0) {
+            // Writes which have not been submitted will never complete
+            slot->pending -= runs.size() - submitted;
+            if (n < 0 && errno == EINVAL && submitted == 0) {
+                // Buffer is written synchronously instead
+                slot->buffer = NULL;
+                return FLASH_AIO_UNSUPPORTED;
+            }
+            if (slot->pending == 0) {
+                releaseImageBuffer(writer->stream, buffer);
+                slot->buffer = NULL;
+            }
+            return EXIT_FAILURE;
+        }
+        submitted += n;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Buffer is returned to the ring once it is written, also when the write fails
+static int writeBuffer(CCFlashWriter *writer, int i, CCImageBuffer *buffer, const std::vector<CCFlashRun> &runs) {
+    int ret = EXIT_SUCCESS;
+
+    for (size_t r = 0; r < runs.size(); r++)
+        writer->stats->writtenBytes += runs[r].len;
+
+    if (writer->async && !runs.empty()) {
+        ret = submitRuns(writer, i, buffer, runs);
+        if (ret != FLASH_AIO_UNSUPPORTED) {
+            if (ret != EXIT_SUCCESS)
+                fprintf(stderr, "Unable to submit writes to %s: %s\n", writer->target, strerror(errno));
+            return ret;
+        }
+        // Target does not support AIO (e.g. a character device)
+        writer->async = false;
+        ret = EXIT_SUCCESS;
+    }
+
+    for (size_t r = 0; r < runs.size() && ret == EXIT_SUCCESS; r++) {
+        if (writeFull(writer->fd, buffer->data + runs[r].start, runs[r].len, buffer->offset + runs[r].start)
+                != EXIT_SUCCESS) {
+            fprintf(stderr, "Write to %s at offset %lld failed: %s\n", writer->target,
+                    (long long)(buffer->offset + runs[r].start), strerror(errno));
+            ret = EXIT_FAILURE;
+        }
+    }
+    releaseImageBuffer(writer->stream, buffer);
+
+    return ret;
+}
+
+// Writes the unaligned end of the image through the page cache
+static int writeTail(CCFlashWriter *writer, const unsigned char *data, size_t len, off_t offset) {
+    int fd, ret;
+
+    fd = open(writer->target, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to open %s: %s\n", writer->target, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    ret = writeFull(fd, data, len, offset);
+    if (ret != EXIT_SUCCESS)
+        fprintf(stderr, "Write to %s at offset %lld failed: %s\n", writer->target, (long long)offset, strerror(errno));
+    if (ret == EXIT_SUCCESS)
+        ret = flushTarget(fd, writer->target);
+    close(fd);
+
+    writer->stats->writtenBytes += len;
+
+    return ret;
+}
+
+static int processBuffer(CCFlashWriter *writer, int i, CCImageBuffer *buffer, std::vector<CCFlashRun> &runs,
+                         std::vector<CCBlockAction> &actions) {
+    size_t blocks = buffer->len / writer->blockSize * writer->blockSize;
+
+    if (writer->bmap != NULL && verifyChecksums(writer, buffer) != EXIT_SUCCESS) {
+        releaseImageBuffer(writer->stream, buffer);
+        return EXIT_FAILURE;
+    }
+
+    if (getRuns(writer, buffer, runs, actions) != EXIT_SUCCESS) {
+        releaseImageBuffer(writer->stream, buffer);
+        return EXIT_FAILURE;
+    }
+
+    if (writer->verifyMap != NULL)
+        recordVerification(writer, buffer, actions);
+    if (writer->written != NULL)
+        recordWrittenChunks(writer, buffer, actions);
+
+    // Only the last buffer may end with a partial block, which is never a part of a partition
+    if (hasTailRun(writer, buffer)) {
+        if (!runs.empty() && runs.back().start + runs.back().len == blocks) {
+            runs.back().len += buffer->len - blocks;
+        } else {
+            CCFlashRun run = { blocks, buffer->len - blocks };
+            runs.push_back(run);
+        }
+    } else if (blocks < buffer->len && writer->range == NULL) {
+        if (writeTail(writer, buffer->data + blocks, buffer->len - blocks, buffer->offset + blocks) != EXIT_SUCCESS) {
+            releaseImageBuffer(writer->stream, buffer);
+            return EXIT_FAILURE;
+        }
+    }
+
+    return writeBuffer(writer, i, buffer, runs);
+}
+
+// Waits for all buffers in flight, even if some of them fail
+static int drainWriter(CCFlashWriter *writer) {
+    int ret = EXIT_SUCCESS;
+
+    for (int i = 0; i < FLASH_QUEUE_DEPTH; i++) {
+        while (writer->slots[i].buffer != NULL) {
+            if (reapWriter(writer) != EXIT_SUCCESS)
+                ret = EXIT_FAILURE;
+        }
+    }
+
+    return ret;
+}
+
+static void closeWriter(CCFlashWriter *writer) {
+    if (writer->aio != 0)
+        ioDestroy(writer->aio);
+    free(writer->card);
+    if (writer->fd >= 0)
+        close(writer->fd);
+}
+
+// Skipped blocks at the end of the image do not extend a file given as the target
+static int finishWriter(CCFlashWriter *writer) {
+    struct stat st;
+
+    issueDiscard(writer);
+
+    if (writer->regularFile && fstat(writer->fd, &st) == 0 && (uint64_t)st.st_size < writer->end
+            && ftruncate(writer->fd, writer->end) < 0) {
+        fprintf(stderr, "Unable to extend %s: %s\n", writer->target, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    return flushTarget(writer->fd, writer->target);
+}
+
+/*
+ * Card is read before writing only to make sure it has not been modified since its manifest was stored. If it has,
+ * the image is written as if there was no manifest.
+ */
+static void checkLastWritten(CCFlashWriter *writer, const char *target, CCCardManifest *lastWritten, bool delta) {
+    double start = getTimeMs();
+
+    if (isCardUnchanged(writer->fd, lastWritten, writer->card)) {
+        writer->lastWritten = lastWritten;
+        writer->stats->lastWritten = true;
+    } else {
+        fprintf(stderr, "Card in %s may have been modified since it was written last, its manifest is not used\n",
+                target);
+        writer->delta = delta;
+    }
+    writer->stats->cardReadMs += getTimeMs() - start;
+}
+
+// Manifest of the card is stored only once the whole image has been written and verified
+static void storeWrittenChunks(CCFlashWriter *writer, const char *dir, const char *serial) {
+    CCCardManifest *written = writer->written;
+    size_t chunks;
+
+    // Partial chunk at the end of the previous image is followed by more of the card
+    if (writer->end > written->size) {
+        if (written->size % writer->chunkSize != 0 && written->size / writer->chunkSize < written->known.size())
+            written->known[written->size / writer->chunkSize] = false;
+        written->size = writer->end;
+    }
+    chunks = (written->size + writer->chunkSize - 1) / writer->chunkSize;
+    written->hashes.resize(chunks);
+    written->known.resize(chunks);
+
+    if (getCardSize(writer->fd, &writer->written->cardSize) != EXIT_SUCCESS) {
+        fprintf(stderr, "Unable to get size of %s: %s\n", writer->target, strerror(errno));
+        return;
+    }
+
+    storeCardManifest(dir, serial, writer->written);
+}
+
+// Partition is written only if the card is partitioned the same way as the image
+static int checkCardLayout(CCFlashWriter *writer, const std::vector<CCPartition> &layout) {
+    size_t len = (PARTITION_TABLE_SIZE + IMAGE_ALIGNMENT - 1) / IMAGE_ALIGNMENT * IMAGE_ALIGNMENT;
+    std::vector<CCPartition> partitions;
+    unsigned char *table;
+    uint64_t cardSize;
+    int ret = EXIT_FAILURE;
+    ssize_t n;
+
+    if (posix_memalign((void **)&table, IMAGE_ALIGNMENT, len) != 0) {
+        fprintf(stderr, "Unable to allocate partition table buffer\n");
+        return EXIT_FAILURE;
+    }
+
+    do {
+        n = pread(writer->fd, table, len, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        fprintf(stderr, "Unable to read %s: %s\n", writer->target, strerror(errno));
+        goto finish_him;
+    }
+
+    if (parsePartitionTable(table, n, partitions) != EXIT_SUCCESS || !isSameLayout(partitions, layout)) {
+        fprintf(stderr, "Partitions of %s do not match the image, the whole image has to be written\n", writer->target);
+        goto finish_him;
+    }
+    if (getCardSize(writer->fd, &cardSize) == EXIT_SUCCESS && cardSize < writer->range->end) {
+        fprintf(stderr, "%s ends before the end of the partition\n", writer->target);
+        goto finish_him;
+    }
+    ret = EXIT_SUCCESS;
+
+finish_him:
+    free(table);
+    return ret;
+}
+
+// Bytes of the buffer which are a part of the image being written
+static uint64_t getBytesInRange(const CCFlashWriter *writer, const CCImageBuffer *buffer) {
+    uint64_t start = buffer->offset, end = buffer->offset + buffer->len;
+
+    if (writer->range == NULL)
+        return buffer->len;
+
+    if (start < writer->range->start)
+        start = writer->range->start;
+    if (end > writer->range->end)
+        end = writer->range->end;
+
+    return end > start ? end - start : 0;
+}
+
+// Writes the image to one target as reader of the shared stream
+static int writeTarget(const char *target, const char *serial, size_t reader, CCFlashShared *shared,
+                       CCFlashStats *stats) {
+    CCOptionValue *options = shared->options;
+    const char *manifestDir = options[CCO_CardManifest].args;
+    double start = getTimeMs(), waitStart;
+    std::vector<CCFlashRun> runs;
+    std::vector<CCBlockAction> actions;
+    CCCardManifest lastWritten, written;
+    CCVerifyMap verifyMap;
+    CCImageBuffer *buffer;
+    CCFlashWriter writer;
+    bool known = false;
+    int ret = EXIT_FAILURE, i;
+
+    memset(&writer, 0, sizeof(writer));
+    writer.fd = -1;
+    writer.stats = stats;
+    writer.blockSize = shared->bmap != NULL ? shared->bmap->blockSize : IMAGE_ALIGNMENT;
+    writer.sparse = options[CCO_Sparse].argn;
+    writer.bmap = shared->bmap;
+    writer.discard = options[CCO_Discard].argn;
+    writer.delta = options[CCO_Delta].argn;
+    writer.pool = &shared->pool;
+    writer.chunkSize = writer.blockSize > FLASH_DELTA_CHUNK ? writer.blockSize : FLASH_DELTA_CHUNK;
+    writer.cachedHashes = shared->cachedHashes;
+    writer.range = shared->partition ? &shared->range : NULL;
+    if (options[CCO_Verify].argn) {
+        initVerifyMap(&verifyMap, writer.blockSize);
+        writer.verifyMap = &verifyMap;
+    }
+    if (manifestDir != NULL && serial != NULL && writer.chunkSize == CARD_MANIFEST_CHUNK) {
+        known = loadCardManifest(manifestDir, serial, &lastWritten) == EXIT_SUCCESS;
+        // Card is read as in delta mode to check the manifest
+        writer.delta = writer.delta || known;
+        writer.written = &written;
+        written.size = 0;
+    }
+
+    if (isMounted(target)) {
+        fprintf(stderr, "%s or one of its partitions is mounted, refusing to overwrite it\n", target);
+        goto finish_him;
+    }
+
+    if (openWriter(target, &shared->stream, &writer) != EXIT_SUCCESS)
+        goto finish_him;
+    stats->direct = writer.direct;
+
+    if (writer.range != NULL && checkCardLayout(&writer, shared->partitions) != EXIT_SUCCESS)
+        goto finish_him;
+
+    if (known)
+        checkLastWritten(&writer, target, &lastWritten, options[CCO_Delta].argn);
+    if (writer.written != NULL && removeCardManifest(manifestDir, serial) != EXIT_SUCCESS)
+        goto finish_him;
+    // Rest of the card stays as the previous manifest says, without it the partition alone is not worth recording
+    if (writer.range != NULL && writer.lastWritten != NULL)
+        written = lastWritten;
+    else if (writer.range != NULL)
+        writer.written = NULL;
+
+    for (;;) {
+        i = getFreeSlot(&writer);
+        if (i < 0)
+            goto finish_him;
+
+        waitStart = getTimeMs();
+        buffer = getImageBuffer(&shared->stream, reader);
+        stats->readWaitMs += getTimeMs() - waitStart;
+        if (buffer == NULL)
+            break;
+
+        if (buffer->index == 0)
+            writer.start = buffer->offset;
+        writer.end = buffer->offset + buffer->len;
+        stats->bytes += getBytesInRange(&writer, buffer);
+        if (processBuffer(&writer, i, buffer, runs, actions) != EXIT_SUCCESS)
+            goto finish_him;
+    }
+
+    if (drainWriter(&writer) != EXIT_SUCCESS || shared->stream.ret != EXIT_SUCCESS)
+        goto finish_him;
+
+    if (writer.range != NULL && writer.end < writer.range->end) {
+        fprintf(stderr, "Image ends before the end of partition %s\n", options[CCO_Partition].args);
+        goto finish_him;
+    }
+
+    if (shared->bmap != NULL && writer.range == NULL && stats->bytes != shared->bmap->imageSize) {
+        fprintf(stderr, "Image has %llu bytes, but its block map describes %llu bytes\n",
+                (unsigned long long)stats->bytes, (unsigned long long)shared->bmap->imageSize);
+        goto finish_him;
+    }
+
+    if (finishWriter(&writer) != EXIT_SUCCESS)
+        goto finish_him;
+
+    if (writer.verifyMap != NULL) {
+        waitStart = getTimeMs();
+        if (verifyCard(target, writer.start, writer.range != NULL ? writer.range->end : writer.end, &verifyMap,
+                       &shared->pool) != EXIT_SUCCESS)
+            goto finish_him;
+        stats->verifyMs = getTimeMs() - waitStart;
+    }
+
+    if (writer.written != NULL)
+        storeWrittenChunks(&writer, manifestDir, serial);
+    ret = EXIT_SUCCESS;
+
+finish_him:
+    drainWriter(&writer);
+    detachImageReader(&shared->stream, reader);
+    stats->async = writer.async;
+    closeWriter(&writer);
+    stats->totalMs = getTimeMs() - start;
+
+    return ret;
+}
+
+static void writerThread(const char *target, const char *serial, size_t reader, CCFlashShared *shared,
+                         CCFlashStats *stats, int *ret) {
+    *ret = writeTarget(target, serial, reader, shared, stats);
+}
+
+/*
+ * Image found in the cache given with --image-cache is mapped instead of being decompressed, and hashes of its
+ * manifest are used by --delta and --verify. Other images are stored in the cache by one more reader of the stream,
+ * unless only a partition of them is read.
+ */
+static int startStream(CCFlashShared *shared, size_t readers, CCCachedImage *cached, CCCacheWriter *cacheWriter,
+                       bool *caching) {
+    const char *image = shared->options[CCO_FlashImage].args;
+    const char *cacheDir = shared->options[CCO_ImageCache].args;
+    const CCImageRange *range = shared->partition ? &shared->range : NULL;
+
+    *caching = false;
+    if (cacheDir == NULL)
+        return startImageStream(image, readers, range, NULL, &shared->stream);
+
+    if (findCachedImage(cacheDir, image, cached)
+            && startMappedImageStream(cached->path.c_str(), readers, range, &shared->stream) == EXIT_SUCCESS) {
+        shared->cachedHashes = &cached->hashes[0];
+        return EXIT_SUCCESS;
+    }
+
+    *caching = range == NULL && strcmp(image, "-") != 0
+            && prepareCacheWriter(cacheDir, image, cacheWriter) == EXIT_SUCCESS;
+    if (startImageStream(image, readers + *caching, range, *caching ? &cacheWriter->inputHash : NULL,
+                         &shared->stream) == EXIT_SUCCESS)
+        return EXIT_SUCCESS;
+
+    if (*caching)
+        finishCacheWriter(cacheWriter, false, 0);
+
+    return EXIT_FAILURE;
+}
+
+// Finds the partition given with --partition in the partition table read from the beginning of the image
+static int selectPartition(CCFlashShared *shared) {
+    const char *image = shared->options[CCO_FlashImage].args, *name = shared->options[CCO_Partition].args;
+    size_t blockSize = shared->bmap != NULL ? shared->bmap->blockSize : IMAGE_ALIGNMENT;
+    unsigned char table[PARTITION_TABLE_SIZE];
+    const CCPartition *partition;
+    ssize_t n;
+
+    // Image is read twice, first only for its partition table
+    if (strcmp(image, "-") == 0) {
+        fprintf(stderr, "--partition cannot be used with an image read from standard input\n");
+        return EXIT_FAILURE;
+    }
+
+    n = readImageHead(image, table, sizeof(table));
+    if (n < 0)
+        return EXIT_FAILURE;
+
+    if (parsePartitionTable(table, n, shared->partitions) != EXIT_SUCCESS) {
+        fprintf(stderr, "%s has no partition table\n", image);
+        return EXIT_FAILURE;
+    }
+
+    partition = findPartition(shared->partitions, name);
+    if (partition == NULL) {
+        fprintf(stderr, "Partition %s not found in %s\n", name, image);
+        return EXIT_FAILURE;
+    }
+    if (partition->start % blockSize != 0 || partition->size % blockSize != 0) {
+        fprintf(stderr, "Partition %s of %s is not aligned to %zu bytes\n", name, image, blockSize);
+        return EXIT_FAILURE;
+    }
+
+    shared->partition = true;
+    shared->range.start = partition->start;
+    shared->range.end = partition->start + partition->size;
+
+    return EXIT_SUCCESS;
+}
+
+int flashImages(const std::vector<std::string> &targets, const std::vector<std::string> &serials,
+                CCOptionValue options[], std::vector<CCFlashStats> &stats, std::vector<int> &results) {
+    std::vector<std::thread> writers;
+    CCCachedImage cached;
+    CCCacheWriter cacheWriter;
+    CCFlashShared shared;
+    CCBmap bmap;
+    bool hashing = options[CCO_Delta].argn || options[CCO_Verify].argn || options[CCO_CardManifest].args != NULL;
+    bool caching, stored = false;
+    int ret = EXIT_SUCCESS;
+
+    stats.resize(targets.size());
+    memset(&stats[0], 0, stats.size() * sizeof(stats[0]));
+    results.assign(targets.size(), EXIT_FAILURE);
+    shared.options = options;
+    shared.bmap = NULL;
+    shared.cachedHashes = NULL;
+    shared.partition = false;
+
+    if (options[CCO_Bmap].args != NULL) {
+        if (loadBmap(options[CCO_Bmap].args, &bmap) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+        shared.bmap = &bmap;
+    }
+
+    if (options[CCO_Partition].args != NULL && selectPartition(&shared) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    if (startStream(&shared, targets.size(), &cached, &cacheWriter, &caching) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    if (hashing || caching)
+        startHashPool(&shared.pool);
+    if (caching)
+        startCacheWriter(&cacheWriter, &shared.stream, targets.size(), &shared.pool);
+
+    // A single target is written by the calling thread
+    if (targets.size() == 1) {
+        results[0] = writeTarget(targets[0].c_str(), serials.empty() ? NULL : serials[0].c_str(), 0, &shared,
+                                 &stats[0]);
+    } else {
+        for (size_t i = 0; i < targets.size(); i++) {
+            writers.push_back(std::thread(writerThread, targets[i].c_str(), serials.empty() ? NULL : serials[i].c_str(),
+                                          i, &shared, &stats[i], &results[i]));
+        }
+        for (size_t i = 0; i < writers.size(); i++)
+            writers[i].join();
+    }
+
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (results[i] == EXIT_SUCCESS)
+            stored = true;
+    }
+    // Image is not decompressed to its end just for the cache if no target is being written anymore
+    if (caching)
+        finishCacheWriter(&cacheWriter, stored, (uint64_t)options[CCO_ImageCacheSize].argn << 20);
+
+    if (hashing || caching)
+        stopHashPool(&shared.pool);
+    if (stopImageStream(&shared.stream) != EXIT_SUCCESS)
+        results.assign(targets.size(), EXIT_FAILURE);
+
+    for (size_t i = 0; i < targets.size(); i++) {
+        stats[i].format = shared.stream.format;
+        stats[i].cached = shared.cachedHashes != NULL;
+        stats[i].imageBytes = shared.stream.inBytes;
+        stats[i].decodeMs = shared.stream.busyMs;
+        stats[i].writeWaitMs = shared.stream.waitMs;
+        if (results[i] != EXIT_SUCCESS)
+            ret = EXIT_FAILURE;
+    }
+
+    return ret;
+}
+
+int flashImage(const char *target, CCOptionValue options[], CCFlashStats *stats) {
+    std::vector<std::string> targets(1, target), serials;
+    std::vector<CCFlashStats> allStats;
+    std::vector<int> results;
+    int ret;
+
+    if (options[CCO_DeviceSerial].args != NULL)
+        serials.push_back(options[CCO_DeviceSerial].args);
+    ret = flashImages(targets, serials, options, allStats, results);
+    *stats = allStats[0];
+
+    return ret;
+}
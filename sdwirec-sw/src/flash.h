@@ -0,0 +1,74 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/flash.h
+ * @brief       Writing images to the SD card
+ */
+
+#ifndef SDMUXCTRL_FLASH_H
+#define SDMUXCTRL_FLASH_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "image.h"
+
+#define SDMUX_FLASH_DIRECT_ENV  "SDMUX_FLASH_DIRECT"    // Set to 0 to write through the page cache
+#define FLASH_QUEUE_DEPTH       2       // Buffers written at once, the rest of the ring is filled meanwhile
+#define FLASH_MAX_RUNS          32      // Writes per buffer, runs separated by the smallest gaps are merged beyond it
+#define FLASH_DELTA_CHUNK       (256 << 10)     // Unit compared and rewritten by --delta
+#define FLASH_BLOCKDEV_TIMEOUT  30      // Seconds the card of --flash is waited for unless --timeout is given
+
+struct CCFlashStats {
+    uint64_t bytes;
+    uint64_t writtenBytes;
+    uint64_t skippedBytes;      // Unmapped or zero blocks left out
+    uint64_t discardedBytes;
+    uint64_t unchangedBytes;    // Blocks already on the card found by --delta
+    uint64_t imageBytes;        // Bytes read from the image file, less than bytes for compressed images
+    CCImageFormat format;
+    double totalMs;
+    double decodeMs;            // Time spent reading and decompressing the image
+    double readWaitMs;          // Time the writer waited for the image to be decompressed
+    double writeWaitMs;         // Time decompression waited for buffers to be written
+    double cardReadMs;          // Time spent reading the card by --delta
+    double hashMs;              // Time spent hashing chunks of the image and of the card
+    double verifyMs;            // Time spent reading the card back by --verify
+    bool cached;                // Image mapped from the cache given with --image-cache
+    bool lastWritten;           // Compared with the manifest of the card given with --card-manifest
+    bool direct;                // Written with O_DIRECT
+    bool async;                 // Written with kernel AIO
+};
+
+/*
+ * Writes the image given with --flash to the target. Blocks left out of the block map given with --bmap or, with
+ * --sparse, holding only zeros are skipped and with --discard also discarded. With --delta chunks already on the card
+ * are not written. With --verify the card is read back after writing. With --card-manifest chunks written last to the
+ * card of the device given with --device-serial are not written again.
+ */
+int flashImage(const char *target, CCOptionValue options[], CCFlashStats *stats);
+/*
+ * Writes the image to all targets at once, decompressing it only once. Serial numbers of the devices the targets
+ * belong to, if known, select their manifests for --card-manifest. Result and statistics of each target are stored at
+ * its index, the call fails if any of the targets fails.
+ */
+int flashImages(const std::vector<std::string> &targets, const std::vector<std::string> &serials,
+                CCOptionValue options[], std::vector<CCFlashStats> &stats, std::vector<int> &results);
+
+#endif // SDMUXCTRL_FLASH_H
@@ -0,0 +1,207 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/ftdibackend.cpp
+ * @brief       Backend accessing real devices through libftdi and libusb
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libusb.h>
+
+#include "backend.h"
+
+#define MAX_PORTS       8
+
+static int openBusAddr(struct ftdi_context *ftdi, int busnum, int devnum) {
+    return ftdi_usb_open_bus_addr(ftdi, busnum, devnum);
+}
+
+static int openDescIndex(struct ftdi_context *ftdi, int vendor, int product, const char *serial, unsigned int index) {
+    return ftdi_usb_open_desc_index(ftdi, vendor, product, NULL, serial, index);
+}
+
+static libusb_context *hotplugContext;
+static libusb_hotplug_callback_handle hotplugHandle;
+static CCHotplugCallback hotplugCallback;
+
+// Builds sysfs name of the port the device is plugged into, e.g. "1-2.4"
+static int getUsbPort(libusb_device *dev, char *port, size_t size) {
+    uint8_t ports[MAX_PORTS];
+    int n, len;
+
+    n = libusb_get_port_numbers(dev, ports, MAX_PORTS);
+    if (n <= 0)
+        return -1;
+
+    len = snprintf(port, size, "%d-%d", libusb_get_bus_number(dev), ports[0]);
+    for (int i = 1; i < n; i++)
+        len += snprintf(port + len, size - len, ".%d", ports[i]);
+
+    return 0;
+}
+
+static int getPort(struct ftdi_context *ftdi, char *port, size_t size, int *busnum, int *devnum) {
+    libusb_device *dev = libusb_get_device(ftdi->usb_dev);
+
+    if (getUsbPort(dev, port, size) < 0)
+        return -1;
+
+    *busnum = libusb_get_bus_number(dev);
+    *devnum = libusb_get_device_address(dev);
+
+    return 0;
+}
+
+static int readProduct(struct ftdi_context *ftdi, char *product, int len) {
+    struct libusb_device_descriptor desc;
+    int f;
+
+    f = libusb_get_device_descriptor(libusb_get_device(ftdi->usb_dev), &desc);
+    if (f < 0)
+        return f;
+
+    f = libusb_get_string_descriptor_ascii(ftdi->usb_dev, desc.iProduct, (unsigned char *)product, len - 1);
+    if (f < 0)
+        return f;
+    product[f] = '\0';
+
+    return f;
+}
+
+static int decodeEeprom(struct ftdi_context *ftdi) {
+    return ftdi_eeprom_decode(ftdi, 0);
+}
+
+static int getEepromProduct(struct ftdi_context *ftdi, char *product, int len) {
+    return ftdi_eeprom_get_strings(ftdi, NULL, 0, product, len, NULL, 0);
+}
+
+static int readData(struct ftdi_context *ftdi, unsigned char *pins) {
+    return ftdi_read_data(ftdi, pins, 1);
+}
+
+static int writeData(struct ftdi_context *ftdi, unsigned char pins) {
+    return ftdi_write_data(ftdi, &pins, 1);
+}
+
+static void closeUsb(struct ftdi_context *ftdi) {
+    ftdi_usb_close(ftdi);
+}
+
+static int onHotplug(libusb_context *, libusb_device *device, libusb_hotplug_event event, void *) {
+    bool arrived = event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED;
+    struct libusb_device_descriptor desc;
+    CCUsbDevice dev;
+
+    memset(&dev, 0, sizeof(dev));
+    if (getUsbPort(device, dev.port, sizeof(dev.port)) < 0)
+        return 0;
+
+    // Strings are taken from sysfs, which is populated before libusb learns about the device
+    if (!arrived || readUsbDevice(dev.port, &dev) != EXIT_SUCCESS) {
+        dev.busnum = libusb_get_bus_number(device);
+        dev.devnum = libusb_get_device_address(device);
+        if (libusb_get_device_descriptor(device, &desc) == 0) {
+            dev.vendor = desc.idVendor;
+            dev.product = desc.idProduct;
+        }
+    }
+
+    hotplugCallback(&dev, arrived);
+
+    return 0;
+}
+
+static int watch(int vendor, int product, CCHotplugCallback callback) {
+    int f;
+
+    if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG))
+        return LIBUSB_ERROR_NOT_SUPPORTED;
+
+    f = libusb_init(&hotplugContext);
+    if (f < 0)
+        return f;
+
+    hotplugCallback = callback;
+    f = libusb_hotplug_register_callback(hotplugContext,
+                                         LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+                                         LIBUSB_HOTPLUG_NO_FLAGS, vendor, product, LIBUSB_HOTPLUG_MATCH_ANY,
+                                         onHotplug, NULL, &hotplugHandle);
+    if (f < 0) {
+        libusb_exit(hotplugContext);
+        hotplugContext = NULL;
+    }
+
+    return f;
+}
+
+static int getEventFds(std::vector<struct pollfd> &fds) {
+    const struct libusb_pollfd **usbFds = libusb_get_pollfds(hotplugContext);
+    struct pollfd pfd;
+
+    if (usbFds == NULL)
+        return -1;
+
+    for (size_t i = 0; usbFds[i] != NULL; i++) {
+        pfd.fd = usbFds[i]->fd;
+        pfd.events = usbFds[i]->events;
+        pfd.revents = 0;
+        fds.push_back(pfd);
+    }
+    libusb_free_pollfds(usbFds);
+
+    return 0;
+}
+
+static int handleEvents(int timeoutMs) {
+    struct timeval tv = { timeoutMs / 1000, (timeoutMs % 1000) * 1000 };
+
+    return libusb_handle_events_timeout_completed(hotplugContext, &tv, NULL);
+}
+
+static void unwatch() {
+    if (hotplugContext == NULL)
+        return;
+
+    libusb_hotplug_deregister_callback(hotplugContext, hotplugHandle);
+    libusb_exit(hotplugContext);
+    hotplugContext = NULL;
+}
+
+const CCBackend ftdiBackend = {
+    "ftdi",
+    false,
+    enumerateUsbDevices,
+    openBusAddr,
+    openDescIndex,
+    getPort,
+    readProduct,
+    ftdi_read_eeprom,
+    decodeEeprom,
+    getEepromProduct,
+    ftdi_set_bitmode,
+    readData,
+    ftdi_read_pins,
+    writeData,
+    closeUsb,
+    watch,
+    getEventFds,
+    handleEvents,
+    unwatch,
+};
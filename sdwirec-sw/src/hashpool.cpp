@@ -0,0 +1,164 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/hashpool.cpp
+ * @brief       Hashing of image and card chunks on all CPU cores
+ */
+
+#include <atomic>
+
+#include "hashpool.h"
+#include "xxhash.h"
+
+struct CCHashJob {
+    const unsigned char *data;
+    size_t len;
+    size_t chunkSize;
+    uint64_t *hashes;
+    const uint64_t *skipped;
+    size_t blockSize;
+    size_t count;
+    std::atomic<size_t> next;
+    // Protected by the lock of the pool
+    size_t done;
+    int workers;                // Workers still referring to the job
+};
+
+// Blocks left in the chunk are hashed run by run, each run seeded with the hash of the previous ones
+static uint64_t hashMaskedChunk(const unsigned char *data, size_t len, uint64_t skipped, size_t blockSize) {
+    uint64_t hash = 0;
+    size_t start, end;
+
+    for (start = 0; start < len; start = end) {
+        end = start + blockSize;
+        if (skipped & ((uint64_t)1 << (start / blockSize)))
+            continue;
+        while (end < len && !(skipped & ((uint64_t)1 << (end / blockSize))))
+            end += blockSize;
+        if (end > len)
+            end = len;
+        hash = xxh64(data + start, end - start, hash);
+    }
+
+    return hash;
+}
+
+// Hashes chunks of the job until none is left, returns the number of chunks hashed
+static size_t runJob(CCHashJob *job) {
+    const unsigned char *data;
+    size_t i, n = 0, len;
+
+    while ((i = job->next++) < job->count) {
+        data = job->data + i * job->chunkSize;
+        len = job->len - i * job->chunkSize < job->chunkSize ? job->len - i * job->chunkSize : job->chunkSize;
+        if (job->skipped != NULL && job->skipped[i] != 0)
+            job->hashes[i] = hashMaskedChunk(data, len, job->skipped[i], job->blockSize);
+        else
+            job->hashes[i] = xxh64(data, len, 0);
+        n++;
+    }
+
+    return n;
+}
+
+static void worker(CCHashPool *pool) {
+    std::unique_lock<std::mutex> lock(pool->lock);
+    CCHashJob *job;
+    size_t n;
+
+    for (;;) {
+        while (pool->jobs.empty() && !pool->stop)
+            pool->cond.wait(lock);
+        if (pool->stop)
+            break;
+
+        job = pool->jobs.front();
+        // Job stays queued until all of its chunks are taken, so idle workers join in
+        if (job->next >= job->count) {
+            pool->jobs.pop_front();
+            continue;
+        }
+
+        job->workers++;
+        lock.unlock();
+        n = runJob(job);
+        lock.lock();
+
+        job->done += n;
+        job->workers--;
+        if (job->done == job->count && job->workers == 0)
+            pool->cond.notify_all();
+    }
+}
+
+void startHashPool(CCHashPool *pool) {
+    unsigned int n = std::thread::hardware_concurrency();
+
+    pool->stop = false;
+    // Thread calling hashChunks() counts as one of the cores
+    for (unsigned int i = 1; i < n; i++)
+        pool->threads.push_back(std::thread(worker, pool));
+}
+
+void stopHashPool(CCHashPool *pool) {
+    {
+        std::lock_guard<std::mutex> lock(pool->lock);
+        pool->stop = true;
+        pool->cond.notify_all();
+    }
+
+    for (size_t i = 0; i < pool->threads.size(); i++)
+        pool->threads[i].join();
+    pool->threads.clear();
+}
+
+void hashChunks(CCHashPool *pool, const unsigned char *data, size_t len, size_t chunkSize, uint64_t *hashes,
+                const uint64_t *skipped, size_t blockSize) {
+    CCHashJob job;
+    size_t n;
+
+    job.data = data;
+    job.len = len;
+    job.chunkSize = chunkSize;
+    job.hashes = hashes;
+    job.skipped = skipped;
+    job.blockSize = blockSize;
+    job.count = (len + chunkSize - 1) / chunkSize;
+    job.next = 0;
+    job.done = 0;
+    job.workers = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(pool->lock);
+        pool->jobs.push_back(&job);
+        pool->cond.notify_all();
+    }
+
+    n = runJob(&job);
+
+    std::unique_lock<std::mutex> lock(pool->lock);
+    job.done += n;
+    while (job.done < job.count || job.workers > 0)
+        pool->cond.wait(lock);
+
+    // Workers may have dropped the job already
+    for (std::deque<CCHashJob *>::iterator it = pool->jobs.begin(); it != pool->jobs.end(); ++it) {
+        if (*it == &job) {
+            pool->jobs.erase(it);
+            break;
+        }
+    }
+}
@@ -0,0 +1,58 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/hashpool.h
+ * @brief       Hashing of image and card chunks on all CPU cores
+ */
+
+#ifndef SDMUXCTRL_HASHPOOL_H
+#define SDMUXCTRL_HASHPOOL_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define HASH_MAX_CHUNK_BLOCKS   64
+
+struct CCHashJob;
+
+struct CCHashPool {
+    std::vector<std::thread> threads;
+    std::deque<CCHashJob *> jobs;
+    std::mutex lock;
+    std::condition_variable cond;
+    bool stop;
+};
+
+void startHashPool(CCHashPool *pool);
+void stopHashPool(CCHashPool *pool);
+
+/*
+ * Stores XXH64 of each chunkSize bytes of data in hashes, the last chunk may be shorter. The calling thread takes part
+ * in hashing, so many threads may hash at once without waiting for each other's jobs.
+ *
+ * If skipped is given, bits set in its masks leave blocks of blockSize bytes out of the hash of the chunk, the lowest
+ * bit standing for the first block. Chunks must not have more than HASH_MAX_CHUNK_BLOCKS blocks then.
+ */
+void hashChunks(CCHashPool *pool, const unsigned char *data, size_t len, size_t chunkSize, uint64_t *hashes,
+                const uint64_t *skipped, size_t blockSize);
+
+#endif // SDMUXCTRL_HASHPOOL_H
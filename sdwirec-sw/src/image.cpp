@@ -0,0 +1,620 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/image.cpp
+ * @brief       Reading of possibly compressed images into a ring of buffers
+ *
+ * Format is detected from magic bytes, so the image may be given on stdin. Gzip, xz and zstd images are supported
+ * when sd-mux-ctrl is built with zlib, liblzma and libzstd respectively. Concatenated members, streams and frames are
+ * decompressed one after another, as the command line tools do.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "image.h"
+#include "sha256.h"
+#include "timing.h"
+
+enum CCDecodeResult {
+    CCDR_Ok = 0,
+    CCDR_End,           // End of a member, stream or frame, another one may follow
+    CCDR_Error
+};
+
+struct CCImageDecoder {
+    unsigned char *in;
+    size_t inLen;
+    size_t inPos;
+    bool eof;
+    bool finished;
+#ifdef HAVE_ZLIB
+    z_stream gzip;
+#endif
+#ifdef HAVE_LZMA
+    lzma_stream xz;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DStream *zstd;
+#endif
+};
+
+struct CCImageMagic {
+    CCImageFormat format;
+    size_t len;
+    const unsigned char bytes[IMAGE_MAGIC_SIZE];
+};
+
+static const CCImageMagic imageMagics[] = {
+    { CCIF_Gzip, 2, { 0x1f, 0x8b } },
+    { CCIF_Xz, 6, { 0xfd, '7', 'z', 'X', 'Z', 0x00 } },
+    { CCIF_Zstd, 4, { 0x28, 0xb5, 0x2f, 0xfd } },
+};
+
+static const char *formatNames[CCIF_MAX] = { "raw", "gzip", "xz", "zstd" };
+
+const char *getImageFormatName(CCImageFormat format) {
+    return format < CCIF_MAX ? formatNames[format] : "unknown";
+}
+
+static int refillInput(CCImageStream *stream) {
+    CCImageDecoder *dec = stream->decoder;
+    ssize_t n;
+
+    do {
+        n = read(stream->fd, dec->in, IMAGE_INPUT_SIZE);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        fprintf(stderr, "Unable to read %s: %s\n", stream->path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    dec->inLen = n;
+    dec->inPos = 0;
+    dec->eof = n == 0;
+    stream->inBytes += n;
+    if (stream->inputHash != NULL)
+        sha256Update(stream->inputHash, dec->in, n);
+
+    return EXIT_SUCCESS;
+}
+
+static int initDecoder(CCImageStream *stream) {
+    CCImageDecoder *dec = stream->decoder;
+
+    switch (stream->format) {
+    case CCIF_Raw:
+        return EXIT_SUCCESS;
+#ifdef HAVE_ZLIB
+    case CCIF_Gzip:
+        memset(&dec->gzip, 0, sizeof(dec->gzip));
+        if (inflateInit2(&dec->gzip, 16 + MAX_WBITS) == Z_OK)
+            return EXIT_SUCCESS;
+        break;
+#endif
+#ifdef HAVE_LZMA
+    case CCIF_Xz:
+        dec->xz = LZMA_STREAM_INIT;
+        if (lzma_stream_decoder(&dec->xz, UINT64_MAX, 0) == LZMA_OK)
+            return EXIT_SUCCESS;
+        break;
+#endif
+#ifdef HAVE_ZSTD
+    case CCIF_Zstd:
+        dec->zstd = ZSTD_createDStream();
+        if (dec->zstd != NULL && !ZSTD_isError(ZSTD_initDStream(dec->zstd)))
+            return EXIT_SUCCESS;
+        break;
+#endif
+    default:
+        fprintf(stderr, "%s is a %s image, but sd-mux-ctrl was built without %s support\n", stream->path,
+                getImageFormatName(stream->format), getImageFormatName(stream->format));
+        return EXIT_FAILURE;
+    }
+
+    fprintf(stderr, "Unable to initialize %s decoder\n", getImageFormatName(stream->format));
+    return EXIT_FAILURE;
+}
+
+static void endDecoder(CCImageStream *stream) {
+    switch (stream->format) {
+#ifdef HAVE_ZLIB
+    case CCIF_Gzip:
+        inflateEnd(&stream->decoder->gzip);
+        break;
+#endif
+#ifdef HAVE_LZMA
+    case CCIF_Xz:
+        lzma_end(&stream->decoder->xz);
+        break;
+#endif
+#ifdef HAVE_ZSTD
+    case CCIF_Zstd:
+        ZSTD_freeDStream(stream->decoder->zstd);
+        break;
+#endif
+    default:
+        break;
+    }
+}
+
+// Prepares the decoder for the next member, stream or frame
+static void resetDecoder(CCImageStream *stream) {
+    switch (stream->format) {
+#ifdef HAVE_ZLIB
+    case CCIF_Gzip:
+        inflateReset(&stream->decoder->gzip);
+        break;
+#endif
+#ifdef HAVE_LZMA
+    case CCIF_Xz:
+        lzma_end(&stream->decoder->xz);
+        initDecoder(stream);
+        break;
+#endif
+#ifdef HAVE_ZSTD
+    case CCIF_Zstd:
+        ZSTD_initDStream(stream->decoder->zstd);
+        break;
+#endif
+    default:
+        break;
+    }
+}
+
+static CCDecodeResult decodeStep(CCImageStream *stream, unsigned char *out, size_t outLen, size_t *consumed,
+                                 size_t *produced) {
+    CCImageDecoder *dec = stream->decoder;
+    unsigned char *in = dec->in + dec->inPos;
+    size_t inLen = dec->inLen - dec->inPos;
+
+    // Unused when built without any decompression library
+    (void)in;
+    (void)inLen;
+    (void)out;
+    (void)outLen;
+    *consumed = 0;
+    *produced = 0;
+
+    switch (stream->format) {
+#ifdef HAVE_ZLIB
+    case CCIF_Gzip: {
+        int r;
+
+        dec->gzip.next_in = in;
+        dec->gzip.avail_in = inLen;
+        dec->gzip.next_out = out;
+        dec->gzip.avail_out = outLen;
+        r = inflate(&dec->gzip, Z_NO_FLUSH);
+        *consumed = inLen - dec->gzip.avail_in;
+        *produced = outLen - dec->gzip.avail_out;
+        if (r == Z_STREAM_END)
+            return CCDR_End;
+        if (r == Z_OK || r == Z_BUF_ERROR)
+            return CCDR_Ok;
+        fprintf(stderr, "Unable to decompress %s: %s\n", stream->path,
+                dec->gzip.msg != NULL ? dec->gzip.msg : "corrupted data");
+        return CCDR_Error;
+    }
+#endif
+#ifdef HAVE_LZMA
+    case CCIF_Xz: {
+        lzma_ret r;
+
+        dec->xz.next_in = in;
+        dec->xz.avail_in = inLen;
+        dec->xz.next_out = out;
+        dec->xz.avail_out = outLen;
+        r = lzma_code(&dec->xz, dec->eof ? LZMA_FINISH : LZMA_RUN);
+        *consumed = inLen - dec->xz.avail_in;
+        *produced = outLen - dec->xz.avail_out;
+        if (r == LZMA_STREAM_END)
+            return CCDR_End;
+        if (r == LZMA_OK || r == LZMA_BUF_ERROR)
+            return CCDR_Ok;
+        fprintf(stderr, "Unable to decompress %s: liblzma error %d\n", stream->path, (int)r);
+        return CCDR_Error;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    case CCIF_Zstd: {
+        ZSTD_inBuffer input = { in, inLen, 0 };
+        ZSTD_outBuffer output = { out, outLen, 0 };
+        size_t r;
+
+        r = ZSTD_decompressStream(dec->zstd, &output, &input);
+        *consumed = input.pos;
+        *produced = output.pos;
+        if (ZSTD_isError(r)) {
+            fprintf(stderr, "Unable to decompress %s: %s\n", stream->path, ZSTD_getErrorName(r));
+            return CCDR_Error;
+        }
+        return r == 0 ? CCDR_End : CCDR_Ok;
+    }
+#endif
+    default:
+        return CCDR_Error;
+    }
+}
+
+// Fills the buffer up to its size, less only at the end of the image
+static ssize_t fillBuffer(CCImageStream *stream, unsigned char *buf, size_t len) {
+    CCImageDecoder *dec = stream->decoder;
+    size_t out = 0, consumed, produced;
+    CCDecodeResult r;
+
+    while (out < len && !dec->finished) {
+        if (dec->inPos == dec->inLen && !dec->eof && refillInput(stream) != EXIT_SUCCESS)
+            return -1;
+
+        if (stream->format == CCIF_Raw) {
+            size_t n = dec->inLen - dec->inPos < len - out ? dec->inLen - dec->inPos : len - out;
+
+            memcpy(buf + out, dec->in + dec->inPos, n);
+            dec->inPos += n;
+            out += n;
+            dec->finished = dec->eof;
+            continue;
+        }
+
+        r = decodeStep(stream, buf + out, len - out, &consumed, &produced);
+        dec->inPos += consumed;
+        out += produced;
+        if (r == CCDR_Error)
+            return -1;
+
+        if (r == CCDR_End) {
+            if (dec->inPos == dec->inLen && !dec->eof && refillInput(stream) != EXIT_SUCCESS)
+                return -1;
+            if (dec->inPos == dec->inLen)
+                dec->finished = true;
+            else
+                resetDecoder(stream);
+        } else if (consumed == 0 && produced == 0 && dec->eof) {
+            fprintf(stderr, "Unable to decompress %s: unexpected end of file\n", stream->path);
+            return -1;
+        }
+    }
+
+    return out;
+}
+
+static ssize_t mapBuffer(CCImageStream *stream, CCImageBuffer *buffer, uint64_t offset) {
+    size_t len = stream->mapLen - offset < IMAGE_BUFFER_SIZE ? stream->mapLen - offset : IMAGE_BUFFER_SIZE;
+
+    buffer->data = stream->map + offset;
+    // Pages are read ahead while previous buffers are being written
+    if (len > 0)
+        madvise(buffer->data, len, MADV_WILLNEED);
+    stream->inBytes += len;
+
+    return len;
+}
+
+// Raw images are not read before the first buffer of the range, others have to be decompressed up to it anyway
+static uint64_t skipToRange(CCImageStream *stream) {
+    uint64_t start = stream->range.start / IMAGE_BUFFER_SIZE * IMAGE_BUFFER_SIZE;
+
+    if (stream->map != NULL)
+        return start < stream->mapLen ? start : stream->mapLen;
+
+    if (start == 0 || stream->format != CCIF_Raw || lseek(stream->fd, start, SEEK_SET) != (off_t)start)
+        return 0;
+
+    // Input buffer holds the beginning of the file read to detect its format
+    stream->decoder->inLen = 0;
+    stream->decoder->inPos = 0;
+
+    return start;
+}
+
+static void producer(CCImageStream *stream) {
+    CCImageBuffer *buffer;
+    uint64_t offset, index = 0;
+    double start;
+    ssize_t n;
+
+    offset = skipToRange(stream);
+    for (;;) {
+        std::unique_lock<std::mutex> lock(stream->lock);
+
+        start = getTimeMs();
+        while (stream->idle.empty() && !stream->stop)
+            stream->cond.wait(lock);
+        stream->waitMs += getTimeMs() - start;
+        if (stream->stop)
+            break;
+        buffer = stream->idle.front();
+        stream->idle.pop_front();
+        lock.unlock();
+
+        start = getTimeMs();
+        if (stream->map != NULL)
+            n = mapBuffer(stream, buffer, offset);
+        else
+            n = fillBuffer(stream, buffer->data, IMAGE_BUFFER_SIZE);
+        stream->busyMs += getTimeMs() - start;
+
+        lock.lock();
+        if (n < 0) {
+            stream->ret = EXIT_FAILURE;
+            stream->idle.push_back(buffer);
+            break;
+        }
+        if (n > 0 && stream->readers > 0 && offset + n > stream->range.start) {
+            buffer->len = n;
+            buffer->offset = offset;
+            buffer->index = index++;
+            buffer->refs = stream->readers;
+            stream->outBytes += n;
+            stream->filled.push_back(buffer);
+            stream->cond.notify_all();
+        } else {
+            stream->idle.push_back(buffer);
+        }
+        offset += n;
+        if ((size_t)n < IMAGE_BUFFER_SIZE || offset >= stream->range.end)
+            break;
+    }
+
+    std::lock_guard<std::mutex> lock(stream->lock);
+    stream->done = true;
+    stream->cond.notify_all();
+}
+
+static CCImageFormat detectFormat(const unsigned char *data, size_t len) {
+    for (size_t i = 0; i < sizeof(imageMagics) / sizeof(imageMagics[0]); i++) {
+        if (len >= imageMagics[i].len && memcmp(data, imageMagics[i].bytes, imageMagics[i].len) == 0)
+            return imageMagics[i].format;
+    }
+
+    return CCIF_Raw;
+}
+
+static void freeImageStream(CCImageStream *stream) {
+    if (stream->decoder != NULL) {
+        free(stream->decoder->in);
+        delete stream->decoder;
+        stream->decoder = NULL;
+    }
+    if (stream->map != NULL) {
+        munmap(stream->map, stream->mapLen);
+        stream->map = NULL;
+    } else {
+        for (size_t i = 0; i < stream->buffers.size(); i++)
+            free(stream->buffers[i].data);
+    }
+    stream->buffers.clear();
+    stream->idle.clear();
+    stream->filled.clear();
+    if (stream->fd >= 0 && stream->fd != STDIN_FILENO)
+        close(stream->fd);
+    stream->fd = -1;
+}
+
+static void initImageStream(const char *path, size_t readers, const CCImageRange *range, CCImageStream *stream) {
+    stream->path = path;
+    stream->range.start = range != NULL ? range->start : 0;
+    stream->range.end = range != NULL ? range->end : UINT64_MAX;
+    stream->positions.assign(readers, 0);
+    stream->readers = readers;
+    stream->done = false;
+    stream->stop = false;
+    stream->ret = EXIT_SUCCESS;
+    stream->inBytes = 0;
+    stream->outBytes = 0;
+    stream->busyMs = 0;
+    stream->waitMs = 0;
+    stream->decoder = NULL;
+    stream->map = NULL;
+    stream->mapLen = 0;
+    stream->inputHash = NULL;
+    stream->format = CCIF_Raw;
+    stream->buffers.resize(IMAGE_RING_BUFFERS);
+}
+
+int startImageStream(const char *path, size_t readers, const CCImageRange *range, CCSha256 *inputHash,
+                     CCImageStream *stream) {
+    CCImageDecoder *dec;
+
+    initImageStream(path, readers, range, stream);
+    stream->inputHash = inputHash;
+    stream->decoder = dec = new CCImageDecoder();
+
+    stream->fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY | O_CLOEXEC);
+    if (stream->fd < 0) {
+        fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+        goto finish_him;
+    }
+
+    for (size_t i = 0; i < stream->buffers.size(); i++) {
+        if (posix_memalign((void **)&stream->buffers[i].data, IMAGE_ALIGNMENT, IMAGE_BUFFER_SIZE) != 0) {
+            stream->buffers[i].data = NULL;
+            fprintf(stderr, "Unable to allocate image buffers\n");
+            goto finish_him;
+        }
+        stream->idle.push_back(&stream->buffers[i]);
+    }
+
+    dec->in = (unsigned char *)malloc(IMAGE_INPUT_SIZE);
+    if (dec->in == NULL) {
+        fprintf(stderr, "Unable to allocate image buffers\n");
+        goto finish_him;
+    }
+
+    // Magic bytes are left in the input buffer, so detection works for pipes too
+    if (refillInput(stream) != EXIT_SUCCESS)
+        goto finish_him;
+    stream->format = detectFormat(dec->in, dec->inLen);
+    if (initDecoder(stream) != EXIT_SUCCESS)
+        goto finish_him;
+
+    stream->thread = std::thread(producer, stream);
+
+    return EXIT_SUCCESS;
+
+finish_him:
+    freeImageStream(stream);
+    return EXIT_FAILURE;
+}
+
+int startMappedImageStream(const char *path, size_t readers, const CCImageRange *range, CCImageStream *stream) {
+    struct stat st;
+    void *map;
+
+    initImageStream(path, readers, range, stream);
+
+    stream->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (stream->fd < 0) {
+        fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+        goto finish_him;
+    }
+
+    if (fstat(stream->fd, &st) < 0) {
+        fprintf(stderr, "Unable to map %s: %s\n", path, strerror(errno));
+        goto finish_him;
+    }
+    if (st.st_size == 0) {
+        fprintf(stderr, "Unable to map %s: empty file\n", path);
+        goto finish_him;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, stream->fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Unable to map %s: %s\n", path, strerror(errno));
+        goto finish_him;
+    }
+    stream->map = (unsigned char *)map;
+    stream->mapLen = st.st_size;
+    madvise(stream->map, stream->mapLen, MADV_SEQUENTIAL);
+
+    for (size_t i = 0; i < stream->buffers.size(); i++) {
+        stream->buffers[i].data = NULL;
+        stream->idle.push_back(&stream->buffers[i]);
+    }
+
+    stream->thread = std::thread(producer, stream);
+
+    return EXIT_SUCCESS;
+
+finish_him:
+    freeImageStream(stream);
+    return EXIT_FAILURE;
+}
+
+// Buffers of all readers are in flight at once, so the next one of a reader is looked up by its index
+static CCImageBuffer *findBuffer(CCImageStream *stream, uint64_t index) {
+    for (size_t i = 0; i < stream->filled.size(); i++) {
+        if (stream->filled[i]->index == index)
+            return stream->filled[i];
+    }
+
+    return NULL;
+}
+
+CCImageBuffer *getImageBuffer(CCImageStream *stream, size_t reader) {
+    std::unique_lock<std::mutex> lock(stream->lock);
+    CCImageBuffer *buffer;
+
+    while ((buffer = findBuffer(stream, stream->positions[reader])) == NULL && !stream->done)
+        stream->cond.wait(lock);
+    if (buffer != NULL)
+        stream->positions[reader]++;
+
+    return buffer;
+}
+
+// Writes may complete out of order, so buffers are filled again in any order
+static void recycleBuffers(CCImageStream *stream) {
+    for (size_t i = 0; i < stream->filled.size(); ) {
+        if (stream->filled[i]->refs == 0) {
+            stream->idle.push_back(stream->filled[i]);
+            stream->filled.erase(stream->filled.begin() + i);
+        } else {
+            i++;
+        }
+    }
+    stream->cond.notify_all();
+}
+
+void releaseImageBuffer(CCImageStream *stream, CCImageBuffer *buffer) {
+    std::lock_guard<std::mutex> lock(stream->lock);
+
+    buffer->refs--;
+    recycleBuffers(stream);
+}
+
+void detachImageReader(CCImageStream *stream, size_t reader) {
+    std::lock_guard<std::mutex> lock(stream->lock);
+
+    for (size_t i = 0; i < stream->filled.size(); i++) {
+        if (stream->filled[i]->index >= stream->positions[reader])
+            stream->filled[i]->refs--;
+    }
+    stream->positions[reader] = UINT64_MAX;
+    stream->readers--;
+    recycleBuffers(stream);
+}
+
+ssize_t readImageHead(const char *path, unsigned char *data, size_t len) {
+    CCImageRange range = { 0, len };
+    CCImageStream stream;
+    CCImageBuffer *buffer;
+    ssize_t n = 0;
+
+    if (startImageStream(path, 1, &range, NULL, &stream) != EXIT_SUCCESS)
+        return -1;
+
+    buffer = getImageBuffer(&stream, 0);
+    if (buffer != NULL) {
+        n = buffer->len < len ? buffer->len : len;
+        memcpy(data, buffer->data, n);
+        releaseImageBuffer(&stream, buffer);
+    }
+    detachImageReader(&stream, 0);
+
+    return stopImageStream(&stream) == EXIT_SUCCESS ? n : -1;
+}
+
+int stopImageStream(CCImageStream *stream) {
+    {
+        std::lock_guard<std::mutex> lock(stream->lock);
+        stream->stop = true;
+        stream->cond.notify_all();
+    }
+    if (stream->thread.joinable())
+        stream->thread.join();
+
+    endDecoder(stream);
+    freeImageStream(stream);
+
+    return stream->ret;
+}
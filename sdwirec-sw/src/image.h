@@ -0,0 +1,114 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/image.h
+ * @brief       Reading of possibly compressed images into a ring of buffers
+ */
+
+#ifndef SDMUXCTRL_IMAGE_H
+#define SDMUXCTRL_IMAGE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define IMAGE_BUFFER_SIZE       (4 << 20)
+#define IMAGE_RING_BUFFERS      4       // Buffers being written plus buffers being filled ahead
+#define IMAGE_ALIGNMENT         4096    // Covers logical block size of any card and page size for O_DIRECT
+#define IMAGE_INPUT_SIZE        (1 << 20)
+#define IMAGE_MAGIC_SIZE        6
+
+enum CCImageFormat {
+    CCIF_Raw = 0,
+    CCIF_Gzip,
+    CCIF_Xz,
+    CCIF_Zstd,
+    CCIF_MAX
+};
+
+struct CCImageBuffer {
+    unsigned char *data;
+    size_t len;
+    uint64_t offset;
+    uint64_t index;         // Buffers are numbered in the order of the image
+    size_t refs;            // Readers which have not released the buffer yet
+};
+
+// Part of the image handed to readers
+struct CCImageRange {
+    uint64_t start;
+    uint64_t end;
+};
+
+struct CCImageDecoder;
+struct CCSha256;
+
+/*
+ * Image is read and decompressed by a separate thread into IMAGE_RING_BUFFERS buffers. Only the last buffer may be
+ * filled partially. Each buffer is handed out by getImageBuffer() to every reader and filled again after all of them
+ * release it, so the slowest reader sets the pace of the others.
+ */
+struct CCImageStream {
+    const char *path;
+    int fd;
+    CCImageFormat format;
+    CCImageDecoder *decoder;
+    unsigned char *map;     // Raw image mapped instead of being read into the buffers
+    uint64_t mapLen;
+    CCSha256 *inputHash;    // Updated with the contents of the image file if given
+    CCImageRange range;
+    std::vector<CCImageBuffer> buffers;
+    std::deque<CCImageBuffer *> filled;     // Until released by all readers
+    std::deque<CCImageBuffer *> idle;
+    std::vector<uint64_t> positions;        // Index of the next buffer of each reader
+    size_t readers;                         // Readers which have not been detached
+    std::mutex lock;
+    std::condition_variable cond;
+    std::thread thread;
+    bool done;
+    bool stop;
+    int ret;
+    uint64_t inBytes;       // Bytes read from the image file
+    uint64_t outBytes;      // Bytes after decompression
+    double busyMs;          // Time spent reading and decompressing
+    double waitMs;          // Time spent waiting for a free buffer
+};
+
+const char *getImageFormatName(CCImageFormat format);
+
+/*
+ * "-" reads the image from stdin, readers are numbered from 0. Input hash is initialized by the caller. Given a range,
+ * only buffers overlapping it are handed out, the stream ends after the last of them.
+ */
+int startImageStream(const char *path, size_t readers, const CCImageRange *range, CCSha256 *inputHash,
+                     CCImageStream *stream);
+// Buffers point into the memory mapped raw image, which is read ahead by the kernel
+int startMappedImageStream(const char *path, size_t readers, const CCImageRange *range, CCImageStream *stream);
+// Reads up to len bytes from the beginning of the image, after decompression
+ssize_t readImageHead(const char *path, unsigned char *data, size_t len);
+// Returns NULL at the end of the image or when it cannot be read, which is reported by stopImageStream()
+CCImageBuffer *getImageBuffer(CCImageStream *stream, size_t reader);
+void releaseImageBuffer(CCImageStream *stream, CCImageBuffer *buffer);
+// Reader which stops early gives up the buffers it has not taken yet, so it does not hold back the others
+void detachImageReader(CCImageStream *stream, size_t reader);
+int stopImageStream(CCImageStream *stream);
+
+#endif // SDMUXCTRL_IMAGE_H
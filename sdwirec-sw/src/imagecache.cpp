@@ -0,0 +1,440 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/imagecache.cpp
+ * @brief       Local cache of decompressed images along with manifests of their chunk hashes
+ *
+ * Images are stored decompressed, as sparse files holding only non-zero blocks, under SHA-256 of the image file they
+ * come from, so the same image given under different names is stored once. Next to each image a manifest holds XXH64
+ * of its chunks, which --delta and --verify use instead of hashing the image again. An index maps device, inode, size
+ * and modification time of image files to their keys, so a cached image is found without reading the file.
+ *
+ * Modification time of the manifest tells when the image was used last. Least recently used images are evicted once
+ * the cache grows over its limit. The directory is locked with flock() while it is searched or modified.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "imagecache.h"
+
+#define IMAGE_CACHE_INDEX           "index"
+#define IMAGE_CACHE_IMAGE_SUFFIX    ".img"
+#define IMAGE_CACHE_MANIFEST_SUFFIX ".manifest"
+#define IMAGE_CACHE_TMP_PREFIX      ".tmp-"
+#define IMAGE_CACHE_MANIFEST_MAGIC  "sd-mux-ctrl-manifest 1"
+#define IMAGE_CACHE_STALE_TMP       (24 * 60 * 60)  // Seconds after which temporary files of killed runs are removed
+
+struct CCCacheIndexEntry {
+    char key[SHA256_HEX_SIZE];
+    unsigned long long dev;
+    unsigned long long ino;
+    long long size;
+    long long mtimeSec;
+    long long mtimeNsec;
+};
+
+struct CCCacheFile {
+    std::string key;
+    struct timespec used;
+    uint64_t bytes;         // Disk space taken by the sparse image
+};
+
+static std::string getCachePath(const std::string &dir, const std::string &key, const char *suffix) {
+    return dir + "/" + key + suffix;
+}
+
+static int lockCacheDir(const char *dir, int operation) {
+    int fd;
+
+    fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    if (flock(fd, operation) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static bool isSameFile(const CCCacheIndexEntry *entry, const struct stat *st) {
+    return entry->dev == (unsigned long long)st->st_dev && entry->ino == (unsigned long long)st->st_ino
+            && entry->size == (long long)st->st_size && entry->mtimeSec == (long long)st->st_mtim.tv_sec
+            && entry->mtimeNsec == (long long)st->st_mtim.tv_nsec;
+}
+
+static void readIndex(const std::string &dir, std::vector<CCCacheIndexEntry> &entries) {
+    char line[256];
+    CCCacheIndexEntry entry;
+    FILE *f;
+
+    f = fopen((dir + "/" IMAGE_CACHE_INDEX).c_str(), "re");
+    if (f == NULL)
+        return;
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "%64s %llu %llu %lld %lld %lld", entry.key, &entry.dev, &entry.ino, &entry.size,
+                   &entry.mtimeSec, &entry.mtimeNsec) == 6 && strlen(entry.key) == SHA256_HEX_SIZE - 1)
+            entries.push_back(entry);
+    }
+
+    fclose(f);
+}
+
+// Index is replaced at once, so it is never read half written
+static int writeIndex(const std::string &dir, const std::vector<CCCacheIndexEntry> &entries) {
+    std::string path = dir + "/" IMAGE_CACHE_INDEX, tmpPath = path + ".tmp";
+    FILE *f;
+
+    f = fopen(tmpPath.c_str(), "we");
+    if (f == NULL)
+        return EXIT_FAILURE;
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        fprintf(f, "%s %llu %llu %lld %lld %lld\n", entries[i].key, entries[i].dev, entries[i].ino, entries[i].size,
+                entries[i].mtimeSec, entries[i].mtimeNsec);
+    }
+
+    if (fclose(f) != 0 || rename(tmpPath.c_str(), path.c_str()) < 0) {
+        unlink(tmpPath.c_str());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int loadManifest(const std::string &path, CCCachedImage *entry) {
+    char line[64];
+    unsigned long long size, chunk;
+    uint64_t hash;
+    FILE *f;
+    int ret = EXIT_FAILURE;
+
+    f = fopen(path.c_str(), "re");
+    if (f == NULL)
+        return EXIT_FAILURE;
+
+    if (fgets(line, sizeof(line), f) == NULL || strcmp(line, IMAGE_CACHE_MANIFEST_MAGIC "\n") != 0
+            || fscanf(f, "size %llu\nchunk %llu\n", &size, &chunk) != 2 || chunk != IMAGE_CACHE_CHUNK)
+        goto finish_him;
+
+    entry->size = size;
+    entry->hashes.clear();
+    while (fscanf(f, "%" SCNx64 "\n", &hash) == 1)
+        entry->hashes.push_back(hash);
+
+    if (entry->hashes.size() == (size + IMAGE_CACHE_CHUNK - 1) / IMAGE_CACHE_CHUNK)
+        ret = EXIT_SUCCESS;
+
+finish_him:
+    fclose(f);
+    return ret;
+}
+
+static int writeManifest(const std::string &path, uint64_t size, const std::vector<uint64_t> &hashes) {
+    std::string tmpPath = path + ".tmp";
+    FILE *f;
+
+    f = fopen(tmpPath.c_str(), "we");
+    if (f == NULL)
+        return EXIT_FAILURE;
+
+    fprintf(f, IMAGE_CACHE_MANIFEST_MAGIC "\nsize %llu\nchunk %d\n", (unsigned long long)size, IMAGE_CACHE_CHUNK);
+    for (size_t i = 0; i < hashes.size(); i++)
+        fprintf(f, "%016" PRIx64 "\n", hashes[i]);
+
+    if (fclose(f) != 0 || rename(tmpPath.c_str(), path.c_str()) < 0) {
+        unlink(tmpPath.c_str());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+bool findCachedImage(const char *dir, const char *image, CCCachedImage *entry) {
+    std::vector<CCCacheIndexEntry> entries;
+    struct stat st;
+    bool found = false;
+    int dirFd;
+
+    if (strcmp(image, "-") == 0 || stat(image, &st) < 0)
+        return false;
+
+    dirFd = lockCacheDir(dir, LOCK_SH);
+    if (dirFd < 0)
+        return false;
+
+    readIndex(dir, entries);
+    for (size_t i = 0; i < entries.size() && !found; i++) {
+        struct stat imageSt;
+
+        if (!isSameFile(&entries[i], &st))
+            continue;
+
+        entry->path = getCachePath(dir, entries[i].key, IMAGE_CACHE_IMAGE_SUFFIX);
+        found = loadManifest(getCachePath(dir, entries[i].key, IMAGE_CACHE_MANIFEST_SUFFIX), entry) == EXIT_SUCCESS
+                && stat(entry->path.c_str(), &imageSt) == 0 && (uint64_t)imageSt.st_size == entry->size;
+        if (found)
+            utimensat(AT_FDCWD, getCachePath(dir, entries[i].key, IMAGE_CACHE_MANIFEST_SUFFIX).c_str(), NULL, 0);
+    }
+
+    close(dirFd);
+
+    return found;
+}
+
+int prepareCacheWriter(const char *dir, const char *image, CCCacheWriter *writer) {
+    std::vector<char> tmpPath;
+
+    if (stat(image, &writer->source) < 0) {
+        fprintf(stderr, "Unable to cache %s: %s\n", image, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    mkdir(dir, 0755);
+    writer->dir = dir;
+    tmpPath.resize(writer->dir.size() + strlen("/" IMAGE_CACHE_TMP_PREFIX "XXXXXX") + 1);
+    snprintf(&tmpPath[0], tmpPath.size(), "%s/" IMAGE_CACHE_TMP_PREFIX "XXXXXX", dir);
+    writer->fd = mkostemp(&tmpPath[0], O_CLOEXEC);
+    if (writer->fd < 0) {
+        fprintf(stderr, "Unable to create a file in image cache %s: %s\n", dir, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    fchmod(writer->fd, 0644);
+    writer->tmpPath = &tmpPath[0];
+    writer->size = 0;
+    writer->hashes.clear();
+    writer->cancel = false;
+    writer->complete = false;
+    sha256Init(&writer->inputHash);
+
+    return EXIT_SUCCESS;
+}
+
+// Only blocks holding data are written, the rest is left as holes of the sparse file
+static int writeCacheBuffer(CCCacheWriter *writer, const CCImageBuffer *buffer) {
+    size_t start, end, blockLen;
+    ssize_t n;
+
+    writer->hashes.resize((buffer->offset + buffer->len + IMAGE_CACHE_CHUNK - 1) / IMAGE_CACHE_CHUNK);
+    hashChunks(writer->pool, buffer->data, buffer->len, IMAGE_CACHE_CHUNK,
+               &writer->hashes[buffer->offset / IMAGE_CACHE_CHUNK], NULL, 0);
+
+    for (start = 0; start < buffer->len; start = end) {
+        blockLen = buffer->len - start < IMAGE_ALIGNMENT ? buffer->len - start : IMAGE_ALIGNMENT;
+        end = start + blockLen;
+        if (buffer->data[start] == 0 && memcmp(buffer->data + start, buffer->data + start + 1, blockLen - 1) == 0)
+            continue;
+
+        while (end < buffer->len) {
+            blockLen = buffer->len - end < IMAGE_ALIGNMENT ? buffer->len - end : IMAGE_ALIGNMENT;
+            if (buffer->data[end] == 0 && memcmp(buffer->data + end, buffer->data + end + 1, blockLen - 1) == 0)
+                break;
+            end += blockLen;
+        }
+
+        for (size_t done = start; done < end; done += n) {
+            n = pwrite(writer->fd, buffer->data + done, end - done, buffer->offset + done);
+            if (n < 0 && errno == EINTR) {
+                n = 0;
+                continue;
+            }
+            if (n <= 0) {
+                fprintf(stderr, "Unable to write to image cache %s: %s\n", writer->dir.c_str(),
+                        n < 0 ? strerror(errno) : "short write");
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    writer->size = buffer->offset + buffer->len;
+
+    return EXIT_SUCCESS;
+}
+
+static void cacheWriter(CCCacheWriter *writer) {
+    CCImageBuffer *buffer = NULL;
+    int ret = EXIT_SUCCESS;
+
+    while (!writer->cancel && ret == EXIT_SUCCESS) {
+        buffer = getImageBuffer(writer->stream, writer->reader);
+        if (buffer == NULL)
+            break;
+        ret = writeCacheBuffer(writer, buffer);
+        releaseImageBuffer(writer->stream, buffer);
+    }
+
+    // End of the stream is reported with a NULL buffer also when the image cannot be read
+    writer->complete = buffer == NULL && ret == EXIT_SUCCESS && writer->stream->ret == EXIT_SUCCESS;
+    detachImageReader(writer->stream, writer->reader);
+}
+
+void startCacheWriter(CCCacheWriter *writer, CCImageStream *stream, size_t reader, CCHashPool *pool) {
+    writer->stream = stream;
+    writer->reader = reader;
+    writer->pool = pool;
+    writer->thread = std::thread(cacheWriter, writer);
+}
+
+static bool isOlder(const CCCacheFile &a, const CCCacheFile &b) {
+    return a.used.tv_sec < b.used.tv_sec || (a.used.tv_sec == b.used.tv_sec && a.used.tv_nsec < b.used.tv_nsec);
+}
+
+// Image just stored is never evicted, even if it does not fit the cache alone
+static void evictImages(const std::string &dir, uint64_t limit, const std::string &keep) {
+    std::vector<CCCacheFile> files;
+    struct stat manifestSt, imageSt;
+    uint64_t total = 0;
+    struct dirent *de;
+    size_t len, suffixLen = strlen(IMAGE_CACHE_MANIFEST_SUFFIX);
+    DIR *d;
+
+    d = opendir(dir.c_str());
+    if (d == NULL)
+        return;
+
+    while ((de = readdir(d)) != NULL) {
+        std::string name = de->d_name;
+
+        if (name.compare(0, strlen(IMAGE_CACHE_TMP_PREFIX), IMAGE_CACHE_TMP_PREFIX) == 0) {
+            if (stat((dir + "/" + name).c_str(), &imageSt) == 0
+                    && imageSt.st_mtime + IMAGE_CACHE_STALE_TMP < time(NULL))
+                unlink((dir + "/" + name).c_str());
+            continue;
+        }
+
+        len = name.size();
+        if (len <= suffixLen || name.compare(len - suffixLen, suffixLen, IMAGE_CACHE_MANIFEST_SUFFIX) != 0)
+            continue;
+
+        CCCacheFile file;
+        file.key = name.substr(0, len - suffixLen);
+        if (stat(getCachePath(dir, file.key, IMAGE_CACHE_MANIFEST_SUFFIX).c_str(), &manifestSt) < 0)
+            continue;
+        file.used = manifestSt.st_mtim;
+        file.bytes = stat(getCachePath(dir, file.key, IMAGE_CACHE_IMAGE_SUFFIX).c_str(), &imageSt) == 0
+                ? (uint64_t)imageSt.st_blocks * 512 : 0;
+        total += file.bytes;
+        if (file.key != keep)
+            files.push_back(file);
+    }
+    closedir(d);
+
+    std::sort(files.begin(), files.end(), isOlder);
+    for (size_t i = 0; i < files.size() && total > limit; i++) {
+        unlink(getCachePath(dir, files[i].key, IMAGE_CACHE_MANIFEST_SUFFIX).c_str());
+        unlink(getCachePath(dir, files[i].key, IMAGE_CACHE_IMAGE_SUFFIX).c_str());
+        total -= files[i].bytes;
+    }
+}
+
+// Entries of evicted images are dropped along with the previous entry of the same file
+static int updateIndex(const std::string &dir, const char *key, const struct stat *source) {
+    std::vector<CCCacheIndexEntry> entries, kept;
+    CCCacheIndexEntry entry;
+    struct stat st;
+
+    readIndex(dir, entries);
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (!isSameFile(&entries[i], source)
+                && stat(getCachePath(dir, entries[i].key, IMAGE_CACHE_MANIFEST_SUFFIX).c_str(), &st) == 0)
+            kept.push_back(entries[i]);
+    }
+
+    snprintf(entry.key, sizeof(entry.key), "%s", key);
+    entry.dev = source->st_dev;
+    entry.ino = source->st_ino;
+    entry.size = source->st_size;
+    entry.mtimeSec = source->st_mtim.tv_sec;
+    entry.mtimeNsec = source->st_mtim.tv_nsec;
+    kept.push_back(entry);
+
+    return writeIndex(dir, kept);
+}
+
+static int storeImage(CCCacheWriter *writer, uint64_t limit) {
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    char key[SHA256_HEX_SIZE];
+    std::string imagePath;
+    struct stat st;
+    int dirFd, ret = EXIT_FAILURE;
+
+    if (ftruncate(writer->fd, writer->size) < 0 || fdatasync(writer->fd) < 0) {
+        fprintf(stderr, "Unable to write to image cache %s: %s\n", writer->dir.c_str(), strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    sha256Final(&writer->inputHash, digest);
+    sha256ToHex(digest, key);
+    imagePath = getCachePath(writer->dir, key, IMAGE_CACHE_IMAGE_SUFFIX);
+
+    dirFd = lockCacheDir(writer->dir.c_str(), LOCK_EX);
+    if (dirFd < 0) {
+        fprintf(stderr, "Unable to lock image cache %s: %s\n", writer->dir.c_str(), strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    // The same image may have been stored under another name of the file already
+    if (stat(imagePath.c_str(), &st) == 0 && (uint64_t)st.st_size == writer->size)
+        unlink(writer->tmpPath.c_str());
+    else if (rename(writer->tmpPath.c_str(), imagePath.c_str()) < 0)
+        goto finish_him;
+    writer->tmpPath.clear();
+
+    if (writeManifest(getCachePath(writer->dir, key, IMAGE_CACHE_MANIFEST_SUFFIX), writer->size, writer->hashes)
+            != EXIT_SUCCESS)
+        goto finish_him;
+
+    evictImages(writer->dir, limit, key);
+    ret = updateIndex(writer->dir, key, &writer->source);
+
+finish_him:
+    if (ret != EXIT_SUCCESS)
+        fprintf(stderr, "Unable to store image in cache %s: %s\n", writer->dir.c_str(), strerror(errno));
+    close(dirFd);
+
+    return ret;
+}
+
+int finishCacheWriter(CCCacheWriter *writer, bool store, uint64_t limit) {
+    int ret = EXIT_FAILURE;
+
+    if (!store)
+        writer->cancel = true;
+    if (writer->thread.joinable())
+        writer->thread.join();
+
+    if (store && writer->complete)
+        ret = storeImage(writer, limit);
+
+    close(writer->fd);
+    if (!writer->tmpPath.empty())
+        unlink(writer->tmpPath.c_str());
+
+    return ret;
+}
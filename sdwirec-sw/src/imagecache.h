@@ -0,0 +1,78 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/imagecache.h
+ * @brief       Local cache of decompressed images along with manifests of their chunk hashes
+ */
+
+#ifndef SDMUXCTRL_IMAGECACHE_H
+#define SDMUXCTRL_IMAGECACHE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hashpool.h"
+#include "image.h"
+#include "sha256.h"
+
+#define IMAGE_CACHE_CHUNK           (256 << 10)     // Unit of manifest hashes, the same as of --delta and --verify
+#define IMAGE_CACHE_DEFAULT_SIZE    16384           // MiB
+
+struct CCCachedImage {
+    std::string path;
+    uint64_t size;
+    std::vector<uint64_t> hashes;   // XXH64 of each IMAGE_CACHE_CHUNK bytes, the last chunk may be shorter
+};
+
+// Stores the image as one more reader of its stream
+struct CCCacheWriter {
+    std::string dir;
+    std::string tmpPath;
+    struct stat source;
+    CCSha256 inputHash;             // Key of the image, updated by the stream
+    CCImageStream *stream;
+    size_t reader;
+    CCHashPool *pool;
+    int fd;
+    uint64_t size;
+    std::vector<uint64_t> hashes;
+    std::thread thread;
+    std::atomic<bool> cancel;
+    bool complete;
+};
+
+/*
+ * Looks the image file up by its device, inode, size and modification time, so the file does not have to be read.
+ * Found image is marked as used most recently.
+ */
+bool findCachedImage(const char *dir, const char *image, CCCachedImage *entry);
+
+// Creates a temporary file in the cache, inputHash has to be passed to startImageStream()
+int prepareCacheWriter(const char *dir, const char *image, CCCacheWriter *writer);
+void startCacheWriter(CCCacheWriter *writer, CCImageStream *stream, size_t reader, CCHashPool *pool);
+/*
+ * Waits for the writer and, unless the image could not be read to its end or store is false, stores the image under
+ * SHA-256 of the image file. Least recently used images are evicted then until the cache fits limit bytes.
+ */
+int finishCacheWriter(CCCacheWriter *writer, bool store, uint64_t limit);
+
+#endif // SDMUXCTRL_IMAGECACHE_H
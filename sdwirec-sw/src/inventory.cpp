@@ -0,0 +1,193 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/inventory.cpp
+ * @brief       List of connected devices kept up to date by hotplug events
+ *
+ * Devices are enumerated once when the inventory is started and then added and removed as they are plugged in and
+ * out. Backends without hotplug support are enumerated again every INVENTORY_POLL_MS milliseconds instead.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <mutex>
+
+#include "inventory.h"
+#include "timing.h"
+
+static std::vector<CCUsbDevice> inventory;
+static std::mutex inventoryMutex;
+static CCHotplugCallback inventoryListener;
+static int inventoryVendor, inventoryProduct;
+static bool running, watching;
+static double lastRefresh;
+
+static void updateInventory(const CCUsbDevice *dev, bool arrived) {
+    CCUsbDevice gone;
+    bool found = false;
+
+    inventoryMutex.lock();
+    for (size_t i = 0; i < inventory.size(); i++) {
+        if (strcmp(inventory[i].port, dev->port) == 0) {
+            gone = inventory[i];
+            inventory.erase(inventory.begin() + i);
+            found = true;
+            break;
+        }
+    }
+    if (arrived)
+        inventory.insert(std::upper_bound(inventory.begin(), inventory.end(), *dev, compareUsbPorts), *dev);
+    inventoryMutex.unlock();
+
+    if (inventoryListener == NULL)
+        return;
+    if (arrived) {
+        inventoryListener(dev, true);
+    } else if (found) {
+        // Strings of the device are not available any more, pass the ones seen when it was plugged in
+        inventoryListener(&gone, false);
+    }
+}
+
+static bool isSameDevice(const CCUsbDevice &a, const CCUsbDevice &b) {
+    return strcmp(a.port, b.port) == 0 && a.devnum == b.devnum;
+}
+
+static void refreshInventory() {
+    std::vector<CCUsbDevice> current, previous;
+    size_t i, j;
+
+    lastRefresh = getTimeMs();
+    if (getBackend()->enumerate(inventoryVendor, inventoryProduct, current) != EXIT_SUCCESS)
+        return;
+
+    inventoryMutex.lock();
+    previous = inventory;
+    inventoryMutex.unlock();
+
+    for (i = 0; i < previous.size(); i++) {
+        for (j = 0; j < current.size() && !isSameDevice(previous[i], current[j]); j++)
+            ;
+        if (j == current.size())
+            updateInventory(&previous[i], false);
+    }
+
+    for (i = 0; i < current.size(); i++) {
+        for (j = 0; j < previous.size() && !isSameDevice(current[i], previous[j]); j++)
+            ;
+        if (j == previous.size())
+            updateInventory(&current[i], true);
+    }
+}
+
+int startInventory(int vendor, int product, CCHotplugCallback listener) {
+    std::vector<CCUsbDevice> devices;
+
+    inventoryVendor = vendor;
+    inventoryProduct = product;
+
+    // Events start to be queued before enumeration, so no device plugged in meanwhile is missed
+    watching = getBackend()->watch(vendor, product, updateInventory) >= 0;
+
+    lastRefresh = getTimeMs();
+    if (getBackend()->enumerate(vendor, product, devices) != EXIT_SUCCESS && !watching) {
+        fprintf(stderr, "Unable to enumerate devices, neither sysfs nor hotplug is available\n");
+        return EXIT_FAILURE;
+    }
+
+    inventoryMutex.lock();
+    inventory = devices;
+    inventoryMutex.unlock();
+
+    inventoryListener = listener;
+    running = true;
+
+    return EXIT_SUCCESS;
+}
+
+void stopInventory() {
+    if (watching)
+        getBackend()->unwatch();
+
+    inventoryMutex.lock();
+    inventory.clear();
+    inventoryMutex.unlock();
+
+    inventoryListener = NULL;
+    running = false;
+    watching = false;
+}
+
+bool isInventoryRunning() {
+    return running;
+}
+
+// Time in milliseconds to wait for events before handleInventoryEvents() has to be called, -1 when unlimited
+int getInventoryTimeout() {
+    double left;
+
+    if (!running || watching)
+        return -1;
+
+    left = lastRefresh + INVENTORY_POLL_MS - getTimeMs();
+
+    return left > 0 ? (int)left + 1 : 0;
+}
+
+void getInventoryFds(std::vector<struct pollfd> &fds) {
+    if (watching)
+        getBackend()->getEventFds(fds);
+}
+
+int handleInventoryEvents(int timeoutMs) {
+    int wait;
+
+    if (watching)
+        return getBackend()->handleEvents(timeoutMs) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+    wait = getInventoryTimeout();
+    if (wait > timeoutMs) {
+        usleep(timeoutMs * 1000);
+        return EXIT_SUCCESS;
+    }
+
+    usleep(wait * 1000);
+    refreshInventory();
+
+    return EXIT_SUCCESS;
+}
+
+void getInventory(std::vector<CCUsbDevice> &devices) {
+    std::lock_guard<std::mutex> lock(inventoryMutex);
+
+    devices = inventory;
+}
+
+bool findInventoryDevice(const char *serial, CCUsbDevice *dev) {
+    std::lock_guard<std::mutex> lock(inventoryMutex);
+
+    for (size_t i = 0; i < inventory.size(); i++) {
+        if (strcmp(inventory[i].serial, serial) == 0) {
+            *dev = inventory[i];
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,43 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/inventory.h
+ * @brief       List of connected devices kept up to date by hotplug events
+ */
+
+#ifndef SDMUXCTRL_INVENTORY_H
+#define SDMUXCTRL_INVENTORY_H
+
+#include <poll.h>
+
+#include <vector>
+
+#include "backend.h"
+#include "sysfs.h"
+
+// How often devices are enumerated again when the backend does not support hotplug
+#define INVENTORY_POLL_MS       500
+
+int startInventory(int vendor, int product, CCHotplugCallback listener);
+void stopInventory();
+bool isInventoryRunning();
+int getInventoryTimeout();
+void getInventoryFds(std::vector<struct pollfd> &fds);
+int handleInventoryEvents(int timeoutMs);
+void getInventory(std::vector<CCUsbDevice> &devices);
+bool findInventoryDevice(const char *serial, CCUsbDevice *dev);
+
+#endif // SDMUXCTRL_INVENTORY_H
@@ -0,0 +1,56 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/json.cpp
+ * @brief       Helpers for machine readable output
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "json.h"
+
+#define FORMAT_TEXT     "text"
+#define FORMAT_JSON     "json"
+
+bool isJsonFormat(CCOptionValue options[]) {
+    return options[CCO_Format].args != NULL && strcmp(options[CCO_Format].args, FORMAT_JSON) == 0;
+}
+
+int checkFormat(CCOptionValue options[]) {
+    const char *format = options[CCO_Format].args;
+
+    if (format != NULL && strcmp(format, FORMAT_TEXT) != 0 && strcmp(format, FORMAT_JSON) != 0) {
+        fprintf(stderr, "Invalid format: %s. Use \"text\" or \"json\".\n", format);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+void printJsonString(FILE *out, const char *str) {
+    fputc('"', out);
+    for (const unsigned char *c = (const unsigned char *)str; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(out, "\\%c", *c);
+        } else if (*c < 0x20) {
+            fprintf(out, "\\u%04x", *c);
+        } else {
+            fputc(*c, out);
+        }
+    }
+    fputc('"', out);
+}
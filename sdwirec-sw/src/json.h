@@ -0,0 +1,32 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/json.h
+ * @brief       Helpers for machine readable output
+ */
+
+#ifndef SDMUXCTRL_JSON_H
+#define SDMUXCTRL_JSON_H
+
+#include <stdio.h>
+
+#include "common.h"
+
+bool isJsonFormat(CCOptionValue options[]);
+int checkFormat(CCOptionValue options[]);
+void printJsonString(FILE *out, const char *str);
+
+#endif // SDMUXCTRL_JSON_H
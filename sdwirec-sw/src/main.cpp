@@ -23,123 +23,30 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
-#include <libftdi1/ftdi.h>
-
-#define PRODUCT 0x6001
-#define SAMSUNG_VENDOR 0x04e8
-
-// SDMUX specific definitions
-#define SOCKET_SEL      (0x01 << 0x00)
-#define USB_SEL         (0x01 << 0x03)
-#define POWER_SW_OFF    (0x01 << 0x02)
-#define POWER_SW_ON     (0x01 << 0x04)
-#define DYPER1          (0x01 << 0x05)
-#define DYPER2          (0x01 << 0x06)
-
-// USBMUX specific definitions
-#define UM_SOCKET_SEL	(0x01 << 0x00)
-#define UM_DEVICE_PWR	(0x01 << 0x01)
-#define UM_DUT_LED		(0x01 << 0x02)
-#define UM_GP_LED		(0x01 << 0x03)
-
-
-#define DELAY_100MS     100000
-#define DELAY_500MS     500000
-
-#define CCDT_SDMUX_STR  "sd-mux"
-#define CCDT_SDWIRE_STR "sd-wire"
-#define CCDT_USBMUX_STR "usb-mux"
-
-#define STRING_SIZE     128
-
-enum CCCommand {
-    CCC_List,
-    CCC_DUT,
-    CCC_TS,
-    CCC_Tick,
-    CCC_Pins,
-    CCC_Info,
-    CCC_ShowSerial,
-    CCC_SetSerial,
-    CCC_Init,
-    CCC_Status,
-    CCC_DyPer1,
-    CCC_DyPer2,
-    CCC_None
-};
-
-enum Target {
-    T_DUT,
-    T_TS
-};
-
-enum CCDeviceType {
-    CCDT_SDMUX,
-    CCDT_SDWIRE,
-	CCDT_USBMUX,
-    CCDT_MAX
-};
-
-enum CCFeature {
-    CCF_SDMUX,
-    CCF_POWERSWITCH,
-    CCF_USBMUX,
-    CCF_DYPERS,
-    CCF_MAX
-};
-
-enum CCOption {
-    CCO_DeviceId,
-    CCO_DeviceSerial,
-    CCO_TickTime,
-    CCO_BitsInvert,
-    CCO_Vendor,
-    CCO_Product,
-    CCO_DyPer,
-    CCO_DeviceType,
-    CCO_MAX
-};
-
-union CCOptionValue {
-    int argn;
-    char *args;
-};
-
-int doPower(bool off, bool on, CCOptionValue options[]);
-int selectTarget(Target target, CCOptionValue options[]);
-
-CCDeviceType getDeviceTypeFromString(char *deviceTypeStr) {
-    if (strcmp(CCDT_SDMUX_STR, deviceTypeStr) == 0) {
-        return CCDT_SDMUX;
-    }
-
-    if (strcmp(CCDT_SDWIRE_STR, deviceTypeStr) == 0) {
-        return CCDT_SDWIRE;
-    }
-
-    if (strcmp(CCDT_USBMUX_STR, deviceTypeStr) == 0) {
-        return CCDT_USBMUX;
-    }
-
-    return CCDT_MAX;
-}
+#include <vector>
 
-bool hasFeature(CCDeviceType deviceType, CCFeature feature) {
-    static const bool featureMatrix[CCDT_MAX][CCF_MAX] = {
-            {true, true, true, true},           // SD-MUX features
-            {true, false, false, false},        // SDWire features
-			{false, false, true, false},        // SDWire features
-    };
-
-    if (deviceType >= CCDT_MAX || feature >= CCF_MAX)
-        return false;
-
-    return featureMatrix[deviceType][feature];
-}
+#include <libftdi1/ftdi.h>
 
-int listDevices(CCOptionValue options[]) {
+#include "backend.h"
+#include "batch.h"
+#include "blockdev.h"
+#include "cli.h"
+#include "common.h"
+#include "daemon.h"
+#include "device.h"
+#include "fanout.h"
+#include "flash.h"
+#include "imagecache.h"
+#include "inventory.h"
+#include "json.h"
+#include "pool.h"
+#include "sysfs.h"
+#include "timing.h"
+
+int listFtdiDevices(CCOptionValue options[]) {
     int fret, i;
     struct ftdi_context *ftdi;
     struct ftdi_device_list *devlist, *curdev;
@@ -187,72 +94,209 @@ finish_him:
     return retval;
 }
 
-struct ftdi_context* openDevice(CCOptionValue options[], CCDeviceType *deviceType) {
-    struct ftdi_context *ftdi = NULL;
-    int fret;
-    char product[STRING_SIZE + 1];
-    CCDeviceType tmpDeviceType;
+void printDevicesJson(const std::vector<CCUsbDevice> &devices) {
+    char parent[PORT_PATH_SIZE];
+    CCDeviceType deviceType;
 
-    if ((options[CCO_DeviceSerial].args == NULL) && (options[CCO_DeviceId].argn < 0)) {
-        fprintf(stderr, "No serial number or device id provided!\n");
-        return NULL;
+    printf("[");
+    for (size_t i = 0; i < devices.size(); i++) {
+        const CCUsbDevice &dev = devices[i];
+
+        deviceType = getDeviceTypeFromString(dev.description);
+        getParentPort(dev.port, parent, sizeof(parent));
+
+        printf("%s\n  {\"id\": %zu, \"serial\": ", i ? "," : "", i);
+        printJsonString(stdout, dev.serial);
+        printf(", \"manufacturer\": ");
+        printJsonString(stdout, dev.manufacturer);
+        printf(", \"product\": ");
+        printJsonString(stdout, dev.description);
+        printf(", \"type\": ");
+        if (deviceType != CCDT_MAX) {
+            printJsonString(stdout, dev.description);
+        } else {
+            printf("null");
+        }
+        printf(", \"bus\": %d, \"address\": %d, \"port\": ", dev.busnum, dev.devnum);
+        printJsonString(stdout, dev.port);
+        printf(", \"parent\": ");
+        printJsonString(stdout, parent);
+        printf(", \"ports\": [");
+        for (const char *p = strchr(dev.port, '-'); p != NULL; p = strchr(p + 1, '.'))
+            printf("%s%d", p == strchr(dev.port, '-') ? "" : ", ", atoi(p + 1));
+        printf("]}");
     }
+    printf("%s]\n", devices.empty() ? "" : "\n");
+}
 
-    if ((ftdi = ftdi_new()) == 0) {
-        fprintf(stderr, "ftdi_new failed\n");
-        return NULL;
+int listDevices(CCOptionValue options[]) {
+    std::vector<CCUsbDevice> devices;
+    int id = options[CCO_DeviceId].argn;
+
+    if (checkFormat(options) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    // Inventory of the daemon is up to date, so sysfs is not scanned again
+    if ((options[CCO_Direct].argn || daemonListDevices(options, devices) != EXIT_SUCCESS)
+            && getBackend()->enumerate(options[CCO_Vendor].argn, options[CCO_Product].argn, devices) != EXIT_SUCCESS) {
+        if (isJsonFormat(options)) {
+            fprintf(stderr, "JSON output is available only when sysfs is mounted\n");
+            return EXIT_FAILURE;
+        }
+        return listFtdiDevices(options);
     }
 
-    if (options[CCO_DeviceSerial].args != NULL) {
-        fret = ftdi_usb_open_desc_index(ftdi, options[CCO_Vendor].argn, options[CCO_Product].argn, NULL, options[CCO_DeviceSerial].args, 0);
-    } else {
-        fret = ftdi_usb_open_desc_index(ftdi, options[CCO_Vendor].argn, options[CCO_Product].argn, NULL, NULL, options[CCO_DeviceId].argn);
+    if (id != -1) {
+        if (id >= 0 && (size_t)id < devices.size())
+            printf("%s", devices[id].serial);
+        return EXIT_SUCCESS;
     }
-    if (fret < 0) {
-        fprintf(stderr, "Unable to open ftdi device: %d (%s)\n", fret, ftdi_get_error_string(ftdi));
-        goto error;
+
+    if (isJsonFormat(options)) {
+        printDevicesJson(devices);
+        return EXIT_SUCCESS;
     }
 
-    fret = ftdi_read_eeprom(ftdi);
-    if (fret < 0) {
-        fprintf(stderr, "Unable to read ftdi eeprom: %d (%s)\n", fret, ftdi_get_error_string(ftdi));
-        goto error;
+    printf("Number of FTDI devices found: %zu\n", devices.size());
+    for (size_t i = 0; i < devices.size(); i++) {
+        printf("Dev: %zu, Manufacturer: %s, Serial: %s, Description: %s\n", i,
+               devices[i].manufacturer, devices[i].serial, devices[i].description);
     }
 
-    fret = ftdi_eeprom_decode(ftdi, 0);
-    if (fret < 0) {
-        fprintf(stderr, "Unable to decode ftdi eeprom: %d (%s)\n", fret, ftdi_get_error_string(ftdi));
-        goto error;
+    return EXIT_SUCCESS;
+}
+
+int waitForDevice(const char *serial, CCOptionValue options[]) {
+    double deadline = getTimeMs() + options[CCO_Timeout].argn * 1000.0;
+    CCUsbDevice dev;
+    int ret = EXIT_FAILURE;
+    double left;
+
+    if (startInventory(options[CCO_Vendor].argn, options[CCO_Product].argn, NULL) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    while (!findInventoryDevice(serial, &dev)) {
+        left = deadline - getTimeMs();
+        if (options[CCO_Timeout].argn > 0 && left <= 0) {
+            fprintf(stderr, "Device %s did not appear within %d s\n", serial, options[CCO_Timeout].argn);
+            goto finish_him;
+        }
+        if (options[CCO_Timeout].argn <= 0 || left > INVENTORY_POLL_MS)
+            left = INVENTORY_POLL_MS;
+        if (handleInventoryEvents((int)left) != EXIT_SUCCESS) {
+            fprintf(stderr, "Unable to handle hotplug events\n");
+            goto finish_him;
+        }
+    }
+    ret = EXIT_SUCCESS;
+
+finish_him:
+    stopInventory();
+
+    return ret;
+}
+
+// Finds the port the device given by serial number or id is plugged into along with its type
+static int getDevicePort(CCOptionValue options[], char *port, size_t len, CCDeviceType *deviceType) {
+    std::vector<CCUsbDevice> devices;
+    int id = options[CCO_DeviceId].argn;
+
+    if (getBackend()->simulated) {
+        fprintf(stderr, "Simulated devices have no block devices\n");
+        return EXIT_FAILURE;
+    }
+
+    if (getBackend()->enumerate(options[CCO_Vendor].argn, options[CCO_Product].argn, devices) != EXIT_SUCCESS) {
+        fprintf(stderr, "Unable to enumerate devices, sysfs is not available\n");
+        return EXIT_FAILURE;
     }
 
-    if (deviceType != NULL) {
-        ftdi_eeprom_get_strings(ftdi, NULL, 0, product, sizeof(product), NULL, 0);
-        tmpDeviceType = getDeviceTypeFromString(product);
-        if (tmpDeviceType == CCDT_MAX) {
-            fprintf(stderr, "Invalid device type. Device probably not configured!\n");
-            goto error;
+    for (size_t i = 0; i < devices.size(); i++) {
+        if (options[CCO_DeviceSerial].args != NULL ? strcmp(devices[i].serial, options[CCO_DeviceSerial].args) == 0
+                                                   : (size_t)id == i) {
+            snprintf(port, len, "%s", devices[i].port);
+            *deviceType = getDeviceTypeFromString(devices[i].description);
+            return EXIT_SUCCESS;
         }
-        *deviceType = tmpDeviceType;
     }
 
-    return ftdi;
+    fprintf(stderr, "Device not found\n");
+    return EXIT_FAILURE;
+}
 
-error:
-    ftdi_usb_close(ftdi);
-    ftdi_free(ftdi);
+// Refuses devices without a card reader before their card is switched
+static int checkDeviceCardReader(CCOptionValue options[]) {
+    char port[PORT_PATH_SIZE];
+    CCDeviceType deviceType;
+
+    if (getDevicePort(options, port, sizeof(port), &deviceType) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    return checkCardReader(port, deviceType);
+}
+
+/*
+ * Finds the block device of the card reader of the selected device, waiting for it if necessary. Without --timeout
+ * the wait is limited to the given default number of seconds, zero meaning forever.
+ */
+static int findCardBlockdev(CCOptionValue options[], int defaultTimeout, char *devPath, size_t len) {
+    char port[PORT_PATH_SIZE];
+    CCDeviceType deviceType;
+    int timeout = options[CCO_Timeout].argn > 0 ? options[CCO_Timeout].argn : defaultTimeout;
+    int timeoutMs = timeout > 0 ? timeout * 1000 : -1;
+    double start;
+    int ret;
+
+    if (isFanOut(options)) {
+        fprintf(stderr, "Block device can be found for a single device only\n");
+        return EXIT_FAILURE;
+    }
+
+    if ((options[CCO_DeviceSerial].args == NULL) && (options[CCO_DeviceId].argn < 0)) {
+        fprintf(stderr, "No serial number or device id provided!\n");
+        return EXIT_FAILURE;
+    }
+
+    if (getDevicePort(options, port, sizeof(port), &deviceType) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    start = getTimeMs();
+    ret = waitForBlockDevice(port, deviceType, timeoutMs, devPath, len);
+    recordPhase(CCP_Blockdev, start);
+
+    return ret;
+}
+
+int waitBlockdev(CCOptionValue options[]) {
+    char devPath[BLOCKDEV_PATH_SIZE];
+
+    if (findCardBlockdev(options, 0, devPath, sizeof(devPath)) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
 
-    return NULL;
+    printf("%s\n", devPath);
+
+    return EXIT_SUCCESS;
 }
 
 int showInfo(CCOptionValue options[]) {
     struct ftdi_context *ftdi;
     int fret, ret = EXIT_SUCCESS;
 
+    if (getBackend()->simulated) {
+        fprintf(stderr, "EEPROM of simulated devices cannot be accessed\n");
+        return EXIT_FAILURE;
+    }
+
     ftdi = openDevice(options, NULL);
     if (ftdi == NULL) {
         return EXIT_FAILURE;
     }
 
+    if (readEeprom(ftdi) != EXIT_SUCCESS) {
+        closeDevice(ftdi);
+        return EXIT_FAILURE;
+    }
+
     fret = ftdi_eeprom_decode(ftdi, 1);
     if (fret < 0) {
         fprintf(stderr, "Unable to decode ftdi eeprom: %d (%s)\n", fret, ftdi_get_error_string(ftdi));
@@ -264,23 +308,16 @@ int showInfo(CCOptionValue options[]) {
     return ret;
 }
 
-int doInit(CCOptionValue options[]) {
-    if (doPower(true, false, options) != EXIT_SUCCESS) {
-        return EXIT_FAILURE;
-    }
-
-    if (selectTarget(T_TS, options) != EXIT_SUCCESS) {
-        return EXIT_FAILURE;
-    }
-
-    return EXIT_SUCCESS;
-}
-
 int setSerial(char *serialNumber, CCOptionValue options[]) {
     struct ftdi_context *ftdi;
     int f, ret = EXIT_FAILURE;
     char *type = options[CCO_DeviceType].args;
 
+    if (getBackend()->simulated) {
+        fprintf(stderr, "EEPROM of simulated devices cannot be accessed\n");
+        return EXIT_FAILURE;
+    }
+
     if (!type) {
         fprintf(stderr, "Device type not specified\n");
         return EXIT_FAILURE;
@@ -291,6 +328,9 @@ int setSerial(char *serialNumber, CCOptionValue options[]) {
         return EXIT_FAILURE;
     }
 
+    if (readEeprom(ftdi) != EXIT_SUCCESS)
+        goto finish_him;
+
     f = ftdi_eeprom_initdefaults(ftdi, (char *)"SRPOL", type, serialNumber);
     if (f < 0) {
         fprintf(stderr, "Unable to set eeprom strings: %d (%s)\n", f, ftdi_get_error_string(ftdi));
@@ -361,199 +401,6 @@ finish_him:
     return ret;
 }
 
-int writePins(struct ftdi_context *ftdi, unsigned char pins) {
-    int f = ftdi_write_data(ftdi, &pins, 1);
-    if (f < 0) {
-        fprintf(stderr,"write failed for 0x%x, error %d (%s)\n", pins, f, ftdi_get_error_string(ftdi));
-        return EXIT_FAILURE;
-    }
-    return EXIT_SUCCESS;
-}
-
-struct ftdi_context* prepareDevice(CCOptionValue options[], unsigned char *pins, CCDeviceType *deviceType) {
-    struct ftdi_context *ftdi;
-    int f;
-
-    ftdi = openDevice(options, deviceType);
-    if (ftdi == NULL) {
-        return NULL;
-    }
-
-    if (*deviceType == CCDT_SDWIRE || *deviceType == CCDT_USBMUX) {
-        return ftdi; // None of the following steps need to be performed for this type of device.
-    }
-
-    f = ftdi_set_bitmode(ftdi, 0xFF, BITMODE_BITBANG);
-    if (f < 0) {
-        fprintf(stderr, "Unable to enable bitbang mode: %d (%s)\n", f, ftdi_get_error_string(ftdi));
-        ftdi_usb_close(ftdi);
-        ftdi_free(ftdi);
-        return NULL;
-    }
-
-    if (pins != NULL) {
-        f = ftdi_read_data(ftdi, pins, 1);
-        if (f < 0) {
-            fprintf(stderr,"read failed, error %d (%s)\n", f, ftdi_get_error_string(ftdi));
-            ftdi_usb_close(ftdi);
-            ftdi_free(ftdi);
-            return NULL;
-        }
-    }
-
-    return ftdi;
-}
-
-int powerOff(struct ftdi_context *ftdi, unsigned char *pins) {
-    // Turn on the coil
-    *pins |= POWER_SW_ON;
-    *pins &= ~(POWER_SW_OFF);
-    if (writePins(ftdi, *pins) != EXIT_SUCCESS)
-        return EXIT_FAILURE;
-
-    // Wait for 100ms
-    usleep(DELAY_100MS);
-
-    // Turn off the coil
-    *pins |= POWER_SW_OFF;
-    if (writePins(ftdi, *pins) != EXIT_SUCCESS)
-        return EXIT_FAILURE;
-
-    return EXIT_SUCCESS;
-}
-
-int powerOn(struct ftdi_context *ftdi, unsigned char *pins) {
-    // Turn on the coil
-    *pins |= POWER_SW_OFF;
-    *pins &= ~(POWER_SW_ON);
-    if (writePins(ftdi, *pins) != EXIT_SUCCESS)
-        return EXIT_FAILURE;
-
-    // Wait for 100ms
-    usleep(DELAY_100MS);
-
-    // Turn off the coil
-    *pins |= POWER_SW_ON;
-    if (writePins(ftdi, *pins) != EXIT_SUCCESS)
-        return EXIT_FAILURE;
-
-    return EXIT_SUCCESS;
-}
-
-int doPower(bool off, bool on, CCOptionValue options[]) {
-    unsigned char pins;
-    CCDeviceType deviceType;
-    int ret = EXIT_SUCCESS;
-
-    int period = 1000;
-    if (options[CCO_TickTime].argn > 0) {
-        period = options[CCO_TickTime].argn;
-    }
-
-    struct ftdi_context *ftdi = prepareDevice(options, &pins, &deviceType);
-    if (ftdi == NULL)
-        return EXIT_FAILURE;
-
-    if (!hasFeature(deviceType, CCF_POWERSWITCH)) {
-        fprintf(stderr,"Power switching is not available on this device.\n");
-        ret = EXIT_FAILURE;
-        goto finish_him;
-    }
-
-    ret = powerOff(ftdi, &pins);
-    if (off && (ret != EXIT_SUCCESS)) {
-        ret = EXIT_FAILURE;
-        goto finish_him;
-    }
-
-    // Wait for specified period in ms
-    usleep(period * 1000);
-
-    ret = powerOn(ftdi, &pins);
-    if (on && (ret != EXIT_SUCCESS)) {
-        ret = EXIT_FAILURE;
-        goto finish_him;
-    }
-
-finish_him:
-    ftdi_usb_close(ftdi);
-    ftdi_free(ftdi);
-
-    return ret;
-}
-
-int selectTarget(Target target, CCOptionValue options[]) {
-    unsigned char pins;
-    CCDeviceType deviceType;
-    int ret = EXIT_SUCCESS;
-
-    struct ftdi_context *ftdi = prepareDevice(options, &pins, &deviceType);
-    if (ftdi == NULL)
-        return EXIT_FAILURE;
-
-    if (deviceType == CCDT_SDWIRE) {
-        unsigned char pinState = 0x00;
-        pinState |= 0xF0; // Upper half of the byte sets all pins to output (SDWire has only one bit - 0)
-        pinState |= target == T_DUT ? 0x00 : 0x01; // Lower half of the byte sets state of output pins.
-                                                   // In this particular case we care only of bit 0.
-        ret |= ftdi_set_bitmode(ftdi, pinState, BITMODE_CBUS);
-        goto finish_him;
-    }
-
-    if (deviceType == CCDT_USBMUX) {
-        unsigned char pinState = 0xF0;
-
-        if (target == T_DUT) {
-            pinState &= ~UM_DEVICE_PWR;
-            ret |= ftdi_set_bitmode(ftdi, pinState, BITMODE_CBUS);
-            usleep(DELAY_500MS);
-            pinState |= UM_DEVICE_PWR;
-            ret |= ftdi_set_bitmode(ftdi, pinState, BITMODE_CBUS);
-            usleep(DELAY_100MS);
-            pinState |= UM_DUT_LED;
-            pinState &= ~UM_SOCKET_SEL;
-            pinState &= ~UM_GP_LED;
-            ret |= ftdi_set_bitmode(ftdi, pinState, BITMODE_CBUS);
-        } else {
-            pinState &= ~UM_DUT_LED;
-            pinState &= ~UM_DEVICE_PWR;
-            ret |= ftdi_set_bitmode(ftdi, pinState, BITMODE_CBUS);
-            usleep(DELAY_500MS);
-            pinState |= UM_DEVICE_PWR;
-            ret |= ftdi_set_bitmode(ftdi, pinState, BITMODE_CBUS);
-            usleep(DELAY_100MS);
-            pinState |= UM_SOCKET_SEL;
-            pinState |= UM_GP_LED;
-            ret |= ftdi_set_bitmode(ftdi, pinState, BITMODE_CBUS);
-        }
-
-        goto finish_him;
-    }
-
-    // Currently only old SD-MUX is the other device so do the job in its style.
-    if (target == T_DUT) {
-        pins &= ~(USB_SEL);
-        pins &= ~(SOCKET_SEL);
-        if (powerOn(ftdi, &pins) != EXIT_SUCCESS) {  // Also selects USB and SD
-            ret = EXIT_FAILURE;
-            goto finish_him;
-        }
-    } else {
-        pins |= USB_SEL;
-        pins |= SOCKET_SEL;
-        if (powerOff(ftdi, &pins) != EXIT_SUCCESS) { // Also selects USB and SD
-            ret = EXIT_FAILURE;
-            goto finish_him;
-        }
-    }
-
-finish_him:
-    ftdi_usb_close(ftdi);
-    ftdi_free(ftdi);
-
-    return ret;
-}
-
 int setPins(unsigned char pins, CCOptionValue options[]) {
     CCDeviceType deviceType;
     struct ftdi_context *ftdi = prepareDevice(options, NULL, &deviceType);
@@ -574,105 +421,15 @@ int setPins(unsigned char pins, CCOptionValue options[]) {
 
     int ret = writePins(ftdi, pins);
 
-    ftdi_usb_close(ftdi);
-    ftdi_free(ftdi);
+    closeDevice(ftdi);
 
     return ret;
 }
 
-int showStatus(CCOptionValue options[]) {
-	int ret = 0;
-    unsigned char pins;
-    CCDeviceType deviceType;
-    struct ftdi_context *ftdi = prepareDevice(options, &pins, &deviceType);
-    if (ftdi == NULL)
-        return EXIT_FAILURE;
-
-
-    if (deviceType == CCDT_SDWIRE) {
-       if (ftdi_read_pins(ftdi, &pins) != 0) {
-           fprintf(stderr, "Error reading pins state.\n");
-           ret = EXIT_FAILURE;
-           goto finish_him;
-       }
-       fprintf(stdout, "SD connected to: %s\n", pins & SOCKET_SEL ? "TS" : "DUT");
-       goto finish_him;
-    }
-
-    if (deviceType == CCDT_USBMUX) {
-       if (ftdi_read_pins(ftdi, &pins) != 0) {
-           fprintf(stderr, "Error reading pins state.\n");
-           ret = EXIT_FAILURE;
-           goto finish_him;
-       }
-
-       if (pins == 0xff) {
-           fprintf(stdout, "Device not initialized!\n");
-           goto finish_him;
-       }
-
-       fprintf(stdout, "SD connected to: %s\n", pins & UM_SOCKET_SEL ? "TS" : "DUT");
-       goto finish_him;
-    }
-
-    // Currently only old SD-MUX is the other device so do the job in its style.
-    if (!((pins & POWER_SW_ON) && (pins & POWER_SW_OFF))) {
-        fprintf(stdout, "Device not initialized!\n");
-        goto finish_him;
-    }
-
-    fprintf(stdout, "USB connected to: %s\n", pins & USB_SEL ? "TS" : "DUT");
-    fprintf(stdout, "SD connected to: %s\n", pins & SOCKET_SEL ? "TS" : "DUT");
-
-finish_him:
-    ftdi_usb_close(ftdi);
-    ftdi_free(ftdi);
-
-    return ret;
-}
-
-int setDyPer(CCCommand cmd, CCOptionValue options[]) {
-    unsigned char pins;
-    bool switchOn;
-    CCDeviceType deviceType;
-    int ret = EXIT_SUCCESS, dyper;
-
-    struct ftdi_context *ftdi = prepareDevice(options, &pins, &deviceType);
-    if (ftdi == NULL)
-        return EXIT_FAILURE;
-
-    if (!hasFeature(deviceType, CCF_DYPERS)) {
-        fprintf(stderr,"DyPers are not available on this device.\n");
-        return EXIT_FAILURE;
-    }
-
-    #define STRON "ON"
-    #define STROFF "OFF"
-
-    if (strcasecmp(STRON, options[CCO_DyPer].args) == 0) {
-      switchOn = true;
-    } else if (strcasecmp(STROFF, options[CCO_DyPer].args) == 0) {
-      switchOn = false;
-    } else {
-      fprintf(stderr,"Invalid DyPer argument! Use \"on\" or \"off\".\n");
-      goto finish_him;
-    }
-
-    dyper = cmd == CCC_DyPer1 ? DYPER1 : DYPER2;
-    pins = switchOn ? pins | dyper : pins & ~dyper;
-
-    if (writePins(ftdi, pins) != EXIT_SUCCESS)
-        ret = EXIT_FAILURE;
-
-finish_him:
-    ftdi_usb_close(ftdi);
-    ftdi_free(ftdi);
-
-    return ret;
-}
-
-int parseArguments(int argc, const char **argv, CCCommand *cmd, int *arg, char *args, size_t argsLen,
-                   CCOptionValue options[]) {
+int parseArguments(int argc, const char **argv, CCCommand *cmd, std::vector<CCAction> *actions, int *arg, char *args,
+                   size_t argsLen, CCOptionValue options[]) {
+    CCCommand parsed;
+    CCAction action;
     int c;
     char *serial = NULL;
 
@@ -696,12 +453,59 @@ int parseArguments(int argc, const char **argv, CCCommand *cmd, int *arg, char *
                     NULL },
             { "device-id", 'v', POPT_ARG_INT, &options[CCO_DeviceId].argn, 'v', "use device with given id", NULL },
             { "device-serial", 'e', POPT_ARG_STRING, &options[CCO_DeviceSerial].args, 'e',
-                    "use device with given serial number", NULL },
+                    "use device with given serial number (comma separated list runs command on all of them)", NULL },
             { "device-type", 'k', POPT_ARG_STRING, &options[CCO_DeviceType].args, 'k',
                     "make the device of this type", NULL },
             { "vendor", 'x', POPT_ARG_INT, &options[CCO_Vendor].argn, 'x', "use device with given vendor id", NULL },
             { "product", 'a', POPT_ARG_INT, &options[CCO_Product].argn, 'a', "use device with given product id", NULL },
             { "invert", 'n', POPT_ARG_NONE, NULL, 'n', "invert bits for --pins command", NULL },
+            { "daemon", '\0', POPT_ARG_NONE, NULL, 'D', "run as sd-mux-ctrld keeping devices open and serving requests",
+                    NULL },
+            { "socket", '\0', POPT_ARG_STRING, &options[CCO_Socket].args, 'S', "sd-mux-ctrld socket path", NULL },
+            { "direct", '\0', POPT_ARG_NONE, NULL, 'R', "access the device directly even if sd-mux-ctrld is running",
+                    NULL },
+            { "eeprom-detect", '\0', POPT_ARG_NONE, NULL, 'E', "detect device type from EEPROM contents", NULL },
+            { "batch", '\0', POPT_ARG_STRING, &options[CCO_BatchFile].args, 'B',
+                    "execute commands listed in the file, one per line (\"-\" reads from stdin)", "FILE" },
+            { "all", '\0', POPT_ARG_NONE, NULL, 'A', "execute command on all connected devices at once", NULL },
+            { "jobs", '\0', POPT_ARG_INT, &options[CCO_Jobs].argn, 'J',
+                    "number of devices handled in parallel by --all or a list of serial numbers", NULL },
+            { "format", '\0', POPT_ARG_STRING, &options[CCO_Format].args, 'F', "output format: \"text\" or \"json\"",
+                    NULL },
+            { "timings", '\0', POPT_ARG_NONE, NULL, 'T', "print duration of each phase of the command to stderr",
+                    NULL },
+            { "wait-for", '\0', POPT_ARG_STRING, &serial, 'W',
+                    "wait until device with given serial number is connected", "SERIAL" },
+            { "wait-blockdev", '\0', POPT_ARG_NONE, NULL, 'L',
+                    "wait for the block device of the card reader and print its path", NULL },
+            { "flash", '\0', POPT_ARG_STRING, &options[CCO_FlashImage].args, 'f',
+                    "switch the card to TS, write the image to it and switch it back to DUT (\"-\" reads from stdin)",
+                    "IMAGE" },
+            { "blockdev", '\0', POPT_ARG_STRING, &options[CCO_Blockdev].args, 'b',
+                    "write --flash image to given block device or file instead of the card reader", "PATH" },
+            { "bmap", '\0', POPT_ARG_STRING, &options[CCO_Bmap].args, 'P',
+                    "write only blocks mapped in given bmaptool block map and verify their checksums", "FILE" },
+            { "sparse", '\0', POPT_ARG_NONE, NULL, 'Z',
+                    "skip --flash blocks holding only zeros", NULL },
+            { "discard", '\0', POPT_ARG_NONE, NULL, 'X',
+                    "discard blocks skipped by --bmap or --sparse", NULL },
+            { "delta", '\0', POPT_ARG_NONE, NULL, 'G',
+                    "read the card and write only --flash chunks which differ", NULL },
+            { "verify", '\0', POPT_ARG_NONE, NULL, 'V',
+                    "read the card back after --flash and compare it with the image", NULL },
+            { "image-cache", '\0', POPT_ARG_STRING, &options[CCO_ImageCache].args, 'C',
+                    "keep decompressed --flash images with hashes of their chunks in given directory", "DIR" },
+            { "image-cache-size", '\0', POPT_ARG_INT, &options[CCO_ImageCacheSize].argn, 'Q',
+                    "evict least recently used images once the image cache grows over given size in MiB", NULL },
+            { "card-manifest", '\0', POPT_ARG_STRING, &options[CCO_CardManifest].args, 'K',
+                    "keep hashes of chunks written to each card in given directory and write only chunks which differ",
+                    "DIR" },
+            { "partition", '\0', POPT_ARG_STRING, &options[CCO_Partition].args, 'N',
+                    "write only the partition of --flash image with given number or GPT label", "N|LABEL" },
+            { "timeout", '\0', POPT_ARG_INT, &options[CCO_Timeout].argn, 'O',
+                    "give up --wait-for or --wait-blockdev after given number of seconds", NULL },
+            { "metrics-port", '\0', POPT_ARG_INT, &options[CCO_MetricsPort].argn, 'M',
+                    "serve sd-mux-ctrld metrics in Prometheus format on given localhost port", NULL },
             POPT_AUTOHELP
             { NULL, 0, 0, NULL, 0, NULL, NULL }
     };
@@ -715,46 +519,93 @@ int parseArguments(int argc, const char **argv, CCCommand *cmd, int *arg, char *
     }
     /* Now do options processing, get portname */
     while ((c = poptGetNextOpt(optCon)) >= 0) {
+        parsed = CCC_None;
         switch (c) {
             case 'l':
-                *cmd = CCC_List;
+                parsed = CCC_List;
                 break;
             case 'i':
-                *cmd = CCC_Info;
+                parsed = CCC_Info;
                 break;
             case 'o':
-                *cmd = CCC_ShowSerial;
+                parsed = CCC_ShowSerial;
                 break;
             case 'r':
-                *cmd = CCC_SetSerial;
+                parsed = CCC_SetSerial;
                 break;
             case 't':
-                *cmd = CCC_Init;
+                parsed = CCC_Init;
                 break;
             case 'd':
-                *cmd = CCC_DUT;
+                parsed = CCC_DUT;
                 break;
             case 's':
-                *cmd = CCC_TS;
+                parsed = CCC_TS;
                 break;
             case 'p':
-                *cmd = CCC_Pins;
+                parsed = CCC_Pins;
                 break;
             case 'c':
-                *cmd = CCC_Tick;
+                parsed = CCC_Tick;
                 break;
             case 'u':
-                *cmd = CCC_Status;
+                parsed = CCC_Status;
                 break;
             case 'y':
-                *cmd = CCC_DyPer1;
+                parsed = CCC_DyPer1;
                 break;
             case 'z':
-                *cmd = CCC_DyPer2;
+                parsed = CCC_DyPer2;
                 break;
             case 'n':
                 options[CCO_BitsInvert].argn = 1;
                 break;
+            case 'D':
+                parsed = CCC_Daemon;
+                break;
+            case 'R':
+                options[CCO_Direct].argn = 1;
+                break;
+            case 'E':
+                options[CCO_EepromDetect].argn = 1;
+                break;
+            case 'B':
+                parsed = CCC_Batch;
+                break;
+            case 'W':
+                parsed = CCC_WaitFor;
+                break;
+            case 'f':
+                parsed = CCC_Flash;
+                break;
+            case 'A':
+                options[CCO_All].argn = 1;
+                break;
+            case 'T':
+                options[CCO_Timings].argn = 1;
+                break;
+            case 'L':
+                options[CCO_WaitBlockdev].argn = 1;
+                break;
+            case 'Z':
+                options[CCO_Sparse].argn = 1;
+                break;
+            case 'X':
+                options[CCO_Discard].argn = 1;
+                break;
+            case 'G':
+                options[CCO_Delta].argn = 1;
+                break;
+            case 'V':
+                options[CCO_Verify].argn = 1;
+                break;
+        }
+
+        if (parsed != CCC_None) {
+            action.cmd = parsed;
+            action.state = (parsed == CCC_DyPer1 || parsed == CCC_DyPer2) ? options[CCO_DyPer].args : "";
+            actions->push_back(action);
+            *cmd = parsed;
         }
     }
 
@@ -773,20 +624,373 @@ int parseArguments(int argc, const char **argv, CCCommand *cmd, int *arg, char *
     return EXIT_SUCCESS;
 }
 
-int main(int argc, const char **argv) {
-    CCCommand cmd = CCC_None;
-    int arg;
-    char args[64];
-    CCOptionValue options[CCO_MAX];
-    memset(&options, 0, sizeof(options));
-    options[CCO_DeviceId].argn = -1;
-    options[CCO_Vendor].argn = SAMSUNG_VENDOR;
-    options[CCO_Product].argn = PRODUCT;
+static const char *getCommandLabel(CCCommand cmd) {
+    switch (cmd) {
+    case CCC_List:
+        return "list";
+    case CCC_Info:
+        return "info";
+    case CCC_ShowSerial:
+        return "show-serial";
+    case CCC_SetSerial:
+        return "set-serial";
+    case CCC_Pins:
+        return "pins";
+    case CCC_WaitFor:
+        return "wait-for";
+    case CCC_Flash:
+        return "flash";
+    default:
+        return getCommandName(cmd) != NULL ? getCommandName(cmd) : "none";
+    }
+}
+
+// All actions share a single open of the device and the pin state read while preparing it
+static int runActions(const std::vector<CCAction> &actions, CCOptionValue options[]) {
+    CCPoolDevice dev;
+    int ret;
+
+    dev.pins = 0;
+    dev.busy = false;
+    dev.ftdi = prepareDevice(options, &dev.pins, &dev.deviceType);
+    if (dev.ftdi == NULL)
+        return EXIT_FAILURE;
+
+    ret = executeActions(&dev, actions, options, stdout);
+
+    closeDevice(dev.ftdi);
+
+    return ret;
+}
+
+// Switches the card of the selected device through sd-mux-ctrld if it is running
+static int switchCard(CCCommand cmd, CCOptionValue options[]) {
+    std::vector<CCAction> actions(1);
+    int ret;
+
+    actions[0].cmd = cmd;
+    if (!options[CCO_Direct].argn) {
+        ret = daemonRequestActions(actions, options, stdout);
+        if (ret != CCD_NOT_HANDLED)
+            return ret;
+    }
+
+    return runActions(actions, options);
+}
+
+static double getMibPerSecond(uint64_t bytes, double ms) {
+    return ms > 0 ? bytes / (1024.0 * 1024.0) * 1000.0 / ms : 0;
+}
+
+static void printFlashStatsJson(const char *image, const char *target, const CCFlashStats &stats) {
+    double writeMs = stats.totalMs - stats.readWaitMs - stats.verifyMs;
+
+    printf("\"image\": ");
+    printJsonString(stdout, image);
+    printf(", \"target\": ");
+    printJsonString(stdout, target);
+    printf(", \"format\": \"%s\", \"bytes\": %llu, \"image_bytes\": %llu, \"written_bytes\": %llu, "
+           "\"skipped_bytes\": %llu, \"discarded_bytes\": %llu, \"unchanged_bytes\": %llu, ",
+           getImageFormatName(stats.format), (unsigned long long)stats.bytes, (unsigned long long)stats.imageBytes,
+           (unsigned long long)stats.writtenBytes, (unsigned long long)stats.skippedBytes,
+           (unsigned long long)stats.discardedBytes, (unsigned long long)stats.unchangedBytes);
+    printf("\"card_read_ms\": %.3f, \"hash_ms\": %.3f, \"verify_ms\": %.3f, ", stats.cardReadMs, stats.hashMs,
+           stats.verifyMs);
+    printf("\"time_ms\": %.3f, \"decode_ms\": %.3f, \"read_wait_ms\": %.3f, \"write_wait_ms\": %.3f, "
+           "\"decode_mib_s\": %.1f, \"write_mib_s\": %.1f, \"cached\": %s, \"card_manifest\": %s, \"direct\": %s, "
+           "\"async\": %s", stats.totalMs, stats.decodeMs, stats.readWaitMs, stats.writeWaitMs,
+           getMibPerSecond(stats.bytes, stats.decodeMs), getMibPerSecond(stats.bytes, writeMs),
+           stats.cached ? "true" : "false", stats.lastWritten ? "true" : "false", stats.direct ? "true" : "false",
+           stats.async ? "true" : "false");
+}
+
+// Throughput of each stage tells whether decompression or the card is the bottleneck
+static void printFlashStats(const char *image, const char *target, const CCFlashStats &stats,
+                            CCOptionValue options[]) {
+    double writeMs = stats.totalMs - stats.readWaitMs - stats.verifyMs;
+
+    if (isJsonFormat(options)) {
+        printf("{");
+        printFlashStatsJson(image, target, stats);
+        printf("}\n");
+        return;
+    }
+
+    printf("Flashed %.1f MiB to %s in %.1f s (%.1f MiB/s)\n", stats.bytes / (1024.0 * 1024.0), target,
+           stats.totalMs / 1000.0, getMibPerSecond(stats.bytes, stats.totalMs));
+    if (stats.skippedBytes > 0 || stats.unchangedBytes > 0 || options[CCO_Delta].argn) {
+        printf("  %.1f MiB written, %.1f MiB unchanged, %.1f MiB skipped, %.1f MiB discarded\n",
+               stats.writtenBytes / (1024.0 * 1024.0), stats.unchangedBytes / (1024.0 * 1024.0),
+               stats.skippedBytes / (1024.0 * 1024.0), stats.discardedBytes / (1024.0 * 1024.0));
+    }
+    printf("  %-6s %8.1f MiB/s, %.1f MiB of %s image, waited %.1f s for the card\n", "read",
+           getMibPerSecond(stats.bytes, stats.decodeMs), stats.imageBytes / (1024.0 * 1024.0),
+           stats.cached ? "cached" : getImageFormatName(stats.format), stats.writeWaitMs / 1000.0);
+    if (stats.lastWritten) {
+        printf("  %-6s compared with the card manifest, card checked in %.1f s, hashing took %.1f s\n", "delta",
+               stats.cardReadMs / 1000.0, stats.hashMs / 1000.0);
+    } else if (options[CCO_Delta].argn) {
+        printf("  %-6s %8.1f MiB/s, hashing took %.1f s\n", "delta", getMibPerSecond(stats.bytes, stats.cardReadMs),
+               stats.hashMs / 1000.0);
+    }
+    printf("  %-6s %8.1f MiB/s, waited %.1f s for the image\n", "write", getMibPerSecond(stats.bytes, writeMs),
+           stats.readWaitMs / 1000.0);
+    if (options[CCO_Verify].argn)
+        printf("  %-6s %8.1f MiB/s\n", "verify", getMibPerSecond(stats.bytes, stats.verifyMs));
+}
+
+// Throughput of each card shows which of them, or their readers, hold back the others
+static void printFlashResults(const char *image, const std::vector<std::string> &serials,
+                              const std::vector<std::string> &targets, const std::vector<CCFlashStats> &stats,
+                              const std::vector<int> &results, double timeMs, CCOptionValue options[]) {
+    size_t width = strlen("Device"), targetWidth = strlen("Block device");
+
+    if (isJsonFormat(options)) {
+        printf("[");
+        for (size_t i = 0; i < targets.size(); i++) {
+            printf("%s\n  {\"serial\": ", i ? "," : "");
+            if (serials.empty())
+                printf("null");
+            else
+                printJsonString(stdout, serials[i].c_str());
+            printf(", \"rc\": %d, ", results[i]);
+            printFlashStatsJson(image, targets[i].c_str(), stats[i]);
+            printf("}");
+        }
+        printf("%s]\n", targets.empty() ? "" : "\n");
+        return;
+    }
+
+    printf("Flashed %.1f MiB of %s image to %zu cards in %.1f s, read at %.1f MiB/s\n",
+           stats[0].bytes / (1024.0 * 1024.0), stats[0].cached ? "cached" : getImageFormatName(stats[0].format),
+           targets.size(), timeMs / 1000.0, getMibPerSecond(stats[0].bytes, stats[0].decodeMs));
+
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (!serials.empty() && serials[i].size() > width)
+            width = serials[i].size();
+        if (targets[i].size() > targetWidth)
+            targetWidth = targets[i].size();
+    }
+
+    printf("%-*s  %-*s  %-6s  %13s  %8s  %8s\n", (int)width, "Device", (int)targetWidth, "Block device", "Result",
+           "Written [MiB]", "Time [s]", "MiB/s");
+    for (size_t i = 0; i < targets.size(); i++) {
+        printf("%-*s  %-*s  %-6s  %13.1f  %8.1f  %8.1f\n", (int)width, serials.empty() ? "-" : serials[i].c_str(),
+               (int)targetWidth, targets[i].c_str(), results[i] == EXIT_SUCCESS ? "OK" : "FAILED",
+               stats[i].writtenBytes / (1024.0 * 1024.0), stats[i].totalMs / 1000.0,
+               getMibPerSecond(stats[i].bytes, stats[i].totalMs));
+    }
+}
 
-    if (parseArguments(argc, argv, &cmd, &arg, args, sizeof(args), options) != EXIT_SUCCESS) {
+static void selectDevice(CCOptionValue options[], const char *serial, CCOptionValue devOptions[]) {
+    memcpy(devOptions, options, sizeof(CCOptionValue) * CCO_MAX);
+    devOptions[CCO_DeviceSerial].args = (char *)serial;
+    devOptions[CCO_DeviceId].argn = -1;
+    devOptions[CCO_All].argn = 0;
+}
+
+// Cards already switched to TS are switched back when the others cannot be prepared
+static void restoreCards(CCOptionValue options[], const std::vector<std::string> &serials, size_t count) {
+    CCOptionValue devOptions[CCO_MAX];
+
+    for (size_t i = 0; i < count; i++) {
+        selectDevice(options, serials[i].c_str(), devOptions);
+        if (switchCard(CCC_DUT, devOptions) != EXIT_SUCCESS)
+            fprintf(stderr, "Card of %s is left connected to TS\n", serials[i].c_str());
+    }
+}
+
+// Files are told apart by inode, block devices by device number, as many nodes may stand for one device
+static bool isSameTarget(const struct stat &a, const struct stat &b) {
+    if (S_ISBLK(a.st_mode) && S_ISBLK(b.st_mode))
+        return a.st_rdev == b.st_rdev;
+
+    return a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+}
+
+// A target given twice would be written by two writers at once
+static int checkDuplicateTargets(const std::vector<std::string> &targets) {
+    std::vector<struct stat> st(targets.size());
+    std::vector<bool> found(targets.size());
+
+    for (size_t i = 0; i < targets.size(); i++)
+        found[i] = stat(targets[i].c_str(), &st[i]) == 0;
+
+    for (size_t i = 0; i < targets.size(); i++) {
+        for (size_t j = i + 1; j < targets.size(); j++) {
+            if (found[i] && found[j] ? isSameTarget(st[i], st[j]) : targets[i] == targets[j]) {
+                fprintf(stderr, "%s and %s are the same target\n", targets[i].c_str(), targets[j].c_str());
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Image is decompressed once and written to the cards of many devices, or to a comma separated list of block devices,
+ * at once. Cards which have been written successfully are switched to DUT, the others are left connected to TS.
+ */
+static int flashCards(CCOptionValue options[]) {
+    const char *image = options[CCO_FlashImage].args;
+    std::vector<std::string> serials, targets;
+    std::vector<CCFlashStats> stats;
+    std::vector<int> results;
+    CCOptionValue devOptions[CCO_MAX];
+    char devPath[BLOCKDEV_PATH_SIZE];
+    double start;
+    int ret;
+
+    if (isFanOut(options)) {
+        if (options[CCO_Blockdev].args != NULL) {
+            fprintf(stderr, "--blockdev cannot be given along with many devices\n");
+            return EXIT_FAILURE;
+        }
+        if (getTargetSerials(options, serials) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+        if (serials.empty()) {
+            fprintf(stderr, "No devices found\n");
+            return EXIT_FAILURE;
+        }
+
+        // Block devices appear only after the cards are switched to TS
+        for (size_t i = 0; i < serials.size(); i++) {
+            selectDevice(options, serials[i].c_str(), devOptions);
+            if (checkDeviceCardReader(devOptions) != EXIT_SUCCESS || switchCard(CCC_TS, devOptions) != EXIT_SUCCESS) {
+                fprintf(stderr, "Unable to prepare card of %s, nothing has been written\n", serials[i].c_str());
+                restoreCards(options, serials, i);
+                return EXIT_FAILURE;
+            }
+            if (findCardBlockdev(devOptions, FLASH_BLOCKDEV_TIMEOUT, devPath, sizeof(devPath)) != EXIT_SUCCESS) {
+                fprintf(stderr, "Unable to prepare card of %s, nothing has been written\n", serials[i].c_str());
+                restoreCards(options, serials, i + 1);
+                return EXIT_FAILURE;
+            }
+            targets.push_back(devPath);
+        }
+    } else {
+        for (const char *s = options[CCO_Blockdev].args; *s != '\0'; ) {
+            size_t len = strcspn(s, ",");
+            if (len > 0)
+                targets.push_back(std::string(s, len));
+            s += len;
+            if (*s == ',')
+                s++;
+        }
+        if (targets.empty()) {
+            fprintf(stderr, "No block device provided!\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (checkDuplicateTargets(targets) != EXIT_SUCCESS) {
+        restoreCards(options, serials, serials.size());
+        return EXIT_FAILURE;
+    }
+
+    start = getTimeMs();
+    ret = flashImages(targets, serials, options, stats, results);
+    recordPhase(CCP_Flash, start);
+
+    for (size_t i = 0; i < serials.size(); i++) {
+        selectDevice(options, serials[i].c_str(), devOptions);
+        if (results[i] != EXIT_SUCCESS)
+            fprintf(stderr, "Card of %s is left connected to TS\n", serials[i].c_str());
+        else if (switchCard(CCC_DUT, devOptions) != EXIT_SUCCESS)
+            results[i] = ret = EXIT_FAILURE;
+    }
+
+    printFlashResults(image, serials, targets, stats, results, getTimeMs() - start, options);
+
+    return ret;
+}
+
+/*
+ * Card is switched to TS, image is written to the block device of the card reader and the card is switched back to
+ * DUT. If writing fails, the card is left connected to TS. Block device may be given explicitly with --blockdev, which
+ * also allows writing to a loop device or a file without any sd-mux device.
+ */
+int flashCard(CCOptionValue options[]) {
+    const char *image = options[CCO_FlashImage].args;
+    const char *target = options[CCO_Blockdev].args;
+    bool hasDevice = options[CCO_DeviceSerial].args != NULL || options[CCO_DeviceId].argn >= 0;
+    char devPath[BLOCKDEV_PATH_SIZE];
+    CCFlashStats stats;
+    double start;
+    int ret;
+
+    if (checkFormat(options) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    // Device ids change as devices are plugged in, so manifests are kept under serial numbers
+    if (options[CCO_CardManifest].args != NULL && options[CCO_DeviceSerial].args == NULL && !options[CCO_All].argn) {
+        fprintf(stderr, "--card-manifest needs the device to be given with --device-serial or --all\n");
         return EXIT_FAILURE;
     }
 
+    if (isFanOut(options) || (!hasDevice && target != NULL && strchr(target, ',') != NULL))
+        return flashCards(options);
+
+    if (!hasDevice && target == NULL) {
+        fprintf(stderr, "No serial number, device id or block device provided!\n");
+        return EXIT_FAILURE;
+    }
+
+    if (hasDevice && target == NULL && checkDeviceCardReader(options) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    if (hasDevice && switchCard(CCC_TS, options) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    if (target == NULL) {
+        if (findCardBlockdev(options, FLASH_BLOCKDEV_TIMEOUT, devPath, sizeof(devPath)) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+        target = devPath;
+    }
+
+    start = getTimeMs();
+    ret = flashImage(target, options, &stats);
+    recordPhase(CCP_Flash, start);
+    if (ret != EXIT_SUCCESS) {
+        if (hasDevice)
+            fprintf(stderr, "Card is left connected to TS\n");
+        return EXIT_FAILURE;
+    }
+
+    if (hasDevice && switchCard(CCC_DUT, options) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    printFlashStats(image, target, stats, options);
+
+    return EXIT_SUCCESS;
+}
+
+static int dispatchCommand(CCCommand cmd, const std::vector<CCAction> &actions, int arg, char *args,
+                           CCOptionValue options[]) {
+    int ret;
+
+    if (actions.size() > 1 && !arePoolActions(actions)) {
+        fprintf(stderr, "Only --init, --dut, --ts, --tick, --status, --dyper1 and --dyper2 can be combined\n");
+        return EXIT_FAILURE;
+    }
+
+    if (cmd != CCC_Batch && cmd != CCC_Flash && isFanOut(options)) {
+        // Each action is executed on all devices before the next one starts
+        for (size_t i = 0; i < actions.size(); i++) {
+            applyAction(actions[i], options);
+            if (runOnDevices(actions[i].cmd, options) != EXIT_SUCCESS)
+                return EXIT_FAILURE;
+        }
+        return actions.empty() ? runOnDevices(cmd, options) : EXIT_SUCCESS;
+    }
+
+    if (!options[CCO_Direct].argn && !actions.empty() && arePoolActions(actions)) {
+        ret = daemonRequestActions(actions, options, stdout);
+        if (ret != CCD_NOT_HANDLED)
+            return ret;
+    }
+
     switch (cmd) {
     case CCC_None:
         fprintf(stderr, "No command specified\n");
@@ -800,21 +1004,85 @@ int main(int argc, const char **argv) {
     case CCC_SetSerial:
         return setSerial(args, options);
     case CCC_Init:
-        return doInit(options);
     case CCC_DUT:
-        return selectTarget(T_DUT, options);
     case CCC_TS:
-        return selectTarget(T_TS, options);
     case CCC_Tick:
-        return doPower(true, true, options);
-    case CCC_Pins:
-        return setPins((unsigned char)arg, options);
     case CCC_DyPer1:
     case CCC_DyPer2:
-        return setDyPer(cmd, options);
     case CCC_Status:
-        return showStatus(options);
+        return runActions(actions, options);
+    case CCC_Pins:
+        return setPins((unsigned char)arg, options);
+    case CCC_Daemon:
+        return runDaemon(options);
+    case CCC_Batch:
+        return runBatch(options);
+    case CCC_WaitFor:
+        return waitForDevice(args, options);
+    case CCC_Flash:
+        return flashCard(options);
     }
 
     return EXIT_SUCCESS;
 }
+
+static int runCommand(CCCommand cmd, const std::vector<CCAction> &actions, int arg, char *args,
+                      CCOptionValue options[]) {
+    int ret = EXIT_SUCCESS;
+
+    // Switching is pointless if the device has no card reader to wait for
+    if (cmd != CCC_None && options[CCO_WaitBlockdev].argn && !isFanOut(options)
+            && checkDeviceCardReader(options) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    if (cmd != CCC_None || !options[CCO_WaitBlockdev].argn)
+        ret = dispatchCommand(cmd, actions, arg, args, options);
+
+    // Card reader shows up once the card is connected to TS
+    if (ret == EXIT_SUCCESS && options[CCO_WaitBlockdev].argn)
+        ret = waitBlockdev(options);
+
+    return ret;
+}
+
+int main(int argc, const char **argv) {
+    CCCommand cmd = CCC_None;
+    std::vector<CCAction> actions;
+    int arg, ret;
+    char args[64], selector[SELECTOR_SIZE];
+    CCOptionValue options[CCO_MAX];
+    std::vector<CCPhaseTime> phases;
+    double start, end;
+    memset(&options, 0, sizeof(options));
+    options[CCO_DeviceId].argn = -1;
+    options[CCO_Vendor].argn = SAMSUNG_VENDOR;
+    options[CCO_Product].argn = PRODUCT;
+    options[CCO_ImageCacheSize].argn = IMAGE_CACHE_DEFAULT_SIZE;
+
+    if (parseArguments(argc, argv, &cmd, &actions, &arg, args, sizeof(args), options) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    // Batch and fan-out report timings of each command and device on their own
+    if ((!options[CCO_Timings].argn && getenv(SDMUX_TIMINGS_LOG_ENV) == NULL)
+            || cmd == CCC_Batch || cmd == CCC_Daemon || isFanOut(options)) {
+        return runCommand(cmd, actions, arg, args, options);
+    }
+
+    setPhaseLog(&phases);
+    start = getTimeMs();
+    ret = runCommand(cmd, actions, arg, args, options);
+    end = getTimeMs();
+    setPhaseLog(NULL);
+
+    if (options[CCO_Timings].argn)
+        printPhases(stderr, NULL, phases, start, end, isJsonFormat(options));
+    if (getSelector(options, selector, sizeof(selector)) != EXIT_SUCCESS)
+        selector[0] = '\0';
+    if (actions.size() > 1)
+        logPhases(getActionsName(actions).c_str(), selector, ret, phases, start, end);
+    else
+        logPhases(getCommandLabel(cmd), selector, ret, phases, start, end);
+
+    return ret;
+}
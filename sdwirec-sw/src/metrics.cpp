@@ -0,0 +1,151 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/metrics.cpp
+ * @brief       Per-device counters and latency histograms of sd-mux-ctrld
+ *
+ * Metrics are kept in memory for the lifetime of the daemon and labelled with the device selector (serial number or
+ * #id) the clients use.
+ */
+
+#include <stdlib.h>
+
+#include <map>
+#include <string>
+
+#include "daemon.h"
+#include "metrics.h"
+
+#define BUCKET_COUNT    (sizeof(bucketBounds) / sizeof(bucketBounds[0]))
+
+// Upper bounds of histogram buckets in seconds
+static const double bucketBounds[] = { 0.001, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+
+struct CCHistogram {
+    unsigned long buckets[BUCKET_COUNT];
+    unsigned long count;
+    double sum;
+};
+
+// Keys are label sets already formatted for output, e.g. device="x",command="dut"
+static std::map<std::string, unsigned long> commandCounts;
+static std::map<std::string, unsigned long> switchCounts;
+static std::map<std::string, unsigned long> tickCounts;
+static std::map<std::string, unsigned long> errorCounts;
+static std::map<std::string, CCHistogram> openLatency;
+static std::map<std::string, CCHistogram> sequenceLatency;
+
+static std::string escapeLabel(const char *value) {
+    std::string escaped;
+
+    for (const char *c = value; *c != '\0'; c++) {
+        if (*c == '\\' || *c == '"')
+            escaped += '\\';
+        if (*c == '\n')
+            escaped += "\\n";
+        else
+            escaped += *c;
+    }
+
+    return escaped;
+}
+
+static std::string getLabels(const char *device, const char *name, const char *value) {
+    std::string labels = "device=\"" + escapeLabel(device) + "\"";
+
+    if (name != NULL)
+        labels += std::string(",") + name + "=\"" + escapeLabel(value) + "\"";
+
+    return labels;
+}
+
+static void observe(std::map<std::string, CCHistogram> &histograms, const std::string &labels, double ms) {
+    std::map<std::string, CCHistogram>::iterator it = histograms.find(labels);
+    double seconds = ms / 1000.0;
+
+    if (it == histograms.end()) {
+        CCHistogram empty = {};
+        it = histograms.insert(std::make_pair(labels, empty)).first;
+    }
+
+    for (size_t i = 0; i < BUCKET_COUNT; i++) {
+        if (seconds <= bucketBounds[i])
+            it->second.buckets[i]++;
+    }
+    it->second.count++;
+    it->second.sum += seconds;
+}
+
+void countCommand(const char *device, CCCommand cmd, int ret) {
+    const char *name = getCommandName(cmd);
+
+    if (name == NULL)
+        return;
+
+    commandCounts[getLabels(device, "command", name) + ",result=" + (ret == EXIT_SUCCESS ? "\"ok\"" : "\"error\"")]++;
+    if (ret != EXIT_SUCCESS)
+        return;
+
+    if (cmd == CCC_DUT || cmd == CCC_TS)
+        switchCounts[getLabels(device, "target", name)]++;
+    if (cmd == CCC_Tick || cmd == CCC_Init)
+        tickCounts[getLabels(device, NULL, NULL)]++;
+}
+
+void countError(const char *device, const char *error) {
+    errorCounts[getLabels(device, "error", error != NULL ? error : "unknown")]++;
+}
+
+void observeOpen(const char *device, double ms) {
+    observe(openLatency, getLabels(device, NULL, NULL), ms);
+}
+
+void observeSequence(const char *device, CCCommand cmd, double ms) {
+    const char *name = getCommandName(cmd);
+
+    observe(sequenceLatency, getLabels(device, "command", name != NULL ? name : "unknown"), ms);
+}
+
+static void printCounters(FILE *out, const char *metric, const char *help,
+                          const std::map<std::string, unsigned long> &counters) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s counter\n", metric, help, metric);
+    for (std::map<std::string, unsigned long>::const_iterator it = counters.begin(); it != counters.end(); ++it)
+        fprintf(out, "%s{%s} %lu\n", metric, it->first.c_str(), it->second);
+}
+
+static void printHistograms(FILE *out, const char *metric, const char *help,
+                            const std::map<std::string, CCHistogram> &histograms) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s histogram\n", metric, help, metric);
+    for (std::map<std::string, CCHistogram>::const_iterator it = histograms.begin(); it != histograms.end(); ++it) {
+        const char *labels = it->first.c_str();
+        const CCHistogram &h = it->second;
+
+        for (size_t i = 0; i < BUCKET_COUNT; i++)
+            fprintf(out, "%s_bucket{%s,le=\"%g\"} %lu\n", metric, labels, bucketBounds[i], h.buckets[i]);
+        fprintf(out, "%s_bucket{%s,le=\"+Inf\"} %lu\n", metric, labels, h.count);
+        fprintf(out, "%s_sum{%s} %.6f\n", metric, labels, h.sum);
+        fprintf(out, "%s_count{%s} %lu\n", metric, labels, h.count);
+    }
+}
+
+void printMetrics(FILE *out) {
+    printCounters(out, "sdmux_commands_total", "Commands executed by the daemon.", commandCounts);
+    printCounters(out, "sdmux_switches_total", "Successful switches of the SD card to DUT or TS.", switchCounts);
+    printCounters(out, "sdmux_ticks_total", "Successful power cycles of DUT.", tickCounts);
+    printCounters(out, "sdmux_errors_total", "Failures by libftdi error string.", errorCounts);
+    printHistograms(out, "sdmux_open_seconds", "Time spent opening and preparing a device.", openLatency);
+    printHistograms(out, "sdmux_sequence_seconds", "Duration of switching and power sequences.", sequenceLatency);
+}
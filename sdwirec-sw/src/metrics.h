@@ -0,0 +1,36 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/metrics.h
+ * @brief       Per-device counters and latency histograms of sd-mux-ctrld
+ */
+
+#ifndef SDMUXCTRL_METRICS_H
+#define SDMUXCTRL_METRICS_H
+
+#include <stdio.h>
+
+#include "common.h"
+
+void countCommand(const char *device, CCCommand cmd, int ret);
+void countError(const char *device, const char *error);
+void observeOpen(const char *device, double ms);
+void observeSequence(const char *device, CCCommand cmd, double ms);
+
+// Prints all metrics in Prometheus text exposition format
+void printMetrics(FILE *out);
+
+#endif // SDMUXCTRL_METRICS_H
@@ -0,0 +1,149 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/partition.cpp
+ * @brief       Partition tables of images and cards
+ *
+ * SD cards have 512-byte sectors, so the tables are always read with that sector size. Entries of GPT are expected
+ * right after its header, where all tools put them, so the first PARTITION_TABLE_SIZE bytes of a disk hold the whole
+ * table.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "partition.h"
+
+#define MBR_SIGNATURE_OFFSET    510
+#define MBR_ENTRIES_OFFSET      446
+#define MBR_ENTRY_SIZE          16
+#define MBR_ENTRIES             4
+#define MBR_TYPE_GPT            0xee
+#define GPT_SIGNATURE           "EFI PART"
+#define GPT_ENTRY_MIN_SIZE      128
+#define GPT_NAME_OFFSET         56
+
+static uint32_t getLe32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t getLe64(const unsigned char *p) {
+    return (uint64_t)getLe32(p) | (uint64_t)getLe32(p + 4) << 32;
+}
+
+static bool isZero(const unsigned char *p, size_t len) {
+    return p[0] == 0 && memcmp(p, p + 1, len - 1) == 0;
+}
+
+// Names are stored in UTF-16LE
+static void getGptLabel(const unsigned char *entry, char label[PARTITION_LABEL_SIZE]) {
+    const unsigned char *name = entry + GPT_NAME_OFFSET;
+    unsigned c;
+    size_t i;
+
+    for (i = 0; i < PARTITION_LABEL_SIZE - 1; i++) {
+        c = name[2 * i] | name[2 * i + 1] << 8;
+        if (c == 0)
+            break;
+        label[i] = c >= 0x20 && c < 0x7f ? c : '?';
+    }
+    label[i] = '\0';
+}
+
+static int parseGpt(const unsigned char *data, size_t len, std::vector<CCPartition> &partitions) {
+    const unsigned char *header = data + PARTITION_SECTOR_SIZE, *entry;
+    uint64_t entriesOffset, first, last;
+    uint32_t count, entrySize;
+
+    if (len < 2 * PARTITION_SECTOR_SIZE || memcmp(header, GPT_SIGNATURE, strlen(GPT_SIGNATURE)) != 0)
+        return EXIT_FAILURE;
+
+    entriesOffset = getLe64(header + 72) * PARTITION_SECTOR_SIZE;
+    count = getLe32(header + 80);
+    entrySize = getLe32(header + 84);
+    if (entrySize < GPT_ENTRY_MIN_SIZE || entriesOffset > len || count > (len - entriesOffset) / entrySize)
+        return EXIT_FAILURE;
+
+    for (uint32_t i = 0; i < count; i++) {
+        entry = data + entriesOffset + (size_t)i * entrySize;
+        // Unused entries have zero type GUID
+        if (isZero(entry, 16))
+            continue;
+
+        first = getLe64(entry + 32);
+        last = getLe64(entry + 40);
+        if (last < first)
+            continue;
+
+        CCPartition partition = { i + 1, first * PARTITION_SECTOR_SIZE, (last - first + 1) * PARTITION_SECTOR_SIZE,
+                                  "" };
+        getGptLabel(entry, partition.label);
+        partitions.push_back(partition);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int parsePartitionTable(const unsigned char *data, size_t len, std::vector<CCPartition> &partitions) {
+    const unsigned char *entry;
+
+    partitions.clear();
+    if (len < PARTITION_SECTOR_SIZE || data[MBR_SIGNATURE_OFFSET] != 0x55 || data[MBR_SIGNATURE_OFFSET + 1] != 0xaa)
+        return EXIT_FAILURE;
+
+    for (unsigned i = 0; i < MBR_ENTRIES; i++) {
+        entry = data + MBR_ENTRIES_OFFSET + i * MBR_ENTRY_SIZE;
+        if (entry[4] == MBR_TYPE_GPT)
+            return parseGpt(data, len, partitions);
+    }
+
+    for (unsigned i = 0; i < MBR_ENTRIES; i++) {
+        entry = data + MBR_ENTRIES_OFFSET + i * MBR_ENTRY_SIZE;
+        if (entry[4] == 0 || getLe32(entry + 12) == 0)
+            continue;
+
+        CCPartition partition = { i + 1, (uint64_t)getLe32(entry + 8) * PARTITION_SECTOR_SIZE,
+                                  (uint64_t)getLe32(entry + 12) * PARTITION_SECTOR_SIZE, "" };
+        partitions.push_back(partition);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+const CCPartition *findPartition(const std::vector<CCPartition> &partitions, const char *name) {
+    unsigned number;
+    char end;
+
+    for (size_t i = 0; i < partitions.size(); i++) {
+        if (sscanf(name, "%u%c", &number, &end) == 1 ? partitions[i].number == number
+                                                     : strcmp(partitions[i].label, name) == 0)
+            return &partitions[i];
+    }
+
+    return NULL;
+}
+
+bool isSameLayout(const std::vector<CCPartition> &a, const std::vector<CCPartition> &b) {
+    if (a.size() != b.size())
+        return false;
+
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].number != b[i].number || a[i].start != b[i].start || a[i].size != b[i].size)
+            return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,49 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/partition.h
+ * @brief       Partition tables of images and cards
+ */
+
+#ifndef SDMUXCTRL_PARTITION_H
+#define SDMUXCTRL_PARTITION_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#define PARTITION_SECTOR_SIZE   512
+#define PARTITION_TABLE_SIZE    (34 * PARTITION_SECTOR_SIZE)    // MBR, GPT header and 128 entries of 128 bytes
+#define PARTITION_LABEL_SIZE    37                              // GPT names have up to 36 characters
+
+struct CCPartition {
+    unsigned number;        // As in the name of the partition device, starting from 1
+    uint64_t start;         // Bytes
+    uint64_t size;
+    char label[PARTITION_LABEL_SIZE];   // Name of a GPT partition, characters other than ASCII are replaced by '?'
+};
+
+/*
+ * Parses MBR at the beginning of a disk or, if the MBR is protective, GPT following it. Only primary partitions of MBR
+ * are listed. Fails if the data holds no partition table.
+ */
+int parsePartitionTable(const unsigned char *data, size_t len, std::vector<CCPartition> &partitions);
+// Name is either the number of the partition or its GPT label
+const CCPartition *findPartition(const std::vector<CCPartition> &partitions, const char *name);
+bool isSameLayout(const std::vector<CCPartition> &a, const std::vector<CCPartition> &b);
+
+#endif // SDMUXCTRL_PARTITION_H
@@ -0,0 +1,245 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/pathcache.cpp
+ * @brief       Persistent cache mapping device serial numbers to USB port paths
+ *
+ * Opening a device by its serial number makes libftdi open every device with matching VID:PID and compare
+ * serial strings. The cache remembers where the device was found last time, so it can be opened directly by its
+ * bus and address. An entry is trusted only if sysfs still reports the same serial number, address and type at
+ * the cached port, so any replugging or topology change invalidates it.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "backend.h"
+#include "device.h"
+#include "pathcache.h"
+#include "sysfs.h"
+
+#define CACHE_FILE      "devices"
+
+static const char *deviceTypeNames[CCDT_MAX] = { CCDT_SDMUX_STR, CCDT_SDWIRE_STR, CCDT_USBMUX_STR };
+
+const char *getCacheDir(char *buf, size_t len) {
+    const char *dir = getenv(SDMUX_CACHE_DIR_ENV);
+
+    if (dir != NULL && *dir != '\0')
+        return dir;
+
+    if (access("/run", W_OK) == 0)
+        return SDMUX_DEFAULT_CACHE_DIR;
+
+    dir = getenv("XDG_RUNTIME_DIR");
+    if (dir == NULL || *dir == '\0')
+        return NULL;
+
+    snprintf(buf, len, "%s/sd-mux-ctrl", dir);
+    return buf;
+}
+
+int openCacheFile(const char *name, int flags) {
+    char dirBuf[256], path[300];
+    const char *dir = getCacheDir(dirBuf, sizeof(dirBuf));
+
+    if (dir == NULL)
+        return -1;
+
+    if (flags & O_CREAT)
+        mkdir(dir, 0755);
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    return open(path, flags | O_CLOEXEC, 0644);
+}
+
+static bool parseEntry(char *line, CCCacheEntry *entry) {
+    char *tab = strchr(line, '\t'), *port, *value;
+    size_t len;
+    int n;
+
+    if (tab == NULL || tab - line > STRING_SIZE)
+        return false;
+    *tab = '\0';
+
+    port = tab + 1;
+    len = strcspn(port, " ");
+    if (len == 0 || len >= sizeof(entry->port))
+        return false;
+    memcpy(entry->port, port, len);
+    entry->port[len] = '\0';
+
+    if (sscanf(port + len, " %d %d %n", &entry->busnum, &entry->devnum, &n) != 2)
+        return false;
+    value = port + len + n;
+    value[strcspn(value, "\n")] = '\0';
+    if (*value == '\0')
+        return false;
+
+    strcpy(entry->serial, line);
+    entry->value = value;
+
+    return true;
+}
+
+static void readEntries(int fd, std::vector<CCCacheEntry> &entries) {
+    char line[STRING_SIZE + PORT_PATH_SIZE + 64];
+    CCCacheEntry entry;
+    FILE *f;
+
+    f = fdopen(dup(fd), "r");
+    if (f == NULL)
+        return;
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (parseEntry(line, &entry))
+            entries.push_back(entry);
+    }
+
+    fclose(f);
+}
+
+void readCacheEntries(const char *name, std::vector<CCCacheEntry> &entries) {
+    int fd;
+
+    fd = openCacheFile(name, O_RDONLY);
+    if (fd < 0)
+        return;
+
+    flock(fd, LOCK_SH);
+    readEntries(fd, entries);
+    close(fd);
+}
+
+static void appendEntry(std::string &content, const CCCacheEntry *entry) {
+    char line[STRING_SIZE + PORT_PATH_SIZE + 64];
+
+    snprintf(line, sizeof(line), "%s\t%s %d %d %s\n", entry->serial, entry->port, entry->busnum, entry->devnum,
+             entry->value.c_str());
+    content += line;
+}
+
+// Replaces entries of the device and of its port with the given one, or only removes them
+void updateCacheEntry(const char *name, const CCCacheEntry *entry, bool remove) {
+    std::vector<CCCacheEntry> entries;
+    std::string content;
+    int fd;
+
+    fd = openCacheFile(name, O_RDWR | O_CREAT);
+    if (fd < 0)
+        return;
+
+    flock(fd, LOCK_EX);
+    readEntries(fd, entries);
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        // Any entry of a device which used to be at the same port is stale as well
+        if (strcmp(entries[i].serial, entry->serial) == 0 || strcmp(entries[i].port, entry->port) == 0)
+            continue;
+        appendEntry(content, &entries[i]);
+    }
+    if (!remove)
+        appendEntry(content, entry);
+
+    if (ftruncate(fd, 0) == 0 && pwrite(fd, content.data(), content.size(), 0) != (ssize_t)content.size())
+        fprintf(stderr, "Unable to update %s in the cache directory\n", name);
+
+    close(fd);
+}
+
+static bool validateDevicePath(const CCDevicePath *devPath, int vendor, int product) {
+    char buf[STRING_SIZE + 1];
+    int value;
+
+    if (readUsbAttribute(devPath->port, "serial", buf, sizeof(buf)) != EXIT_SUCCESS
+            || strcmp(buf, devPath->serial) != 0)
+        return false;
+
+    if (readUsbAttributeInt(devPath->port, "busnum", 10, &value) != EXIT_SUCCESS || value != devPath->busnum)
+        return false;
+
+    if (readUsbAttributeInt(devPath->port, "devnum", 10, &value) != EXIT_SUCCESS || value != devPath->devnum)
+        return false;
+
+    if (readUsbAttributeInt(devPath->port, "idVendor", 16, &value) != EXIT_SUCCESS || value != vendor)
+        return false;
+
+    if (readUsbAttributeInt(devPath->port, "idProduct", 16, &value) != EXIT_SUCCESS || value != product)
+        return false;
+
+    if (readUsbAttribute(devPath->port, "product", buf, sizeof(buf)) != EXIT_SUCCESS
+            || getDeviceTypeFromString(buf) != devPath->deviceType)
+        return false;
+
+    return true;
+}
+
+bool findDevicePath(const char *serial, int vendor, int product, CCDevicePath *devPath) {
+    std::vector<CCCacheEntry> entries;
+
+    readCacheEntries(CACHE_FILE, entries);
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (strcmp(entries[i].serial, serial) == 0) {
+            strcpy(devPath->serial, entries[i].serial);
+            strcpy(devPath->port, entries[i].port);
+            devPath->busnum = entries[i].busnum;
+            devPath->devnum = entries[i].devnum;
+            devPath->deviceType = getDeviceTypeFromString(entries[i].value.c_str());
+            return devPath->deviceType != CCDT_MAX && validateDevicePath(devPath, vendor, product);
+        }
+    }
+
+    return false;
+}
+
+int getDevicePath(struct ftdi_context *ftdi, const char *serial, CCDevicePath *devPath) {
+    char product[STRING_SIZE + 1];
+
+    if (getBackend()->getPort(ftdi, devPath->port, sizeof(devPath->port), &devPath->busnum, &devPath->devnum) < 0)
+        return EXIT_FAILURE;
+
+    if (readUsbAttribute(devPath->port, "product", product, sizeof(product)) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    devPath->deviceType = getDeviceTypeFromString(product);
+    if (devPath->deviceType == CCDT_MAX)
+        return EXIT_FAILURE;
+
+    snprintf(devPath->serial, sizeof(devPath->serial), "%s", serial);
+
+    return EXIT_SUCCESS;
+}
+
+void storeDevicePath(const CCDevicePath *devPath) {
+    CCCacheEntry entry;
+
+    strcpy(entry.serial, devPath->serial);
+    strcpy(entry.port, devPath->port);
+    entry.busnum = devPath->busnum;
+    entry.devnum = devPath->devnum;
+    entry.value = deviceTypeNames[devPath->deviceType];
+
+    updateCacheEntry(CACHE_FILE, &entry, false);
+}
@@ -0,0 +1,63 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/pathcache.h
+ * @brief       Persistent cache mapping device serial numbers to USB port paths
+ */
+
+#ifndef SDMUXCTRL_PATHCACHE_H
+#define SDMUXCTRL_PATHCACHE_H
+
+#include <string>
+#include <vector>
+
+#include <libftdi1/ftdi.h>
+
+#include "common.h"
+#include "sysfs.h"
+
+#define SDMUX_CACHE_DIR_ENV     "SDMUX_CACHE_DIR"
+#define SDMUX_DEFAULT_CACHE_DIR "/run/sd-mux-ctrl"
+
+struct CCDevicePath {
+    char serial[STRING_SIZE + 1];
+    char port[PORT_PATH_SIZE];
+    int busnum;
+    int devnum;
+    CCDeviceType deviceType;
+};
+
+/*
+ * Line of a file in the cache directory: "<serial>\t<port> <busnum> <devnum> <value>". Each device and each port
+ * have at most one entry.
+ */
+struct CCCacheEntry {
+    char serial[STRING_SIZE + 1];
+    char port[PORT_PATH_SIZE];
+    int busnum;
+    int devnum;
+    std::string value;
+};
+
+const char *getCacheDir(char *buf, size_t len);
+int openCacheFile(const char *name, int flags);
+void readCacheEntries(const char *name, std::vector<CCCacheEntry> &entries);
+void updateCacheEntry(const char *name, const CCCacheEntry *entry, bool remove);
+bool findDevicePath(const char *serial, int vendor, int product, CCDevicePath *devPath);
+int getDevicePath(struct ftdi_context *ftdi, const char *serial, CCDevicePath *devPath);
+void storeDevicePath(const CCDevicePath *devPath);
+
+#endif // SDMUXCTRL_PATHCACHE_H
@@ -0,0 +1,142 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/pinshadow.cpp
+ * @brief       Shadow copy of the last pin state written to SD-MUX devices
+ *
+ * Changing a single relay of SD-MUX requires knowing the state of all other pins. Instead of reading it back from
+ * the device before every write, the last written state is kept in the cache directory, keyed by the serial number.
+ * An entry is used only if the device is still at the same port with the same address, as a device which has been
+ * replugged or reset gets a new address and starts with its pins in the default state.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "backend.h"
+#include "common.h"
+#include "pathcache.h"
+#include "pinshadow.h"
+#include "sysfs.h"
+
+#define SHADOW_FILE     "pins"
+
+struct CCPinShadow {
+    char serial[STRING_SIZE + 1];
+    char port[PORT_PATH_SIZE];
+    int busnum;
+    int devnum;
+};
+
+// Devices opened by this process, so writes do not have to look up their identity again
+static std::map<struct ftdi_context *, CCPinShadow> openShadows;
+static std::mutex shadowMutex;
+
+// Replaces the entry of the device, or only removes it if pins is NULL
+static void updateEntries(const CCPinShadow *shadow, const unsigned int *pins) {
+    CCCacheEntry entry;
+    char value[8];
+
+    strcpy(entry.serial, shadow->serial);
+    strcpy(entry.port, shadow->port);
+    entry.busnum = shadow->busnum;
+    entry.devnum = shadow->devnum;
+    if (pins != NULL) {
+        snprintf(value, sizeof(value), "0x%02x", *pins);
+        entry.value = value;
+    }
+
+    updateCacheEntry(SHADOW_FILE, &entry, pins == NULL);
+}
+
+static bool findShadow(struct ftdi_context *ftdi, CCPinShadow *shadow) {
+    std::lock_guard<std::mutex> lock(shadowMutex);
+    std::map<struct ftdi_context *, CCPinShadow>::iterator it = openShadows.find(ftdi);
+
+    if (it == openShadows.end())
+        return false;
+
+    *shadow = it->second;
+    return true;
+}
+
+void openPinShadow(struct ftdi_context *ftdi) {
+    CCPinShadow shadow;
+
+    if (getBackend()->getPort(ftdi, shadow.port, sizeof(shadow.port), &shadow.busnum, &shadow.devnum) < 0)
+        return;
+
+    if (readUsbAttribute(shadow.port, "serial", shadow.serial, sizeof(shadow.serial)) != EXIT_SUCCESS
+            || shadow.serial[0] == '\0')
+        return;
+
+    std::lock_guard<std::mutex> lock(shadowMutex);
+    openShadows[ftdi] = shadow;
+}
+
+bool getPinShadow(struct ftdi_context *ftdi, unsigned char *pins) {
+    std::vector<CCCacheEntry> entries;
+    CCPinShadow shadow;
+    unsigned long value;
+    char *end;
+
+    if (!findShadow(ftdi, &shadow))
+        return false;
+
+    readCacheEntries(SHADOW_FILE, entries);
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (strcmp(entries[i].serial, shadow.serial) == 0) {
+            if (strcmp(entries[i].port, shadow.port) != 0 || entries[i].busnum != shadow.busnum
+                    || entries[i].devnum != shadow.devnum)
+                return false;
+            value = strtoul(entries[i].value.c_str(), &end, 16);
+            if (*end != '\0' || value > 0xff)
+                return false;
+            *pins = value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void setPinShadow(struct ftdi_context *ftdi, unsigned char pins) {
+    CCPinShadow shadow;
+    unsigned int value = pins;
+
+    if (findShadow(ftdi, &shadow))
+        updateEntries(&shadow, &value);
+}
+
+void invalidatePinShadow(struct ftdi_context *ftdi) {
+    CCPinShadow shadow;
+
+    if (findShadow(ftdi, &shadow))
+        updateEntries(&shadow, NULL);
+}
+
+void closePinShadow(struct ftdi_context *ftdi) {
+    std::lock_guard<std::mutex> lock(shadowMutex);
+
+    openShadows.erase(ftdi);
+}
@@ -0,0 +1,32 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/pinshadow.h
+ * @brief       Shadow copy of the last pin state written to SD-MUX devices
+ */
+
+#ifndef SDMUXCTRL_PINSHADOW_H
+#define SDMUXCTRL_PINSHADOW_H
+
+#include <libftdi1/ftdi.h>
+
+void openPinShadow(struct ftdi_context *ftdi);
+bool getPinShadow(struct ftdi_context *ftdi, unsigned char *pins);
+void setPinShadow(struct ftdi_context *ftdi, unsigned char pins);
+void invalidatePinShadow(struct ftdi_context *ftdi);
+void closePinShadow(struct ftdi_context *ftdi);
+
+#endif // SDMUXCTRL_PINSHADOW_H
@@ -0,0 +1,244 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/pool.cpp
+ * @brief       Set of devices kept open between commands
+ *
+ * Devices are identified by a selector which is either the serial number or "#<id>". Each device is opened and
+ * prepared once, then its type and pin state are kept along with the ftdi context.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "backend.h"
+#include "daemon.h"
+#include "device.h"
+#include "pool.h"
+#include "sequencer.h"
+
+static std::vector<CCPoolDevice *> devices;
+
+int getSelector(CCOptionValue options[], char *selector, size_t len) {
+    if (options[CCO_DeviceSerial].args != NULL) {
+        snprintf(selector, len, "%s", options[CCO_DeviceSerial].args);
+    } else if (options[CCO_DeviceId].argn >= 0) {
+        snprintf(selector, len, "#%d", options[CCO_DeviceId].argn);
+    } else {
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int applySelector(const char *selector, CCOptionValue options[]) {
+    if (selector[0] == '#') {
+        char *end;
+        options[CCO_DeviceSerial].args = NULL;
+        options[CCO_DeviceId].argn = strtol(selector + 1, &end, 10);
+        if (*end != '\0' || options[CCO_DeviceId].argn < 0)
+            return EXIT_FAILURE;
+    } else {
+        options[CCO_DeviceSerial].args = (char *)selector;
+        options[CCO_DeviceId].argn = -1;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+bool isPoolCommand(CCCommand cmd) {
+    switch (cmd) {
+    case CCC_DUT:
+    case CCC_TS:
+    case CCC_Tick:
+    case CCC_Init:
+    case CCC_Status:
+    case CCC_DyPer1:
+    case CCC_DyPer2:
+        return true;
+    default:
+        return false;
+    }
+}
+
+CCPoolDevice *findPoolDevice(const char *selector) {
+    for (size_t i = 0; i < devices.size(); i++) {
+        if (devices[i]->selector == selector)
+            return devices[i];
+    }
+
+    return NULL;
+}
+
+CCPoolDevice *getPoolDevice(CCOptionValue options[]) {
+    char selector[SELECTOR_SIZE];
+    CCPoolDevice *dev;
+    int busnum, devnum;
+
+    if (getSelector(options, selector, sizeof(selector)) != EXIT_SUCCESS) {
+        fprintf(stderr, "No serial number or device id provided!\n");
+        return NULL;
+    }
+
+    dev = findPoolDevice(selector);
+    if (dev != NULL)
+        return dev;
+
+    dev = new CCPoolDevice();
+    dev->pins = 0;
+    dev->busy = false;
+    dev->stale = false;
+    dev->ftdi = prepareDevice(options, &dev->pins, &dev->deviceType);
+    if (dev->ftdi == NULL) {
+        delete dev;
+        return NULL;
+    }
+
+    // Selector may be "#<id>", so the port is what tells which handle an unplugged device leaves behind
+    if (getBackend()->getPort(dev->ftdi, dev->port, sizeof(dev->port), &busnum, &devnum) < 0)
+        dev->port[0] = '\0';
+
+    dev->selector = selector;
+    devices.push_back(dev);
+
+    return dev;
+}
+
+void dropPoolDevice(CCPoolDevice *dev) {
+    for (size_t i = 0; i < devices.size(); i++) {
+        if (devices[i] == dev) {
+            devices.erase(devices.begin() + i);
+            break;
+        }
+    }
+
+    closeDevice(dev->ftdi);
+    delete dev;
+}
+
+// Handles of a device are useless once it is unplugged, a new one is opened when the device comes back
+void dropUnpluggedDevices(const CCUsbDevice *usbDev) {
+    for (size_t i = devices.size(); i-- > 0;) {
+        CCPoolDevice *dev = devices[i];
+        bool unplugged = dev->port[0] != '\0' ? strcmp(dev->port, usbDev->port) == 0 : dev->selector == usbDev->serial;
+
+        if (!unplugged)
+            continue;
+
+        if (dev->busy)
+            dev->stale = true;
+        else
+            dropPoolDevice(dev);
+    }
+}
+
+void closePool() {
+    while (!devices.empty())
+        dropPoolDevice(devices.back());
+}
+
+bool isSequenceCommand(CCCommand cmd) {
+    return cmd == CCC_DUT || cmd == CCC_TS || cmd == CCC_Tick || cmd == CCC_Init;
+}
+
+int buildSequence(CCPoolDevice *dev, CCCommand cmd, CCOptionValue options[], CCSequence *seq) {
+    int period = options[CCO_TickTime].argn > 0 ? options[CCO_TickTime].argn : DEFAULT_PERIOD;
+    long at;
+
+    if ((cmd == CCC_Tick || cmd == CCC_Init) && !hasFeature(dev->deviceType, CCF_POWERSWITCH)) {
+        fprintf(stderr,"Power switching is not available on this device.\n");
+        return EXIT_FAILURE;
+    }
+
+    initSequence(seq, dev->ftdi);
+
+    switch (cmd) {
+    case CCC_DUT:
+        addSwitchTarget(seq, dev->deviceType, &dev->pins, 0, T_DUT);
+        return EXIT_SUCCESS;
+    case CCC_TS:
+        addSwitchTarget(seq, dev->deviceType, &dev->pins, 0, T_TS);
+        return EXIT_SUCCESS;
+    case CCC_Tick:
+        addCyclePower(seq, &dev->pins, 0, period);
+        return EXIT_SUCCESS;
+    case CCC_Init:
+        at = addCyclePower(seq, &dev->pins, 0, period);
+        addSwitchTarget(seq, dev->deviceType, &dev->pins, at, T_TS);
+        return EXIT_SUCCESS;
+    default:
+        return EXIT_FAILURE;
+    }
+}
+
+int executeCommand(CCPoolDevice *dev, CCCommand cmd, CCOptionValue options[], FILE *out) {
+    CCSequence seq;
+
+    if (isSequenceCommand(cmd)) {
+        if (buildSequence(dev, cmd, options, &seq) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+        return runSequence(&seq);
+    }
+
+    switch (cmd) {
+    case CCC_DyPer1:
+    case CCC_DyPer2:
+        return switchDyPer(dev->ftdi, dev->deviceType, &dev->pins, cmd, options[CCO_DyPer].args);
+    case CCC_Status:
+        return printStatus(dev->ftdi, dev->deviceType, dev->pins, out);
+    default:
+        return EXIT_FAILURE;
+    }
+}
+
+bool arePoolActions(const std::vector<CCAction> &actions) {
+    for (size_t i = 0; i < actions.size(); i++) {
+        if (!isPoolCommand(actions[i].cmd))
+            return false;
+    }
+
+    return true;
+}
+
+void applyAction(const CCAction &action, CCOptionValue options[]) {
+    if (action.cmd == CCC_DyPer1 || action.cmd == CCC_DyPer2)
+        options[CCO_DyPer].args = (char *)action.state.c_str();
+}
+
+std::string getActionsName(const std::vector<CCAction> &actions) {
+    std::string name;
+
+    for (size_t i = 0; i < actions.size(); i++) {
+        if (i > 0)
+            name += ",";
+        name += getCommandName(actions[i].cmd);
+    }
+
+    return name;
+}
+
+// Actions are executed in the given order and the first failing one stops the rest
+int executeActions(CCPoolDevice *dev, const std::vector<CCAction> &actions, CCOptionValue options[], FILE *out) {
+    for (size_t i = 0; i < actions.size(); i++) {
+        applyAction(actions[i], options);
+        if (executeCommand(dev, actions[i].cmd, options, out) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,72 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/pool.h
+ * @brief       Set of devices kept open between commands
+ */
+
+#ifndef SDMUXCTRL_POOL_H
+#define SDMUXCTRL_POOL_H
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include <libftdi1/ftdi.h>
+
+#include "common.h"
+#include "sequencer.h"
+#include "sysfs.h"
+
+#define SELECTOR_SIZE   (STRING_SIZE + 2)
+#define DEFAULT_PERIOD  1000
+
+struct CCPoolDevice {
+    std::string selector;
+    struct ftdi_context *ftdi;
+    char port[PORT_PATH_SIZE];  // USB port the device was opened on, empty if unknown
+    CCDeviceType deviceType;
+    unsigned char pins;
+    bool busy;
+    bool stale;                 // Device was unplugged while busy, dropped once its sequence finishes
+};
+
+// Single command given on the command line, DyPer commands carry the requested state
+struct CCAction {
+    CCCommand cmd;
+    std::string state;
+};
+
+int getSelector(CCOptionValue options[], char *selector, size_t len);
+int applySelector(const char *selector, CCOptionValue options[]);
+bool isPoolCommand(CCCommand cmd);
+
+CCPoolDevice *findPoolDevice(const char *selector);
+CCPoolDevice *getPoolDevice(CCOptionValue options[]);
+void dropPoolDevice(CCPoolDevice *dev);
+void dropUnpluggedDevices(const CCUsbDevice *usbDev);
+void closePool();
+
+bool isSequenceCommand(CCCommand cmd);
+int buildSequence(CCPoolDevice *dev, CCCommand cmd, CCOptionValue options[], CCSequence *seq);
+int executeCommand(CCPoolDevice *dev, CCCommand cmd, CCOptionValue options[], FILE *out);
+bool arePoolActions(const std::vector<CCAction> &actions);
+void applyAction(const CCAction &action, CCOptionValue options[]);
+std::string getActionsName(const std::vector<CCAction> &actions);
+int executeActions(CCPoolDevice *dev, const std::vector<CCAction> &actions, CCOptionValue options[], FILE *out);
+
+#endif // SDMUXCTRL_POOL_H
@@ -0,0 +1,304 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/sequencer.cpp
+ * @brief       Timer driven execution of pin state sequences
+ *
+ * Every switching procedure is described as a list of pin states with their deadlines relative to the start of
+ * the sequence. Deadlines are absolute points on the monotonic clock, so delays do not accumulate USB transfer time
+ * the way consecutive sleeps do. A single timerfd armed for the earliest pending deadline lets one thread drive any
+ * number of overlapping sequences.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "device.h"
+#include "sequencer.h"
+#include "timing.h"
+
+void initSequence(CCSequence *seq, struct ftdi_context *ftdi) {
+    seq->ftdi = ftdi;
+    seq->steps.clear();
+    seq->next = 0;
+    seq->start = 0;
+    seq->ret = EXIT_SUCCESS;
+    seq->done = NULL;
+    seq->data = NULL;
+    seq->phases = NULL;
+}
+
+static void addStep(CCSequence *seq, unsigned char pins, CCStepMode mode, long offset) {
+    CCStep step;
+
+    step.pins = pins;
+    step.mode = mode;
+    step.offset = offset;
+    seq->steps.push_back(step);
+}
+
+long addPowerOff(CCSequence *seq, unsigned char *pins, long at) {
+    // Turn on the coil
+    *pins |= POWER_SW_ON;
+    *pins &= ~(POWER_SW_OFF);
+    addStep(seq, *pins, CCSM_Data, at);
+
+    // Turn off the coil after 100ms
+    *pins |= POWER_SW_OFF;
+    addStep(seq, *pins, CCSM_Data, at + DELAY_100MS);
+
+    return at + DELAY_100MS;
+}
+
+long addPowerOn(CCSequence *seq, unsigned char *pins, long at) {
+    // Turn on the coil
+    *pins |= POWER_SW_OFF;
+    *pins &= ~(POWER_SW_ON);
+    addStep(seq, *pins, CCSM_Data, at);
+
+    // Turn off the coil after 100ms
+    *pins |= POWER_SW_ON;
+    addStep(seq, *pins, CCSM_Data, at + DELAY_100MS);
+
+    return at + DELAY_100MS;
+}
+
+long addCyclePower(CCSequence *seq, unsigned char *pins, long at, int period) {
+    at = addPowerOff(seq, pins, at);
+    return addPowerOn(seq, pins, at + period);
+}
+
+long addSwitchTarget(CCSequence *seq, CCDeviceType deviceType, unsigned char *pins, long at, Target target) {
+    if (deviceType == CCDT_SDWIRE) {
+        unsigned char pinState = 0x00;
+        pinState |= 0xF0; // Upper half of the byte sets all pins to output (SDWire has only one bit - 0)
+        pinState |= target == T_DUT ? 0x00 : 0x01; // Lower half of the byte sets state of output pins.
+                                                   // In this particular case we care only of bit 0.
+        addStep(seq, pinState, CCSM_Cbus, at);
+        *pins = pinState;
+        return at;
+    }
+
+    if (deviceType == CCDT_USBMUX) {
+        unsigned char pinState = 0xF0;
+
+        if (target == T_DUT) {
+            pinState &= ~UM_DEVICE_PWR;
+            addStep(seq, pinState, CCSM_Cbus, at);
+            pinState |= UM_DEVICE_PWR;
+            addStep(seq, pinState, CCSM_Cbus, at + DELAY_500MS);
+            pinState |= UM_DUT_LED;
+            pinState &= ~UM_SOCKET_SEL;
+            pinState &= ~UM_GP_LED;
+            addStep(seq, pinState, CCSM_Cbus, at + DELAY_500MS + DELAY_100MS);
+        } else {
+            pinState &= ~UM_DUT_LED;
+            pinState &= ~UM_DEVICE_PWR;
+            addStep(seq, pinState, CCSM_Cbus, at);
+            pinState |= UM_DEVICE_PWR;
+            addStep(seq, pinState, CCSM_Cbus, at + DELAY_500MS);
+            pinState |= UM_SOCKET_SEL;
+            pinState |= UM_GP_LED;
+            addStep(seq, pinState, CCSM_Cbus, at + DELAY_500MS + DELAY_100MS);
+        }
+
+        *pins = pinState;
+        return at + DELAY_500MS + DELAY_100MS;
+    }
+
+    // Currently only old SD-MUX is the other device so do the job in its style.
+    if (target == T_DUT) {
+        *pins &= ~(USB_SEL);
+        *pins &= ~(SOCKET_SEL);
+        return addPowerOn(seq, pins, at);   // Also selects USB and SD
+    }
+
+    *pins |= USB_SEL;
+    *pins |= SOCKET_SEL;
+    return addPowerOff(seq, pins, at);      // Also selects USB and SD
+}
+
+static int executeStep(CCSequence *seq, const CCStep *step) {
+    double start;
+    int f;
+
+    if (step->mode == CCSM_Data)
+        return writePins(seq->ftdi, step->pins);
+
+    start = getTimeMs();
+    f = getBackend()->setBitmode(seq->ftdi, step->pins, BITMODE_CBUS);
+    recordPhase(CCP_Bitmode, start);
+    if (f < 0) {
+        fprintf(stderr, "Unable to set CBUS pins to 0x%x: %d (%s)\n", step->pins, f,
+                ftdi_get_error_string(seq->ftdi));
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Executes all steps which are due. Returns true when the sequence is finished.
+static bool advanceSequence(CCSequence *seq, double now) {
+    std::vector<CCPhaseTime> *log = getPhaseLog();
+    int ret = EXIT_SUCCESS;
+
+    if (seq->phases != NULL)
+        setPhaseLog(seq->phases);
+
+    while (seq->next < seq->steps.size() && seq->start + seq->steps[seq->next].offset <= now) {
+        if (seq->steps[seq->next].offset > (seq->next > 0 ? seq->steps[seq->next - 1].offset : 0))
+            recordPhase(CCP_Delay, seq->last);
+        ret = executeStep(seq, &seq->steps[seq->next]);
+        if (ret != EXIT_SUCCESS)
+            break;
+        seq->last = getTimeMs();
+        seq->next++;
+    }
+
+    setPhaseLog(log);
+    if (ret != EXIT_SUCCESS) {
+        seq->ret = EXIT_FAILURE;
+        return true;
+    }
+
+    return seq->next >= seq->steps.size();
+}
+
+static void armTimer(CCSequencer *sequencer) {
+    struct itimerspec its;
+    double deadline = -1;
+
+    memset(&its, 0, sizeof(its));
+    for (size_t i = 0; i < sequencer->active.size(); i++) {
+        CCSequence *seq = sequencer->active[i];
+        double d = seq->start + seq->steps[seq->next].offset;
+        if (deadline < 0 || d < deadline)
+            deadline = d;
+    }
+
+    if (deadline >= 0) {
+        its.it_value.tv_sec = (time_t)(deadline / 1000);
+        its.it_value.tv_nsec = (long)((deadline - its.it_value.tv_sec * 1000.0) * 1000000);
+        // All zeroes would disarm the timer
+        if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+            its.it_value.tv_nsec = 1;
+    }
+
+    timerfd_settime(sequencer->timerFd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+int sequencerInit(CCSequencer *sequencer) {
+    sequencer->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (sequencer->timerFd < 0) {
+        fprintf(stderr, "Unable to create timer: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    sequencer->active.clear();
+
+    return EXIT_SUCCESS;
+}
+
+void sequencerClose(CCSequencer *sequencer) {
+    close(sequencer->timerFd);
+}
+
+static void finishSequence(CCSequence *seq) {
+    if (seq->done != NULL)
+        seq->done(seq);
+}
+
+void sequencerAdd(CCSequencer *sequencer, CCSequence *seq) {
+    seq->start = getTimeMs();
+    seq->last = seq->start;
+    seq->next = 0;
+
+    if (advanceSequence(seq, seq->start)) {
+        finishSequence(seq);
+        return;
+    }
+
+    sequencer->active.push_back(seq);
+    armTimer(sequencer);
+}
+
+void sequencerDispatch(CCSequencer *sequencer) {
+    std::vector<CCSequence *> finished;
+    uint64_t expirations;
+    double now = getTimeMs();
+
+    if (read(sequencer->timerFd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+        fprintf(stderr, "Unable to read timer: %s\n", strerror(errno));
+
+    for (size_t i = 0; i < sequencer->active.size(); ) {
+        if (advanceSequence(sequencer->active[i], now)) {
+            finished.push_back(sequencer->active[i]);
+            sequencer->active.erase(sequencer->active.begin() + i);
+        } else {
+            i++;
+        }
+    }
+
+    armTimer(sequencer);
+
+    // Callbacks may add new sequences, so call them once the list is consistent
+    for (size_t i = 0; i < finished.size(); i++)
+        finishSequence(finished[i]);
+}
+
+int runSequences(std::vector<CCSequence *> &seqs) {
+    CCSequencer sequencer;
+    struct pollfd pfd;
+    int ret = EXIT_SUCCESS;
+
+    if (sequencerInit(&sequencer) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    for (size_t i = 0; i < seqs.size(); i++)
+        sequencerAdd(&sequencer, seqs[i]);
+
+    pfd.fd = sequencer.timerFd;
+    pfd.events = POLLIN;
+    while (!sequencer.active.empty()) {
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+            fprintf(stderr, "Waiting for timer failed: %s\n", strerror(errno));
+            for (size_t i = 0; i < sequencer.active.size(); i++)
+                sequencer.active[i]->ret = EXIT_FAILURE;
+            break;
+        }
+        sequencerDispatch(&sequencer);
+    }
+
+    sequencerClose(&sequencer);
+
+    for (size_t i = 0; i < seqs.size(); i++) {
+        if (seqs[i]->ret != EXIT_SUCCESS)
+            ret = EXIT_FAILURE;
+    }
+
+    return ret;
+}
+
+int runSequence(CCSequence *seq) {
+    std::vector<CCSequence *> seqs(1, seq);
+
+    return runSequences(seqs);
+}
@@ -0,0 +1,83 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/sequencer.h
+ * @brief       Timer driven execution of pin state sequences
+ */
+
+#ifndef SDMUXCTRL_SEQUENCER_H
+#define SDMUXCTRL_SEQUENCER_H
+
+#include <vector>
+
+#include <libftdi1/ftdi.h>
+
+#include "common.h"
+#include "timing.h"
+
+#define DELAY_100MS     100
+#define DELAY_500MS     500
+
+enum CCStepMode {
+    CCSM_Data,      // Pins written in bitbang mode (SD-MUX)
+    CCSM_Cbus       // Pins set through CBUS bitmode (SDWire, USB-MUX)
+};
+
+struct CCStep {
+    unsigned char pins;
+    CCStepMode mode;
+    long offset;    // Milliseconds since start of the sequence
+};
+
+struct CCSequence;
+typedef void (*CCSequenceDone)(CCSequence *seq);
+
+struct CCSequence {
+    struct ftdi_context *ftdi;
+    std::vector<CCStep> steps;
+    size_t next;
+    double start;
+    double last;                        // End of the last executed step
+    int ret;
+    CCSequenceDone done;
+    void *data;
+    std::vector<CCPhaseTime> *phases;   // Phase log of the sequence, NULL for the log of the running thread
+};
+
+struct CCSequencer {
+    int timerFd;
+    std::vector<CCSequence *> active;
+};
+
+void initSequence(CCSequence *seq, struct ftdi_context *ftdi);
+
+/*
+ * Builders append steps starting at given offset and return the offset at which the appended part finishes.
+ * *pins is updated to the final state of the pins.
+ */
+long addPowerOff(CCSequence *seq, unsigned char *pins, long at);
+long addPowerOn(CCSequence *seq, unsigned char *pins, long at);
+long addCyclePower(CCSequence *seq, unsigned char *pins, long at, int period);
+long addSwitchTarget(CCSequence *seq, CCDeviceType deviceType, unsigned char *pins, long at, Target target);
+
+int sequencerInit(CCSequencer *sequencer);
+void sequencerClose(CCSequencer *sequencer);
+void sequencerAdd(CCSequencer *sequencer, CCSequence *seq);
+void sequencerDispatch(CCSequencer *sequencer);
+int runSequences(std::vector<CCSequence *> &seqs);
+int runSequence(CCSequence *seq);
+
+#endif // SDMUXCTRL_SEQUENCER_H
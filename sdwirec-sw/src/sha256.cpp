@@ -0,0 +1,162 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/sha256.cpp
+ * @brief       SHA-256 (FIPS 180-4) for checking images without extra dependencies
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sha256.h"
+
+static const uint32_t roundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+static void transform(CCSha256 *ctx, const unsigned char *block) {
+    uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 | (uint32_t)block[i * 4 + 2] << 8
+                | (uint32_t)block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    a = ctx->state[0];
+    b = ctx->state[1];
+    c = ctx->state[2];
+    d = ctx->state[3];
+    e = ctx->state[4];
+    f = ctx->state[5];
+    g = ctx->state[6];
+    h = ctx->state[7];
+
+    for (int i = 0; i < 64; i++) {
+        t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + roundConstants[i] + w[i];
+        t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    ctx->state[0] += a;
+    ctx->state[1] += b;
+    ctx->state[2] += c;
+    ctx->state[3] += d;
+    ctx->state[4] += e;
+    ctx->state[5] += f;
+    ctx->state[6] += g;
+    ctx->state[7] += h;
+}
+
+void sha256Init(CCSha256 *ctx) {
+    static const uint32_t initialState[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(ctx->state, initialState, sizeof(ctx->state));
+    ctx->length = 0;
+    ctx->blockLen = 0;
+}
+
+void sha256Update(CCSha256 *ctx, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *)data;
+    size_t n;
+
+    ctx->length += len;
+
+    if (ctx->blockLen > 0) {
+        n = SHA256_BLOCK_SIZE - ctx->blockLen < len ? SHA256_BLOCK_SIZE - ctx->blockLen : len;
+        memcpy(ctx->block + ctx->blockLen, p, n);
+        ctx->blockLen += n;
+        p += n;
+        len -= n;
+        if (ctx->blockLen < SHA256_BLOCK_SIZE)
+            return;
+        transform(ctx, ctx->block);
+        ctx->blockLen = 0;
+    }
+
+    for (; len >= SHA256_BLOCK_SIZE; p += SHA256_BLOCK_SIZE, len -= SHA256_BLOCK_SIZE)
+        transform(ctx, p);
+
+    memcpy(ctx->block, p, len);
+    ctx->blockLen = len;
+}
+
+void sha256Final(CCSha256 *ctx, unsigned char digest[SHA256_DIGEST_SIZE]) {
+    uint64_t bits = ctx->length * 8;
+
+    ctx->block[ctx->blockLen++] = 0x80;
+    if (ctx->blockLen > SHA256_BLOCK_SIZE - 8) {
+        memset(ctx->block + ctx->blockLen, 0, SHA256_BLOCK_SIZE - ctx->blockLen);
+        transform(ctx, ctx->block);
+        ctx->blockLen = 0;
+    }
+    memset(ctx->block + ctx->blockLen, 0, SHA256_BLOCK_SIZE - 8 - ctx->blockLen);
+    for (int i = 0; i < 8; i++)
+        ctx->block[SHA256_BLOCK_SIZE - 1 - i] = (unsigned char)(bits >> (i * 8));
+    transform(ctx, ctx->block);
+
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = (unsigned char)(ctx->state[i] >> 24);
+        digest[i * 4 + 1] = (unsigned char)(ctx->state[i] >> 16);
+        digest[i * 4 + 2] = (unsigned char)(ctx->state[i] >> 8);
+        digest[i * 4 + 3] = (unsigned char)ctx->state[i];
+    }
+}
+
+void sha256ToHex(const unsigned char digest[SHA256_DIGEST_SIZE], char hex[SHA256_HEX_SIZE]) {
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++)
+        snprintf(hex + i * 2, 3, "%02x", digest[i]);
+}
+
+int sha256FromHex(const char *hex, unsigned char digest[SHA256_DIGEST_SIZE]) {
+    unsigned int byte;
+
+    if (strspn(hex, "0123456789abcdefABCDEF") != SHA256_DIGEST_SIZE * 2 || hex[SHA256_DIGEST_SIZE * 2] != '\0')
+        return EXIT_FAILURE;
+
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        if (sscanf(hex + i * 2, "%2x", &byte) != 1)
+            return EXIT_FAILURE;
+        digest[i] = (unsigned char)byte;
+    }
+
+    return EXIT_SUCCESS;
+}
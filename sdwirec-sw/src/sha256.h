@@ -0,0 +1,46 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/sha256.h
+ * @brief       SHA-256 (FIPS 180-4) for checking images without extra dependencies
+ */
+
+#ifndef SDMUXCTRL_SHA256_H
+#define SDMUXCTRL_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_BLOCK_SIZE       64
+#define SHA256_DIGEST_SIZE      32
+#define SHA256_HEX_SIZE         (SHA256_DIGEST_SIZE * 2 + 1)
+
+struct CCSha256 {
+    uint32_t state[8];
+    uint64_t length;
+    unsigned char block[SHA256_BLOCK_SIZE];
+    size_t blockLen;
+};
+
+void sha256Init(CCSha256 *ctx);
+void sha256Update(CCSha256 *ctx, const void *data, size_t len);
+void sha256Final(CCSha256 *ctx, unsigned char digest[SHA256_DIGEST_SIZE]);
+
+void sha256ToHex(const unsigned char digest[SHA256_DIGEST_SIZE], char hex[SHA256_HEX_SIZE]);
+// Returns EXIT_FAILURE unless hex holds exactly SHA256_DIGEST_SIZE bytes
+int sha256FromHex(const char *hex, unsigned char digest[SHA256_DIGEST_SIZE]);
+
+#endif // SDMUXCTRL_SHA256_H
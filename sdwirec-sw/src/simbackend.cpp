@@ -0,0 +1,463 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/simbackend.cpp
+ * @brief       Backend simulating devices in process
+ *
+ * Selected with SDMUX_BACKEND=sim. Devices are listed in SDMUX_SIM_DEVICES as comma separated type:serial pairs,
+ * e.g. "sd-mux:sim0,sd-wire:sim1". By default there is one device of each type. A device given as "type:serial@ms"
+ * is plugged in the given number of milliseconds after the first use of the backend, which triggers hotplug.
+ * Every operation sleeps for the number of USB transfers it would take on a real device multiplied by
+ * SDMUX_SIM_LATENCY microseconds.
+ *
+ * Devices keep their pin state until the process exits, just like real devices keep it while they are plugged in.
+ * SD-MUX drives its data pins in bitbang mode. SD-Wire and USB-MUX drive CBUS pins, which read as 0xff until they
+ * are set for the first time.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "backend.h"
+#include "common.h"
+#include "device.h"
+#include "timing.h"
+
+#define SIM_DEFAULT_DEVICES     CCDT_SDMUX_STR ":sim-sdmux," CCDT_SDWIRE_STR ":sim-sdwire," \
+                                CCDT_USBMUX_STR ":sim-usbmux"
+#define SIM_DEFAULT_LATENCY     1000
+#define SIM_BUSNUM              0       // Real USB buses are numbered from 1
+
+// Number of USB transfers taken by operations on an FT232R
+#define SIM_OPEN_TRANSFERS      4
+#define SIM_STRING_TRANSFERS    2
+#define SIM_EEPROM_TRANSFERS    64      // One control transfer per 16-bit word
+
+struct CCSimDevice {
+    CCDeviceType deviceType;
+    std::string serial;
+    unsigned char data;
+    unsigned char cbus;
+    unsigned char mode;
+    bool cbusSet;
+    double plugTime;
+    bool reported;
+};
+
+static std::vector<CCSimDevice> simDevices;
+static std::map<struct ftdi_context *, size_t> simOpen;
+static std::mutex simMutex;
+static long simLatency;
+static CCHotplugCallback simCallback;
+static int simTimerFd = -1;
+
+// Must be called with simMutex held
+static void initDevices() {
+    static bool initialized = false;
+    const char *spec, *env;
+
+    if (initialized)
+        return;
+    initialized = true;
+
+    env = getenv(SDMUX_SIM_LATENCY_ENV);
+    simLatency = env != NULL ? atol(env) : SIM_DEFAULT_LATENCY;
+
+    spec = getenv(SDMUX_SIM_DEVICES_ENV);
+    if (spec == NULL)
+        spec = SIM_DEFAULT_DEVICES;
+
+    while (*spec != '\0') {
+        size_t len = strcspn(spec, ",");
+        std::string item(spec, len);
+        size_t colon = item.find(':');
+        size_t at = item.find('@');
+        CCSimDevice dev;
+
+        spec += len + (spec[len] == ',');
+        if (colon == std::string::npos)
+            continue;
+
+        dev.plugTime = getTimeMs();
+        if (at != std::string::npos && at > colon) {
+            dev.plugTime += atol(item.c_str() + at + 1);
+            item.erase(at);
+        }
+        dev.reported = false;
+
+        dev.deviceType = getDeviceTypeFromString(item.substr(0, colon).c_str());
+        if (dev.deviceType == CCDT_MAX)
+            continue;
+        dev.serial = item.substr(colon + 1);
+        dev.data = 0;
+        dev.cbus = 0;
+        dev.mode = BITMODE_RESET;
+        dev.cbusSet = false;
+        simDevices.push_back(dev);
+    }
+}
+
+static void transfer(int count) {
+    if (simLatency > 0)
+        usleep(simLatency * count);
+}
+
+static bool isPlugged(const CCSimDevice &dev) {
+    return getTimeMs() >= dev.plugTime;
+}
+
+static const char *getTypeName(CCDeviceType deviceType) {
+    if (deviceType == CCDT_SDWIRE)
+        return CCDT_SDWIRE_STR;
+    if (deviceType == CCDT_USBMUX)
+        return CCDT_USBMUX_STR;
+    return CCDT_SDMUX_STR;
+}
+
+// Must be called with simMutex held
+static CCSimDevice *findOpen(struct ftdi_context *ftdi) {
+    std::map<struct ftdi_context *, size_t>::iterator it = simOpen.find(ftdi);
+
+    if (it == simOpen.end()) {
+        ftdi->error_str = "simulated device not open";
+        return NULL;
+    }
+
+    return &simDevices[it->second];
+}
+
+// Must be called with simMutex held
+static void describeDevice(size_t i, CCUsbDevice *dev) {
+    snprintf(dev->port, sizeof(dev->port), "%d-%zu", SIM_BUSNUM, i + 1);
+    dev->busnum = SIM_BUSNUM;
+    dev->devnum = i + 1;
+    dev->vendor = SAMSUNG_VENDOR;
+    dev->product = PRODUCT;
+    snprintf(dev->manufacturer, sizeof(dev->manufacturer), "SRPOL");
+    snprintf(dev->description, sizeof(dev->description), "%s", getTypeName(simDevices[i].deviceType));
+    snprintf(dev->serial, sizeof(dev->serial), "%s", simDevices[i].serial.c_str());
+}
+
+static int simEnumerate(int vendor, int product, std::vector<CCUsbDevice> &devices) {
+    std::lock_guard<std::mutex> lock(simMutex);
+
+    initDevices();
+    if (vendor != SAMSUNG_VENDOR || product != PRODUCT)
+        return EXIT_SUCCESS;
+
+    for (size_t i = 0; i < simDevices.size(); i++) {
+        CCUsbDevice dev;
+
+        if (!isPlugged(simDevices[i]))
+            continue;
+        describeDevice(i, &dev);
+        devices.push_back(dev);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// Claims the device for the context, returns the index of the device or a negative error code
+static int simFindDevice(struct ftdi_context *ftdi, int vendor, int product, int busnum, int devnum,
+                      const char *serial, unsigned int index, int *transfers) {
+    std::lock_guard<std::mutex> lock(simMutex);
+
+    initDevices();
+    *transfers = 0;
+    if (vendor != SAMSUNG_VENDOR || product != PRODUCT) {
+        ftdi->error_str = "simulated device not found";
+        return -3;
+    }
+
+    for (size_t i = 0; i < simDevices.size(); i++) {
+        if (!isPlugged(simDevices[i]))
+            continue;
+        if (busnum >= 0 && (busnum != SIM_BUSNUM || (size_t)devnum != i + 1))
+            continue;
+        // libftdi reads the serial string of every device it passes by
+        if (serial != NULL)
+            *transfers += SIM_STRING_TRANSFERS;
+        if (serial != NULL && simDevices[i].serial != serial)
+            continue;
+        if (index-- > 0)
+            continue;
+
+        for (std::map<struct ftdi_context *, size_t>::iterator it = simOpen.begin(); it != simOpen.end(); ++it) {
+            if (it->second == i) {
+                ftdi->error_str = "simulated device already open";
+                return -8;
+            }
+        }
+        simOpen[ftdi] = i;
+        return i;
+    }
+
+    ftdi->error_str = "simulated device not found";
+    return -3;
+}
+
+static int simOpenBusAddr(struct ftdi_context *ftdi, int busnum, int devnum) {
+    int transfers, f;
+
+    f = simFindDevice(ftdi, SAMSUNG_VENDOR, PRODUCT, busnum, devnum, NULL, 0, &transfers);
+    transfer(transfers + (f >= 0 ? SIM_OPEN_TRANSFERS : 0));
+
+    return f < 0 ? f : 0;
+}
+
+static int simOpenDescIndex(struct ftdi_context *ftdi, int vendor, int product, const char *serial,
+                            unsigned int index) {
+    int transfers, f;
+
+    f = simFindDevice(ftdi, vendor, product, -1, -1, serial, index, &transfers);
+    transfer(transfers + (f >= 0 ? SIM_OPEN_TRANSFERS : 0));
+
+    return f < 0 ? f : 0;
+}
+
+static int simGetPort(struct ftdi_context *ftdi, char *port, size_t size, int *busnum, int *devnum) {
+    std::lock_guard<std::mutex> lock(simMutex);
+    std::map<struct ftdi_context *, size_t>::iterator it = simOpen.find(ftdi);
+
+    if (it == simOpen.end())
+        return -1;
+
+    *busnum = SIM_BUSNUM;
+    *devnum = it->second + 1;
+    snprintf(port, size, "%d-%d", *busnum, *devnum);
+
+    return 0;
+}
+
+static int simReadProduct(struct ftdi_context *ftdi, char *product, int len) {
+    transfer(SIM_STRING_TRANSFERS);
+
+    std::lock_guard<std::mutex> lock(simMutex);
+    CCSimDevice *dev = findOpen(ftdi);
+
+    if (dev == NULL)
+        return -1;
+
+    return snprintf(product, len, "%s", getTypeName(dev->deviceType));
+}
+
+static int simReadEeprom(struct ftdi_context *ftdi) {
+    transfer(SIM_EEPROM_TRANSFERS);
+
+    std::lock_guard<std::mutex> lock(simMutex);
+
+    return findOpen(ftdi) != NULL ? 0 : -1;
+}
+
+static int simDecodeEeprom(struct ftdi_context *ftdi) {
+    std::lock_guard<std::mutex> lock(simMutex);
+
+    return findOpen(ftdi) != NULL ? 0 : -1;
+}
+
+static int simGetEepromProduct(struct ftdi_context *ftdi, char *product, int len) {
+    std::lock_guard<std::mutex> lock(simMutex);
+    CCSimDevice *dev = findOpen(ftdi);
+
+    if (dev == NULL)
+        return -1;
+
+    snprintf(product, len, "%s", getTypeName(dev->deviceType));
+    return 0;
+}
+
+static int simSetBitmode(struct ftdi_context *ftdi, unsigned char mask, unsigned char mode) {
+    transfer(1);
+
+    std::lock_guard<std::mutex> lock(simMutex);
+    CCSimDevice *dev = findOpen(ftdi);
+
+    if (dev == NULL)
+        return -1;
+
+    dev->mode = mode;
+    if (mode == BITMODE_CBUS) {
+        dev->cbus = mask;
+        dev->cbusSet = true;
+    }
+
+    return 0;
+}
+
+static int simReadPins(struct ftdi_context *ftdi, unsigned char *pins) {
+    transfer(1);
+
+    std::lock_guard<std::mutex> lock(simMutex);
+    CCSimDevice *dev = findOpen(ftdi);
+
+    if (dev == NULL)
+        return -1;
+
+    if (dev->deviceType == CCDT_SDMUX)
+        *pins = dev->data;
+    else
+        *pins = dev->cbusSet ? dev->cbus & 0x0f : 0xff;
+
+    return 0;
+}
+
+static int simReadData(struct ftdi_context *ftdi, unsigned char *pins) {
+    return simReadPins(ftdi, pins) < 0 ? -1 : 1;
+}
+
+static int simWriteData(struct ftdi_context *ftdi, unsigned char pins) {
+    transfer(1);
+
+    std::lock_guard<std::mutex> lock(simMutex);
+    CCSimDevice *dev = findOpen(ftdi);
+
+    if (dev == NULL)
+        return -1;
+
+    // Outside of bitbang mode the byte goes out through the UART and pins stay as they are
+    if (dev->mode == BITMODE_BITBANG)
+        dev->data = pins;
+
+    return 1;
+}
+
+static void simCloseUsb(struct ftdi_context *ftdi) {
+    size_t closed;
+
+    simMutex.lock();
+    closed = simOpen.erase(ftdi);
+    simMutex.unlock();
+
+    if (closed > 0)
+        transfer(1);
+}
+
+static int simWatch(int vendor, int product, CCHotplugCallback callback) {
+    std::lock_guard<std::mutex> lock(simMutex);
+
+    initDevices();
+    if (vendor != SAMSUNG_VENDOR || product != PRODUCT)
+        return -1;
+
+    simTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (simTimerFd < 0)
+        return -1;
+
+    // Devices plugged in already are not announced, just like with libusb
+    for (size_t i = 0; i < simDevices.size(); i++)
+        simDevices[i].reported = isPlugged(simDevices[i]);
+    simCallback = callback;
+
+    return 0;
+}
+
+// Must be called with simMutex held
+static void armTimer() {
+    struct itimerspec its;
+    double next = -1;
+
+    for (size_t i = 0; i < simDevices.size(); i++) {
+        if (!simDevices[i].reported && (next < 0 || simDevices[i].plugTime < next))
+            next = simDevices[i].plugTime;
+    }
+
+    memset(&its, 0, sizeof(its));
+    if (next >= 0) {
+        // Zero would disarm the timer
+        its.it_value.tv_sec = (time_t)(next / 1000);
+        its.it_value.tv_nsec = (long)((next - its.it_value.tv_sec * 1000.0) * 1000000) + 1;
+    }
+    timerfd_settime(simTimerFd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static int simGetEventFds(std::vector<struct pollfd> &fds) {
+    std::lock_guard<std::mutex> lock(simMutex);
+    struct pollfd pfd;
+
+    armTimer();
+    pfd.fd = simTimerFd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    fds.push_back(pfd);
+
+    return 0;
+}
+
+static int simHandleEvents(int timeoutMs) {
+    std::vector<CCUsbDevice> plugged;
+    struct pollfd pfd;
+    uint64_t expirations;
+
+    simMutex.lock();
+    armTimer();
+    simMutex.unlock();
+
+    pfd.fd = simTimerFd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, timeoutMs) > 0 && read(simTimerFd, &expirations, sizeof(expirations)) < 0)
+        return -1;
+
+    simMutex.lock();
+    for (size_t i = 0; i < simDevices.size(); i++) {
+        if (!simDevices[i].reported && isPlugged(simDevices[i])) {
+            CCUsbDevice dev;
+
+            describeDevice(i, &dev);
+            plugged.push_back(dev);
+            simDevices[i].reported = true;
+        }
+    }
+    simMutex.unlock();
+
+    for (size_t i = 0; i < plugged.size(); i++)
+        simCallback(&plugged[i], true);
+
+    return 0;
+}
+
+static void simUnwatch() {
+    if (simTimerFd >= 0)
+        close(simTimerFd);
+    simTimerFd = -1;
+}
+
+const CCBackend simBackend = {
+    "sim",
+    true,
+    simEnumerate,
+    simOpenBusAddr,
+    simOpenDescIndex,
+    simGetPort,
+    simReadProduct,
+    simReadEeprom,
+    simDecodeEeprom,
+    simGetEepromProduct,
+    simSetBitmode,
+    simReadData,
+    simReadPins,
+    simWriteData,
+    simCloseUsb,
+    simWatch,
+    simGetEventFds,
+    simHandleEvents,
+    simUnwatch,
+};
@@ -0,0 +1,164 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/sysfs.cpp
+ * @brief       Access to USB devices exported through sysfs
+ *
+ * Kernel reads string descriptors once on enumeration and exports them along with the port topology, so devices
+ * may be listed without opening them. Root of the sysfs tree may be changed with SDMUX_SYSFS_ROOT environment
+ * variable, which allows running against a fake tree.
+ */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "sysfs.h"
+
+const char *getSysfsRoot() {
+    const char *root = getenv(SDMUX_SYSFS_ROOT_ENV);
+
+    if (root == NULL || *root == '\0')
+        root = SYSFS_DEFAULT_ROOT;
+
+    return root;
+}
+
+int readSysfsAttribute(const char *attr, char *buf, size_t len) {
+    char path[256];
+    ssize_t n;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/%s", getSysfsRoot(), attr);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return EXIT_FAILURE;
+
+    n = read(fd, buf, len - 1);
+    close(fd);
+    if (n < 0)
+        return EXIT_FAILURE;
+
+    while (n > 0 && (buf[n - 1] == '\n' || buf[n - 1] == ' '))
+        n--;
+    buf[n] = '\0';
+
+    return EXIT_SUCCESS;
+}
+
+int readUsbAttribute(const char *port, const char *attr, char *buf, size_t len) {
+    char path[256];
+
+    snprintf(path, sizeof(path), "%s/%s/%s", SYSFS_USB_DEVICES, port, attr);
+
+    return readSysfsAttribute(path, buf, len);
+}
+
+int readUsbAttributeInt(const char *port, const char *attr, int base, int *value) {
+    char buf[32], *end;
+
+    if (readUsbAttribute(port, attr, buf, sizeof(buf)) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    *value = (int)strtol(buf, &end, base);
+    if (end == buf)
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+void getParentPort(const char *port, char *parent, size_t len) {
+    const char *dot = strrchr(port, '.');
+
+    if (dot != NULL) {
+        snprintf(parent, len, "%.*s", (int)(dot - port), port);
+    } else {
+        snprintf(parent, len, "usb%d", atoi(port));
+    }
+}
+
+// Orders ports numerically level by level, so "1-2.10" comes after "1-2.9"
+bool compareUsbPorts(const CCUsbDevice &a, const CCUsbDevice &b) {
+    const char *pa = a.port, *pb = b.port;
+
+    while (*pa != '\0' && *pb != '\0') {
+        char *ea, *eb;
+        long na = strtol(pa, &ea, 10), nb = strtol(pb, &eb, 10);
+        if (na != nb)
+            return na < nb;
+        pa = *ea != '\0' ? ea + 1 : ea;
+        pb = *eb != '\0' ? eb + 1 : eb;
+    }
+
+    return *pa == '\0' && *pb != '\0';
+}
+
+int readUsbDevice(const char *port, CCUsbDevice *dev) {
+    if (strlen(port) >= sizeof(dev->port))
+        return EXIT_FAILURE;
+
+    strcpy(dev->port, port);
+    if (readUsbAttributeInt(dev->port, "idVendor", 16, &dev->vendor) != EXIT_SUCCESS
+            || readUsbAttributeInt(dev->port, "idProduct", 16, &dev->product) != EXIT_SUCCESS
+            || readUsbAttributeInt(dev->port, "busnum", 10, &dev->busnum) != EXIT_SUCCESS
+            || readUsbAttributeInt(dev->port, "devnum", 10, &dev->devnum) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    if (readUsbAttribute(dev->port, "manufacturer", dev->manufacturer, sizeof(dev->manufacturer)) != EXIT_SUCCESS)
+        dev->manufacturer[0] = '\0';
+    if (readUsbAttribute(dev->port, "product", dev->description, sizeof(dev->description)) != EXIT_SUCCESS)
+        dev->description[0] = '\0';
+    if (readUsbAttribute(dev->port, "serial", dev->serial, sizeof(dev->serial)) != EXIT_SUCCESS)
+        dev->serial[0] = '\0';
+
+    return EXIT_SUCCESS;
+}
+
+int enumerateUsbDevices(int vendor, int product, std::vector<CCUsbDevice> &devices) {
+    char path[256];
+    struct dirent *entry;
+    CCUsbDevice dev;
+    DIR *dir;
+
+    snprintf(path, sizeof(path), "%s/%s", getSysfsRoot(), SYSFS_USB_DEVICES);
+    dir = opendir(path);
+    if (dir == NULL)
+        return EXIT_FAILURE;
+
+    while ((entry = readdir(dir)) != NULL) {
+        // Skip root hubs ("usbN"), interfaces ("1-2:1.0") and dot entries
+        if (!isdigit(entry->d_name[0]) || strchr(entry->d_name, ':') != NULL)
+            continue;
+
+        if (readUsbDevice(entry->d_name, &dev) != EXIT_SUCCESS)
+            continue;
+        if (dev.vendor != vendor || dev.product != product)
+            continue;
+
+        devices.push_back(dev);
+    }
+    closedir(dir);
+
+    std::sort(devices.begin(), devices.end(), compareUsbPorts);
+
+    return EXIT_SUCCESS;
+}
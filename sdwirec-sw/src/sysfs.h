@@ -0,0 +1,56 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/sysfs.h
+ * @brief       Access to USB devices exported through sysfs
+ */
+
+#ifndef SDMUXCTRL_SYSFS_H
+#define SDMUXCTRL_SYSFS_H
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "common.h"
+
+#define SDMUX_SYSFS_ROOT_ENV    "SDMUX_SYSFS_ROOT"
+#define SYSFS_DEFAULT_ROOT      "/sys"
+#define SYSFS_USB_DEVICES       "bus/usb/devices"
+
+#define PORT_PATH_SIZE          32
+
+struct CCUsbDevice {
+    char port[PORT_PATH_SIZE];
+    int busnum;
+    int devnum;
+    int vendor;
+    int product;
+    char manufacturer[STRING_SIZE + 1];
+    char description[STRING_SIZE + 1];
+    char serial[STRING_SIZE + 1];
+};
+
+const char *getSysfsRoot();
+int readSysfsAttribute(const char *attr, char *buf, size_t len);
+int readUsbAttribute(const char *port, const char *attr, char *buf, size_t len);
+int readUsbAttributeInt(const char *port, const char *attr, int base, int *value);
+int readUsbDevice(const char *port, CCUsbDevice *dev);
+int enumerateUsbDevices(int vendor, int product, std::vector<CCUsbDevice> &devices);
+bool compareUsbPorts(const CCUsbDevice &a, const CCUsbDevice &b);
+void getParentPort(const char *port, char *parent, size_t len);
+
+#endif // SDMUXCTRL_SYSFS_H
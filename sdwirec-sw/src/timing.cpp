@@ -0,0 +1,131 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/timing.cpp
+ * @brief       Time measurement helpers
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "json.h"
+#include "timing.h"
+
+static const char *phaseNames[CCP_MAX] = { "enumerate", "open", "detect", "bitmode", "write", "read", "close",
+                                           "eeprom", "delay", "daemon", "blockdev", "flash" };
+
+static thread_local std::vector<CCPhaseTime> *phaseLog = NULL;
+
+double getTimeMs() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+const char *getPhaseName(CCPhase phase) {
+    return phase < CCP_MAX ? phaseNames[phase] : "unknown";
+}
+
+std::vector<CCPhaseTime> *getPhaseLog() {
+    return phaseLog;
+}
+
+void setPhaseLog(std::vector<CCPhaseTime> *log) {
+    phaseLog = log;
+}
+
+void recordPhase(CCPhase phase, double start) {
+    CCPhaseTime entry;
+
+    if (phaseLog == NULL)
+        return;
+
+    entry.phase = phase;
+    entry.start = start;
+    entry.end = getTimeMs();
+    phaseLog->push_back(entry);
+}
+
+void printPhaseFields(FILE *out, const std::vector<CCPhaseTime> &phases, double start, double end) {
+    fprintf(out, "\"total_ms\": %.3f, \"phases\": [", end - start);
+    for (size_t i = 0; i < phases.size(); i++) {
+        fprintf(out, "%s{\"phase\": \"%s\", \"start_ms\": %.3f, \"duration_ms\": %.3f}", i ? ", " : "",
+                getPhaseName(phases[i].phase), phases[i].start - start, phases[i].end - phases[i].start);
+    }
+    fprintf(out, "]");
+}
+
+void printPhases(FILE *out, const char *device, const std::vector<CCPhaseTime> &phases, double start, double end,
+                 bool json) {
+    if (json) {
+        fprintf(out, "{");
+        if (device != NULL) {
+            fprintf(out, "\"device\": ");
+            printJsonString(out, device);
+            fprintf(out, ", ");
+        }
+        printPhaseFields(out, phases, start, end);
+        fprintf(out, "}\n");
+        return;
+    }
+
+    if (device != NULL)
+        fprintf(out, "%s:\n", device);
+    fprintf(out, "%-10s  %10s  %13s\n", "Phase", "Start [ms]", "Duration [ms]");
+    for (size_t i = 0; i < phases.size(); i++) {
+        fprintf(out, "%-10s  %10.3f  %13.3f\n", getPhaseName(phases[i].phase), phases[i].start - start,
+                phases[i].end - phases[i].start);
+    }
+    fprintf(out, "%-10s  %10s  %13.3f\n", "total", "", end - start);
+}
+
+void logPhases(const char *command, const char *device, int rc, const std::vector<CCPhaseTime> &phases,
+               double start, double end) {
+    const char *path = getenv(SDMUX_TIMINGS_LOG_ENV);
+    struct timespec now;
+    char *line;
+    size_t len;
+    FILE *out;
+    int fd;
+
+    if (path == NULL || *path == '\0')
+        return;
+
+    out = open_memstream(&line, &len);
+    if (out == NULL)
+        return;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    fprintf(out, "{\"time\": %ld.%03ld, \"command\": ", (long)now.tv_sec, now.tv_nsec / 1000000);
+    printJsonString(out, command);
+    fprintf(out, ", \"device\": ");
+    printJsonString(out, device);
+    fprintf(out, ", \"rc\": %d, ", rc);
+    printPhaseFields(out, phases, start, end);
+    fprintf(out, "}\n");
+    fclose(out);
+
+    // Each record goes out in a single write, so records of concurrent processes do not interleave
+    fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0 || write(fd, line, len) != (ssize_t)len)
+        fprintf(stderr, "Unable to write timings to %s\n", path);
+    if (fd >= 0)
+        close(fd);
+    free(line);
+}
@@ -0,0 +1,70 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/timing.h
+ * @brief       Time measurement helpers
+ */
+
+#ifndef SDMUXCTRL_TIMING_H
+#define SDMUXCTRL_TIMING_H
+
+#include <stdio.h>
+
+#include <vector>
+
+#define SDMUX_TIMINGS_LOG_ENV   "SDMUX_TIMINGS_LOG"
+
+enum CCPhase {
+    CCP_Enumerate = 0,
+    CCP_Open,
+    CCP_Detect,
+    CCP_Bitmode,
+    CCP_Write,
+    CCP_Read,
+    CCP_Close,
+    CCP_Eeprom,
+    CCP_Delay,          // Deliberate wait between steps of a switching sequence
+    CCP_Daemon,         // Request passed to sd-mux-ctrld
+    CCP_Blockdev,       // Waiting for the card reader to show up
+    CCP_Flash,          // Writing an image to the card
+    CCP_MAX
+};
+
+struct CCPhaseTime {
+    CCPhase phase;
+    double start;
+    double end;
+};
+
+double getTimeMs();
+
+/*
+ * Phases are recorded only in threads which have set a log with setPhaseLog(). Call sites measure the phase with
+ * getTimeMs() before the operation and pass it to recordPhase() right after it.
+ */
+const char *getPhaseName(CCPhase phase);
+std::vector<CCPhaseTime> *getPhaseLog();
+void setPhaseLog(std::vector<CCPhaseTime> *log);
+void recordPhase(CCPhase phase, double start);
+
+// Phases are reported relative to start of the command. Device is optional.
+void printPhaseFields(FILE *out, const std::vector<CCPhaseTime> &phases, double start, double end);
+void printPhases(FILE *out, const char *device, const std::vector<CCPhaseTime> &phases, double start, double end,
+                 bool json);
+void logPhases(const char *command, const char *device, int rc, const std::vector<CCPhaseTime> &phases,
+               double start, double end);
+
+#endif // SDMUXCTRL_TIMING_H
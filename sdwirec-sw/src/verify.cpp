@@ -0,0 +1,250 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/verify.cpp
+ * @brief       Verification of flashed cards by reading them back
+ *
+ * Card is read with O_DIRECT, so the data comes from the card and not from the page cache filled while writing it.
+ * Reads of VERIFY_QUEUE_DEPTH buffers are submitted with kernel AIO, so the next buffer is read while the previous one
+ * is hashed on all cores. Without O_DIRECT the cached pages of the card are dropped first.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "aio.h"
+#include "image.h"
+#include "verify.h"
+
+struct CCVerifyReader {
+    const char *target;
+    int fd;
+    aio_context_t aio;
+    bool async;
+    unsigned char *buffers[VERIFY_QUEUE_DEPTH];
+    struct iocb cbs[VERIFY_QUEUE_DEPTH];
+    uint64_t size;
+};
+
+void initVerifyMap(CCVerifyMap *map, size_t blockSize) {
+    // Each block of a chunk needs a bit of the skip mask
+    map->blockSize = blockSize;
+    map->chunkSize = HASH_MAX_CHUNK_BLOCKS * blockSize < VERIFY_CHUNK_SIZE ? HASH_MAX_CHUNK_BLOCKS * blockSize
+                                                                          : VERIFY_CHUNK_SIZE;
+    map->hashes.clear();
+    map->skipped.clear();
+}
+
+void recordVerifyHashes(CCVerifyMap *map, CCHashPool *pool, const unsigned char *data, size_t len, uint64_t offset,
+                        const uint64_t *skipped, const uint64_t *known) {
+    size_t first = offset / map->chunkSize, count = (len + map->chunkSize - 1) / map->chunkSize;
+
+    map->hashes.resize(first + count);
+    map->skipped.resize(first + count);
+    memcpy(&map->skipped[first], skipped, count * sizeof(uint64_t));
+
+    for (size_t c = 0; c < count && known != NULL; c++) {
+        if (skipped[c] != 0)
+            known = NULL;
+    }
+    if (known != NULL)
+        memcpy(&map->hashes[first], known, count * sizeof(uint64_t));
+    else
+        hashChunks(pool, data, len, map->chunkSize, &map->hashes[first], &map->skipped[first], map->blockSize);
+}
+
+static int openReader(const char *target, uint64_t size, CCVerifyReader *reader) {
+    reader->target = target;
+    reader->size = size;
+    reader->fd = open(target, O_RDONLY | O_DIRECT | O_CLOEXEC);
+    if (reader->fd < 0 && errno == EINVAL) {
+        reader->fd = open(target, O_RDONLY | O_CLOEXEC);
+        if (reader->fd >= 0)
+            posix_fadvise(reader->fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    if (reader->fd < 0) {
+        fprintf(stderr, "Unable to open %s: %s\n", target, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < VERIFY_QUEUE_DEPTH; i++) {
+        if (posix_memalign((void **)&reader->buffers[i], IMAGE_ALIGNMENT, IMAGE_BUFFER_SIZE) != 0) {
+            reader->buffers[i] = NULL;
+            fprintf(stderr, "Unable to allocate verification buffers\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    reader->aio = 0;
+    reader->async = ioSetup(VERIFY_QUEUE_DEPTH, &reader->aio) == 0;
+    if (!reader->async)
+        reader->aio = 0;
+
+    return EXIT_SUCCESS;
+}
+
+static void closeReader(CCVerifyReader *reader) {
+    if (reader->aio != 0)
+        ioDestroy(reader->aio);
+    for (int i = 0; i < VERIFY_QUEUE_DEPTH; i++)
+        free(reader->buffers[i]);
+    if (reader->fd >= 0)
+        close(reader->fd);
+}
+
+// Reads are rounded up to the alignment of O_DIRECT, data beyond the image is not compared
+static size_t getReadLen(CCVerifyReader *reader, uint64_t offset) {
+    uint64_t len = reader->size - offset < IMAGE_BUFFER_SIZE ? reader->size - offset : IMAGE_BUFFER_SIZE;
+
+    return (len + IMAGE_ALIGNMENT - 1) / IMAGE_ALIGNMENT * IMAGE_ALIGNMENT;
+}
+
+// Read is not submitted if the target does not support AIO, it is done synchronously by waitRead() then
+static int submitRead(CCVerifyReader *reader, uint64_t offset, int i, bool *submitted) {
+    struct iocb *cb = &reader->cbs[i];
+
+    *submitted = false;
+    if (!reader->async)
+        return EXIT_SUCCESS;
+
+    memset(cb, 0, sizeof(*cb));
+    cb->aio_data = i;
+    cb->aio_lio_opcode = IOCB_CMD_PREAD;
+    cb->aio_fildes = reader->fd;
+    cb->aio_buf = (__u64)(uintptr_t)reader->buffers[i];
+    cb->aio_nbytes = getReadLen(reader, offset);
+    cb->aio_offset = offset;
+
+    if (ioSubmit(reader->aio, 1, &cb) == 1) {
+        *submitted = true;
+        return EXIT_SUCCESS;
+    }
+
+    if (errno == EINVAL) {
+        reader->async = false;
+        return EXIT_SUCCESS;
+    }
+
+    fprintf(stderr, "Unable to submit read of %s: %s\n", reader->target, strerror(errno));
+    return EXIT_FAILURE;
+}
+
+static ssize_t waitRead(CCVerifyReader *reader, uint64_t offset, int i, bool submitted) {
+    struct io_event event;
+    size_t len = getReadLen(reader, offset), done = 0;
+    ssize_t n;
+    int ret;
+
+    if (submitted) {
+        do {
+            ret = ioGetEvents(reader->aio, 1, 1, &event);
+        } while (ret < 0 && errno == EINTR);
+        if (ret != 1)
+            return -1;
+        if (event.res < 0)
+            errno = -event.res;
+        return event.res;
+    }
+
+    while (done < len) {
+        n = pread(reader->fd, reader->buffers[i] + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        done += n;
+    }
+
+    return done;
+}
+
+static int compareChunks(const CCVerifyMap *map, CCHashPool *pool, const unsigned char *data, size_t len,
+                         uint64_t offset, std::vector<uint64_t> &hashes, const char *target) {
+    size_t first = offset / map->chunkSize, count = (len + map->chunkSize - 1) / map->chunkSize;
+
+    hashes.resize(count);
+    hashChunks(pool, data, len, map->chunkSize, &hashes[0], &map->skipped[first], map->blockSize);
+
+    for (size_t c = 0; c < count; c++) {
+        if (hashes[c] != map->hashes[first + c]) {
+            fprintf(stderr, "Verification of %s failed: %llu bytes at offset %llu differ from the image\n", target,
+                    (unsigned long long)(len - c * map->chunkSize < map->chunkSize ? len - c * map->chunkSize
+                                                                                    : map->chunkSize),
+                    (unsigned long long)((first + c) * map->chunkSize));
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int verifyCard(const char *target, uint64_t start, uint64_t size, const CCVerifyMap *map, CCHashPool *pool) {
+    std::vector<uint64_t> hashes;
+    CCVerifyReader reader;
+    uint64_t offset = start, len;
+    int ret = EXIT_FAILURE, i = 0;
+    bool pending = false;
+    ssize_t n;
+
+    memset(&reader, 0, sizeof(reader));
+    reader.fd = -1;
+
+    if (openReader(target, size, &reader) != EXIT_SUCCESS)
+        goto finish_him;
+
+    if (start < size && submitRead(&reader, start, 0, &pending) != EXIT_SUCCESS)
+        goto finish_him;
+
+    for (; offset < size; offset += IMAGE_BUFFER_SIZE, i = (i + 1) % VERIFY_QUEUE_DEPTH) {
+        len = size - offset < IMAGE_BUFFER_SIZE ? size - offset : IMAGE_BUFFER_SIZE;
+
+        n = waitRead(&reader, offset, i, pending);
+        pending = false;
+        if (n < 0) {
+            fprintf(stderr, "Unable to read %s at offset %llu: %s\n", target, (unsigned long long)offset,
+                    strerror(errno));
+            goto finish_him;
+        }
+        if ((uint64_t)n < len) {
+            fprintf(stderr, "Verification of %s failed: it ends at offset %llu, before the end of the image\n", target,
+                    (unsigned long long)(offset + n));
+            goto finish_him;
+        }
+
+        // Next buffer is read while this one is hashed
+        if (offset + IMAGE_BUFFER_SIZE < size
+                && submitRead(&reader, offset + IMAGE_BUFFER_SIZE, (i + 1) % VERIFY_QUEUE_DEPTH, &pending)
+                != EXIT_SUCCESS)
+            goto finish_him;
+
+        if (compareChunks(map, pool, reader.buffers[i], len, offset, hashes, target) != EXIT_SUCCESS)
+            goto finish_him;
+    }
+    ret = EXIT_SUCCESS;
+
+finish_him:
+    // Buffer of a read in flight must not be freed
+    if (pending)
+        waitRead(&reader, offset, i, true);
+    closeReader(&reader);
+
+    return ret;
+}
@@ -0,0 +1,56 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/verify.h
+ * @brief       Verification of flashed cards by reading them back
+ */
+
+#ifndef SDMUXCTRL_VERIFY_H
+#define SDMUXCTRL_VERIFY_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "hashpool.h"
+
+#define VERIFY_QUEUE_DEPTH      2       // Buffers read at once, one is hashed while the other one is read
+#define VERIFY_CHUNK_SIZE       (256 << 10)
+
+// Hashes of image chunks computed while writing, blocks skipped by --bmap or --sparse are left out of them
+struct CCVerifyMap {
+    size_t chunkSize;
+    size_t blockSize;
+    std::vector<uint64_t> hashes;
+    std::vector<uint64_t> skipped;
+};
+
+void initVerifyMap(CCVerifyMap *map, size_t blockSize);
+/*
+ * Buffers of the image are recorded in order, offset must be a multiple of the chunk size. Hashes of the chunks may be
+ * known already, they are used if no block of the buffer is skipped.
+ */
+void recordVerifyHashes(CCVerifyMap *map, CCHashPool *pool, const unsigned char *data, size_t len, uint64_t offset,
+                        const uint64_t *skipped, const uint64_t *known);
+
+/*
+ * Reads the card back from start, a multiple of IMAGE_BUFFER_SIZE, up to size bypassing the page cache and compares
+ * hashes of its chunks with the map. The first chunk which differs is reported.
+ */
+int verifyCard(const char *target, uint64_t start, uint64_t size, const CCVerifyMap *map, CCHashPool *pool);
+
+#endif // SDMUXCTRL_VERIFY_H
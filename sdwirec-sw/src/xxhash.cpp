@@ -0,0 +1,111 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        src/xxhash.cpp
+ * @brief       XXH64 hash for comparing chunks of images and cards
+ *
+ * Implementation of the XXH64 algorithm by Yann Collet. Its four independent lanes keep the CPU busy well beyond the
+ * speed of any card reader, so no SIMD specific code is needed.
+ */
+
+#include <string.h>
+
+#include "xxhash.h"
+
+static const uint64_t prime1 = 11400714785074694791ULL;
+static const uint64_t prime2 = 14029467366897019727ULL;
+static const uint64_t prime3 = 1609587929392839161ULL;
+static const uint64_t prime4 = 9650029242287828579ULL;
+static const uint64_t prime5 = 2870177450012600261ULL;
+
+static inline uint64_t rotl(uint64_t x, int n) {
+    return (x << n) | (x >> (64 - n));
+}
+
+// Little endian loads, memcpy keeps them safe for unaligned data
+static inline uint64_t read64(const unsigned char *p) {
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint32_t read32(const unsigned char *p) {
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline uint64_t mixLane(uint64_t acc, uint64_t input) {
+    acc += input * prime2;
+    acc = rotl(acc, 31);
+    return acc * prime1;
+}
+
+static inline uint64_t mergeLane(uint64_t acc, uint64_t val) {
+    acc ^= mixLane(0, val);
+    return acc * prime1 + prime4;
+}
+
+uint64_t xxh64(const void *data, size_t len, uint64_t seed) {
+    const unsigned char *p = (const unsigned char *)data, *end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = seed + prime1 + prime2, v2 = seed + prime2, v3 = seed, v4 = seed - prime1;
+
+        for (; p + 32 <= end; p += 32) {
+            v1 = mixLane(v1, read64(p));
+            v2 = mixLane(v2, read64(p + 8));
+            v3 = mixLane(v3, read64(p + 16));
+            v4 = mixLane(v4, read64(p + 24));
+        }
+
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = mergeLane(h, v1);
+        h = mergeLane(h, v2);
+        h = mergeLane(h, v3);
+        h = mergeLane(h, v4);
+    } else {
+        h = seed + prime5;
+    }
+
+    h += len;
+
+    for (; p + 8 <= end; p += 8)
+        h = rotl(h ^ mixLane(0, read64(p)), 27) * prime1 + prime4;
+    if (p + 4 <= end) {
+        h = rotl(h ^ (read32(p) * prime1), 23) * prime2 + prime3;
+        p += 4;
+    }
+    for (; p < end; p++)
+        h = rotl(h ^ (*p * prime5), 11) * prime1;
+
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+
+    return h;
+}
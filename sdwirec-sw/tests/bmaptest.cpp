@@ -0,0 +1,111 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        tests/bmaptest.cpp
+ * @brief       Parsing of bmaptool block maps
+ */
+
+#include <string.h>
+
+#include <string>
+
+#include "bmap.h"
+#include "test.h"
+
+#define BMAP_FILE_CHECKSUM  "6375a86f02c6879cd474d90ea3b7c78a68ad2ca95b62e5c629e5da8563cb0ee5"
+
+// Block map of a 10000 byte image with the first and the last block mapped, as written by bmaptool 3.x
+static const char *bmapV2 =
+    "<?xml version=\"1.0\" ?>\n"
+    "<bmap version=\"2.0\">\n"
+    "    <ImageSize> 10000 </ImageSize>\n"
+    "    <BlockSize> 4096 </BlockSize>\n"
+    "    <BlocksCount> 3 </BlocksCount>\n"
+    "    <MappedBlocksCount> 2 </MappedBlocksCount>\n"
+    "    <ChecksumType> sha256 </ChecksumType>\n"
+    "    <BmapFileChecksum> " BMAP_FILE_CHECKSUM " </BmapFileChecksum>\n"
+    "    <BlockMap>\n"
+    "        <Range chksum=\"ad7facb2586fc6e966c004d7d1d16b024f5805ff7cb47c7a85dabd8b48892ca7\"> 0 </Range>\n"
+    "        <Range chksum=\"c354dea671ed22c50ebce8c975c09e0647f7728ac0199c53bafb77f186cbb503\"> 2 </Range>\n"
+    "    </BlockMap>\n"
+    "</bmap>\n";
+
+static const char *bmapV1 =
+    "<?xml version=\"1.0\" ?>\n"
+    "<bmap version=\"1.4\">\n"
+    "    <ImageSize> 40960 </ImageSize>\n"
+    "    <BlockSize> 4096 </BlockSize>\n"
+    "    <BlocksCount> 10 </BlocksCount>\n"
+    "    <BlockMap>\n"
+    "        <Range sha1=\"2fd4e1c67a2d28fced849ee1bb76e7391b93eb12\"> 1-3 </Range>\n"
+    "        <Range> 7-9 </Range>\n"
+    "    </BlockMap>\n"
+    "</bmap>\n";
+
+static int loadBmapText(const std::string &text, CCBmap *bmap) {
+    const char *path = getTestPath("image.bmap");
+
+    if (writeTestFile(path, text.data(), text.size()) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    return loadBmap(path, bmap);
+}
+
+static std::string replace(std::string text, const char *from, const char *to) {
+    size_t pos = text.find(from);
+
+    if (pos != std::string::npos)
+        text.replace(pos, strlen(from), to);
+
+    return text;
+}
+
+int testBmap() {
+    std::string corrupted;
+    CCBmap bmap;
+
+    CHECK(loadBmapText(bmapV2, &bmap) == EXIT_SUCCESS);
+    CHECK(bmap.imageSize == 10000 && bmap.blockSize == 4096 && bmap.blocksCount == 3);
+    CHECK(bmap.ranges.size() == 2);
+    CHECK(bmap.ranges[0].first == 0 && bmap.ranges[0].last == 0 && bmap.ranges[0].hasChecksum);
+    CHECK(bmap.ranges[0].checksum[0] == 0xad && bmap.ranges[0].checksum[SHA256_DIGEST_SIZE - 1] == 0xa7);
+    CHECK(bmap.ranges[1].first == 2 && bmap.ranges[1].last == 2);
+    // Last block is cut at the end of the image
+    CHECK(getBmapRangeStart(&bmap, &bmap.ranges[1]) == 8192 && getBmapRangeEnd(&bmap, &bmap.ranges[1]) == 10000);
+    CHECK(bmap.mappedBytes == 4096 + 1808);
+
+    // Any change of the file breaks its checksum
+    corrupted = replace(bmapV2, "> 2 </Range>", "> 1 </Range>");
+    CHECK(loadBmapText(corrupted, &bmap) != EXIT_SUCCESS);
+    corrupted = replace(bmapV2, BMAP_FILE_CHECKSUM, "0000");
+    CHECK(loadBmapText(corrupted, &bmap) != EXIT_SUCCESS);
+
+    // SHA-1 checksums are not verified
+    CHECK(loadBmapText(bmapV1, &bmap) == EXIT_SUCCESS);
+    CHECK(bmap.ranges.size() == 2 && !bmap.ranges[0].hasChecksum);
+    CHECK(bmap.ranges[0].first == 1 && bmap.ranges[0].last == 3);
+    CHECK(bmap.ranges[1].first == 7 && bmap.ranges[1].last == 9);
+    CHECK(bmap.mappedBytes == 6 * 4096);
+
+    CHECK(loadBmapText(replace(bmapV1, "7-9", "2-9"), &bmap) != EXIT_SUCCESS);
+    CHECK(loadBmapText(replace(bmapV1, "7-9", "7-10"), &bmap) != EXIT_SUCCESS);
+    CHECK(loadBmapText(replace(bmapV1, "7-9", "9-7"), &bmap) != EXIT_SUCCESS);
+    CHECK(loadBmapText(replace(bmapV1, "<BlockSize> 4096", "<BlockSize> 1000"), &bmap) != EXIT_SUCCESS);
+    CHECK(loadBmapText(replace(bmapV1, "<BlocksCount> 10", "<BlocksCount> 11"), &bmap) != EXIT_SUCCESS);
+    CHECK(loadBmapText("<bmap></bmap>", &bmap) != EXIT_SUCCESS);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,88 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        tests/cachetest.cpp
+ * @brief       Line files of the cache directory
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "pathcache.h"
+#include "test.h"
+
+#define TEST_FILE       "entries"
+
+static CCCacheEntry makeEntry(const char *serial, const char *port, int devnum, const char *value) {
+    CCCacheEntry entry;
+
+    strcpy(entry.serial, serial);
+    strcpy(entry.port, port);
+    entry.busnum = 1;
+    entry.devnum = devnum;
+    entry.value = value;
+
+    return entry;
+}
+
+int testCache() {
+    std::vector<CCCacheEntry> entries;
+    CCCacheEntry entry;
+    std::string content;
+
+    CHECK(setenv(SDMUX_CACHE_DIR_ENV, getTestPath("cache"), 1) == 0);
+
+    entry = makeEntry("sdw-1", "1-2.1", 5, "sd-wire");
+    updateCacheEntry(TEST_FILE, &entry, false);
+    entry = makeEntry("sdm-1", "1-2.2", 6, "0xf0");
+    updateCacheEntry(TEST_FILE, &entry, false);
+    readCacheEntries(TEST_FILE, entries);
+    CHECK(entries.size() == 2);
+    CHECK(strcmp(entries[0].serial, "sdw-1") == 0 && strcmp(entries[0].port, "1-2.1") == 0);
+    CHECK(entries[0].busnum == 1 && entries[0].devnum == 5 && entries[0].value == "sd-wire");
+    CHECK(strcmp(entries[1].serial, "sdm-1") == 0 && entries[1].value == "0xf0");
+
+    // Device taking the port of another one replaces its entry, as does the device itself
+    entry = makeEntry("sdw-2", "1-2.1", 7, "sd-wire");
+    updateCacheEntry(TEST_FILE, &entry, false);
+    entry = makeEntry("sdm-1", "1-2.3", 8, "0x0f");
+    updateCacheEntry(TEST_FILE, &entry, false);
+    entries.clear();
+    readCacheEntries(TEST_FILE, entries);
+    CHECK(entries.size() == 2);
+    CHECK(strcmp(entries[0].serial, "sdw-2") == 0 && entries[0].devnum == 7);
+    CHECK(strcmp(entries[1].port, "1-2.3") == 0 && entries[1].value == "0x0f");
+
+    entry = makeEntry("sdw-2", "1-2.1", 7, "");
+    updateCacheEntry(TEST_FILE, &entry, true);
+    entries.clear();
+    readCacheEntries(TEST_FILE, entries);
+    CHECK(entries.size() == 1 && strcmp(entries[0].serial, "sdm-1") == 0);
+
+    // Ports longer than the entry holds are skipped rather than cut
+    content = "sdw-3\t" + std::string(PORT_PATH_SIZE, '1') + " 1 9 sd-wire\n";
+    content += "sdw-4\t1-2.4 1 10 sd-wire\n";
+    content += "sdw-5\t1-2.5 1 11\n";
+    CHECK(writeTestFile(getTestPath("cache/" TEST_FILE), content.data(), content.size()) == EXIT_SUCCESS);
+    entries.clear();
+    readCacheEntries(TEST_FILE, entries);
+    CHECK(entries.size() == 1 && strcmp(entries[0].serial, "sdw-4") == 0 && entries[0].devnum == 10);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,272 @@
+#!/bin/sh
+#
+# Copyright (c) 2016 Samsung Electronics Co., Ltd All Rights Reserved
+#
+#    Licensed under the Apache License, Version 2.0 (the "License");
+#    you may not use this file except in compliance with the License.
+#    You may obtain a copy of the License at
+#
+#        http://www.apache.org/licenses/LICENSE-2.0
+#
+#    Unless required by applicable law or agreed to in writing, software
+#    distributed under the License is distributed on an "AS IS" BASIS,
+#    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#    See the License for the specific language governing permissions and
+#    limitations under the License.
+#
+# @file        tests/cli.sh
+# @brief       Tests of sd-mux-ctrl command line run against a fake sysfs tree
+#
+# Usage: cli.sh <path to sd-mux-ctrl> <test>
+#
+
+SDMUXCTRL=$1
+TEST=$2
+
+WORKDIR=$(mktemp -d "${TMPDIR:-/tmp}/sd-mux-ctrl-cli.XXXXXX") || exit 1
+trap 'rm -rf "$WORKDIR"' EXIT
+
+# Neither a running daemon nor caches of the host are used
+SDMUX_CTRL_SOCKET=$WORKDIR/none.sock
+SDMUX_CACHE_DIR=$WORKDIR/cache
+SDMUX_SYSFS_ROOT=$WORKDIR/sys
+export SDMUX_CTRL_SOCKET SDMUX_CACHE_DIR SDMUX_SYSFS_ROOT
+mkdir -p "$SDMUX_CACHE_DIR" "$SDMUX_SYSFS_ROOT/bus/usb/devices"
+
+fail() {
+    echo "$TEST: $*" >&2
+    exit 1
+}
+
+# Runs sd-mux-ctrl with the remaining arguments and compares its output with the first one
+expect() {
+    expected=$1
+    shift
+    actual=$("$SDMUXCTRL" "$@" 2>&1) || fail "sd-mux-ctrl $* failed: $actual"
+    [ "$actual" = "$expected" ] || fail "sd-mux-ctrl $*: expected \"$expected\", got \"$actual\""
+}
+
+expectFailure() {
+    "$SDMUXCTRL" "$@" >/dev/null 2>&1 && fail "sd-mux-ctrl $* should have failed"
+    return 0
+}
+
+# Like expectFailure, but also checks that the error message includes the first argument
+expectError() {
+    message=$1
+    shift
+    actual=$("$SDMUXCTRL" "$@" 2>&1) && fail "sd-mux-ctrl $* should have failed"
+    case "$actual" in
+    *"$message"*) ;;
+    *) fail "sd-mux-ctrl $*: expected \"$message\", got \"$actual\"" ;;
+    esac
+}
+
+# JSON results without their timing, which varies from run to run
+expectJson() {
+    expected=$1
+    shift
+    actual=$("$SDMUXCTRL" "$@" 2>&1 | sed 's/"time_ms": [0-9.]*, //')
+    [ "$actual" = "$expected" ] || fail "sd-mux-ctrl $*: expected \"$expected\", got \"$actual\""
+}
+
+expectBatch() {
+    expected=$1
+    shift
+    expectJson "$expected" "$@" --batch -
+}
+
+# Path of the device at the given port in the device tree, e.g. usb1/1-2/1-2.1 for 1-2.1
+getUsbPath() {
+    path=usb${1%%-*}
+    prefix=${1%%-*}-
+    rest=${1#*-}
+    sep=
+    while [ -n "$rest" ]; do
+        prefix=$prefix$sep${rest%%.*}
+        path=$path/$prefix
+        case "$rest" in
+        *.*) rest=${rest#*.} ;;
+        *) rest= ;;
+        esac
+        sep=.
+    done
+    echo "$path"
+}
+
+# addUsbDevice <port> <vendor> <product> <busnum> <devnum> <product string> <serial>
+addUsbDevice() {
+    dir=$SDMUX_SYSFS_ROOT/devices/$(getUsbPath "$1")
+    mkdir -p "$dir"
+    ln -s "$dir" "$SDMUX_SYSFS_ROOT/bus/usb/devices/$1"
+    echo "$2" > "$dir/idVendor"
+    echo "$3" > "$dir/idProduct"
+    echo "$4" > "$dir/busnum"
+    echo "$5" > "$dir/devnum"
+    echo "SRPOL" > "$dir/manufacturer"
+    echo "$6" > "$dir/product"
+    echo "$7" > "$dir/serial"
+}
+
+# addDisk <port of the USB mass storage device> <name> <size in sectors>, the disk gets one partition
+addDisk() {
+    dir=$SDMUX_SYSFS_ROOT/devices/$(getUsbPath "$1")/$1:1.0/host0/target0:0:0/0:0:0:0/block/$2
+    mkdir -p "$dir/${2}1" "$SDMUX_SYSFS_ROOT/class/block"
+    echo "$3" > "$dir/size"
+    printf 'MAJOR=8\nMINOR=0\nDEVNAME=%s\nDEVTYPE=disk\n' "$2" > "$dir/uevent"
+    ln -s "$dir" "$SDMUX_SYSFS_ROOT/class/block/$2"
+    echo "$3" > "$dir/${2}1/size"
+    echo 1 > "$dir/${2}1/partition"
+    ln -s "$dir/${2}1" "$SDMUX_SYSFS_ROOT/class/block/${2}1"
+}
+
+testListJson() {
+    addUsbDevice 1-2.10 04e8 6001 1 12 sd-wire sdw-10
+    addUsbDevice 1-2.9 04e8 6001 1 11 sd-mux sdm-9
+    addUsbDevice 1-2.8 0403 6001 1 10 "FT232R USB UART" other
+    addUsbDevice 2-1 04e8 6001 2 3 usb-mux um-1
+
+    expect '[
+  {"id": 0, "serial": "sdm-9", "manufacturer": "SRPOL", "product": "sd-mux", "type": "sd-mux", "bus": 1, "address": 11, "port": "1-2.9", "parent": "1-2", "ports": [2, 9]},
+  {"id": 1, "serial": "sdw-10", "manufacturer": "SRPOL", "product": "sd-wire", "type": "sd-wire", "bus": 1, "address": 12, "port": "1-2.10", "parent": "1-2", "ports": [2, 10]},
+  {"id": 2, "serial": "um-1", "manufacturer": "SRPOL", "product": "usb-mux", "type": "usb-mux", "bus": 2, "address": 3, "port": "2-1", "parent": "usb2", "ports": [1]}
+]' --list --format=json --direct
+    expect 'Number of FTDI devices found: 3
+Dev: 0, Manufacturer: SRPOL, Serial: sdm-9, Description: sd-mux
+Dev: 1, Manufacturer: SRPOL, Serial: sdw-10, Description: sd-wire
+Dev: 2, Manufacturer: SRPOL, Serial: um-1, Description: usb-mux' --list --direct
+    expect 'sdw-10' --show-serial -v 1 --direct
+    expect '[
+  {"id": 0, "serial": "other", "manufacturer": "SRPOL", "product": "FT232R USB UART", "type": null, "bus": 1, "address": 10, "port": "1-2.8", "parent": "1-2", "ports": [2, 8]}
+]' --list --format=json --direct --vendor=0x0403
+    expectFailure --list --format=xml --direct
+
+    rm "$SDMUX_SYSFS_ROOT/bus/usb/devices"/*
+    expect '[]' --list --format=json --direct
+}
+
+# Sequences of switching commands on simulated devices, whose state lasts as long as the process
+testSimSequences() {
+    SDMUX_BACKEND=sim
+    SDMUX_SIM_DEVICES=sd-mux:sdm-1,sd-wire:sdw-1,usb-mux:um-1
+    SDMUX_SIM_LATENCY=0
+    export SDMUX_BACKEND SDMUX_SIM_DEVICES SDMUX_SIM_LATENCY
+
+    expect 'Device not initialized!' -e sdm-1 --status
+    expect 'USB connected to: TS
+SD connected to: TS' -e sdm-1 --init --status
+    expect 'USB connected to: TS
+SD connected to: TS' -e sdm-1 --ts --status
+    expect 'USB connected to: DUT
+SD connected to: DUT' -e sdm-1 --ts --dut --status
+    expect 'USB connected to: DUT
+SD connected to: DUT' -e sdm-1 --tick -m 10 --status
+    expect 'SD connected to: TS' -e sdw-1 --ts --status
+    expect 'SD connected to: DUT' -e sdw-1 --dut --status
+    expect 'SD connected to: TS' -e um-1 --ts --status
+    expectFailure -e sdw-1 --tick
+    expectFailure -e missing --status
+
+    printf -- '--ts\n--status\nwait 10\n--dut --status\n--tick -m 20\n--status\n--status -e sdw-1\n' > "$WORKDIR/batch"
+    expectBatch '{"line": 1, "command": "--ts", "rc": 0, "output": ""}
+{"line": 2, "command": "--status", "rc": 0, "output": "USB connected to: TS\u000aSD connected to: TS\u000a"}
+{"line": 3, "command": "wait 10", "rc": 0, "output": ""}
+{"line": 4, "command": "--dut --status", "rc": 0, "output": "USB connected to: DUT\u000aSD connected to: DUT\u000a"}
+{"line": 5, "command": "--tick -m 20", "rc": 0, "output": ""}
+{"line": 6, "command": "--status", "rc": 0, "output": "USB connected to: DUT\u000aSD connected to: DUT\u000a"}
+{"line": 7, "command": "--status -e sdw-1", "rc": 0, "output": "SD connected to: TS\u000a"}' \
+        -e sdm-1 < "$WORKDIR/batch"
+
+    # Malformed wait fails its line instead of sleeping for whatever it happens to parse as
+    for wait in 'wait -5' 'wait abc' 'wait 10x' 'wait 99999999999'; do
+        echo "$wait" | expectBatch "Invalid wait time: $wait
+{\"line\": 1, \"command\": \"$wait\", \"rc\": 1, \"output\": \"\"}" -e sdm-1
+    done
+
+    # Results of all devices form a single stream of objects, one per command and device
+    expectJson '{"serial": "sdm-1", "rc": 0, "output": ""}
+{"serial": "sdw-1", "rc": 0, "output": ""}
+{"serial": "um-1", "rc": 0, "output": ""}
+{"serial": "sdm-1", "rc": 0, "output": "USB connected to: TS\u000aSD connected to: TS\u000a", "type": "sd-mux", "initialized": true, "sd": "TS", "usb": "TS", "dyper1": "off", "dyper2": "off"}
+{"serial": "sdw-1", "rc": 0, "output": "SD connected to: TS\u000a", "type": "sd-wire", "initialized": true, "sd": "TS", "usb": null, "dyper1": null, "dyper2": null}
+{"serial": "um-1", "rc": 0, "output": "SD connected to: TS\u000a", "type": "usb-mux", "initialized": true, "sd": null, "usb": "TS", "dyper1": null, "dyper2": null}' \
+        --all --ts --status --format=json
+}
+
+# Card reader is told apart from other disks by USB topology
+testBlockdev() {
+    # SDWire with a card inserted, a USB stick behind a hub chained to its internal hub and a card reader elsewhere
+    addUsbDevice 1-2.1 04e8 6001 1 5 sd-wire sdw-1
+    addUsbDevice 1-2.2 0424 4050 1 6 "Flash Card Reader" reader
+    addDisk 1-2.2 sdb 31116288
+    addUsbDevice 1-2.3 05e3 0608 1 7 "USB2.0 Hub" ""
+    addUsbDevice 1-2.3.1 0424 4050 1 8 "Flash Card Reader" other
+    addDisk 1-2.3.1 sdc 31116288
+    addUsbDevice 1-3 0424 4050 1 9 "Flash Card Reader" elsewhere
+    addDisk 1-3 sdg 31116288
+    expect '/dev/sdb' --wait-blockdev -e sdw-1 --timeout=1
+    expect '/dev/sdb' --wait-blockdev -v 0 --timeout=1
+
+    # SD-MUX without a card, next to a USB stick which is not a card reader
+    addUsbDevice 3-1.1 04e8 6001 3 2 sd-mux sdm-1
+    addUsbDevice 3-1.2 0424 4050 3 3 "Flash Card Reader" reader
+    addDisk 3-1.2 sdd 0
+    addUsbDevice 3-1.4 0781 5567 3 4 "Cruzer Blade" stick
+    addDisk 3-1.4 sde 15633408
+    expectError 'No block device appeared behind port 3-1.1' --wait-blockdev -e sdm-1 --timeout=1
+    echo 31116288 > "$SDMUX_SYSFS_ROOT/class/block/sdd/size"
+    expect '/dev/sdd' --wait-blockdev -e sdm-1 --timeout=1
+
+    # Two card readers on the hub of an SDWire
+    addUsbDevice 4-1.1 04e8 6001 4 2 sd-wire sdw-2
+    addUsbDevice 4-1.2 0424 4050 4 3 "Flash Card Reader" reader
+    addDisk 4-1.2 sdf 31116288
+    addUsbDevice 4-1.3 0424 4050 4 4 "Flash Card Reader" reader
+    addDisk 4-1.3 sdh 31116288
+    expectError 'the card cannot be told apart' --wait-blockdev -e sdw-2 --timeout=1
+
+    # USB-MUX has no card reader, so it is not even switched
+    addUsbDevice 5-1.1 04e8 6001 5 2 usb-mux um-1
+    addUsbDevice 5-1.2 0424 4050 5 3 "Flash Card Reader" reader
+    addDisk 5-1.2 sdi 31116288
+    expectError 'has no card reader' --wait-blockdev -e um-1 --timeout=1
+    expectError 'has no card reader' --ts --wait-blockdev -e um-1 --timeout=1 --direct
+}
+
+# Image written to many files at once, none of which may be given twice
+testFlashTargets() {
+    printf 'sd-mux-ctrl %04d\n' $(seq 1 3000) > "$WORKDIR/image.img"
+    : > "$WORKDIR/a.img"
+    : > "$WORKDIR/b.img"
+    ln -s a.img "$WORKDIR/link.img"
+
+    "$SDMUXCTRL" --flash="$WORKDIR/image.img" --blockdev="$WORKDIR/a.img,$WORKDIR/b.img" > /dev/null 2>&1 \
+        || fail "flashing two files failed"
+    cmp -s "$WORKDIR/image.img" "$WORKDIR/a.img" || fail "a.img differs from the image"
+    cmp -s "$WORKDIR/image.img" "$WORKDIR/b.img" || fail "b.img differs from the image"
+
+    : > "$WORKDIR/a.img"
+    expectError 'are the same target' --flash="$WORKDIR/image.img" \
+        --blockdev="$WORKDIR/a.img,$WORKDIR/b.img,$WORKDIR/a.img"
+    expectError 'are the same target' --flash="$WORKDIR/image.img" --blockdev="$WORKDIR/a.img,$WORKDIR/link.img"
+    [ -s "$WORKDIR/a.img" ] && fail "a.img has been written"
+    return 0
+}
+
+case "$TEST" in
+list-json)
+    testListJson
+    ;;
+sim-sequences)
+    testSimSequences
+    ;;
+blockdev)
+    testBlockdev
+    ;;
+flash-targets)
+    testFlashTargets
+    ;;
+*)
+    fail "unknown test"
+    ;;
+esac
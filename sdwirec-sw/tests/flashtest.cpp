@@ -0,0 +1,326 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        tests/flashtest.cpp
+ * @brief       Round trips of images written to plain files
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "cardmanifest.h"
+#include "flash.h"
+#include "imagecache.h"
+#include "test.h"
+
+static void initOptions(CCOptionValue options[], const char *image) {
+    memset(options, 0, CCO_MAX * sizeof(options[0]));
+    options[CCO_DeviceId].argn = -1;
+    options[CCO_Vendor].argn = SAMSUNG_VENDOR;
+    options[CCO_Product].argn = PRODUCT;
+    options[CCO_ImageCacheSize].argn = IMAGE_CACHE_DEFAULT_SIZE;
+    options[CCO_FlashImage].args = (char *)image;
+}
+
+static int readTestFile(const char *path, std::vector<unsigned char> &data) {
+    struct stat st;
+    ssize_t n;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return EXIT_FAILURE;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    data.resize(st.st_size);
+    n = read(fd, &data[0], data.size());
+    close(fd);
+
+    return n == (ssize_t)data.size() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Writes the image file over whatever the target file holds and reads the target back
+static int flashFile(const std::string &imagePath, const std::string &target, CCOptionValue options[],
+                     CCFlashStats *stats, std::vector<unsigned char> &written) {
+    options[CCO_FlashImage].args = (char *)imagePath.c_str();
+    if (flashImage(target.c_str(), options, stats) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    options[CCO_FlashImage].args = NULL;
+
+    return readTestFile(target.c_str(), written);
+}
+
+static int flashOverFile(const std::vector<unsigned char> &image, const std::string &target, CCOptionValue options[],
+                         CCFlashStats *stats, std::vector<unsigned char> &written) {
+    std::string imagePath = getTestPath("image.img");
+
+    if (writeTestFile(imagePath.c_str(), &image[0], image.size()) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    return flashFile(imagePath, target, options, stats, written);
+}
+
+// Writes the image to an empty target file and reads the target back
+static int flashToFile(const std::vector<unsigned char> &image, const std::string &target, CCOptionValue options[],
+                       CCFlashStats *stats, std::vector<unsigned char> &written) {
+    if (writeTestFile(target.c_str(), "", 0) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    return flashOverFile(image, target, options, stats, written);
+}
+
+static void fillBlock(std::vector<unsigned char> &image, size_t offset, size_t len, unsigned seed) {
+    for (size_t i = 0; i < len; i++)
+        image[offset + i] = (unsigned char)((offset + i) * 31 + seed) | 1;
+}
+
+int testFlash() {
+    std::vector<unsigned char> image(2 * IMAGE_BUFFER_SIZE + IMAGE_ALIGNMENT + 1234, 0), written;
+    std::string target = getTestPath("card.img");
+    CCOptionValue options[CCO_MAX];
+    CCFlashStats stats;
+    size_t aligned = image.size() / IMAGE_ALIGNMENT * IMAGE_ALIGNMENT;
+
+    // Image spanning three buffers, ending with a partial block and with a run of zero blocks in the middle
+    fillBlock(image, 0, image.size(), 7);
+    memset(&image[IMAGE_BUFFER_SIZE - IMAGE_ALIGNMENT], 0, 4 * IMAGE_ALIGNMENT);
+
+    initOptions(options, NULL);
+    CHECK(flashToFile(image, target, options, &stats, written) == EXIT_SUCCESS);
+    CHECK(written == image);
+    CHECK(stats.bytes == image.size() && stats.writtenBytes == image.size() && stats.skippedBytes == 0);
+
+    initOptions(options, NULL);
+    options[CCO_Sparse].argn = 1;
+    CHECK(flashToFile(image, target, options, &stats, written) == EXIT_SUCCESS);
+    CHECK(written == image);
+    CHECK(stats.skippedBytes == 4 * IMAGE_ALIGNMENT);
+    CHECK(stats.writtenBytes == image.size() - 4 * IMAGE_ALIGNMENT);
+
+    initOptions(options, NULL);
+    options[CCO_Delta].argn = 1;
+    options[CCO_Verify].argn = 1;
+    CHECK(flashToFile(image, target, options, &stats, written) == EXIT_SUCCESS);
+    CHECK(written == image);
+
+    // Card already holding the image gets only the partial block at its end, which is always written
+    CHECK(flashOverFile(image, target, options, &stats, written) == EXIT_SUCCESS);
+    CHECK(written == image);
+    CHECK(stats.unchangedBytes == aligned && stats.writtenBytes == image.size() - aligned);
+
+    // Single changed chunk is the only one rewritten
+    image[FLASH_DELTA_CHUNK + 100] ^= 0xff;
+    CHECK(flashOverFile(image, target, options, &stats, written) == EXIT_SUCCESS);
+    CHECK(written == image);
+    CHECK(stats.unchangedBytes == aligned - FLASH_DELTA_CHUNK);
+    CHECK(stats.writtenBytes == image.size() - aligned + FLASH_DELTA_CHUNK);
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Target written through the page cache gets the partial block at the end of the image as one more write of the last
+ * buffer, on top of the FLASH_MAX_RUNS runs of blocks it may already have after coalescing. Image holds
+ * FLASH_MAX_RUNS + 1 runs, two of them separated by a single zero block and the rest by two, followed by a zero block
+ * and the partial block.
+ */
+int testFlashRuns() {
+    std::vector<unsigned char> image, written;
+    std::string target = getTestPath("card.img");
+    CCOptionValue options[CCO_MAX];
+    CCFlashStats stats;
+    size_t block = 0;
+    int ret;
+
+    for (int run = 0; run <= FLASH_MAX_RUNS; run++) {
+        image.resize((block + 1) * IMAGE_ALIGNMENT, 0);
+        fillBlock(image, block * IMAGE_ALIGNMENT, IMAGE_ALIGNMENT, run);
+        block += run == 0 ? 2 : 3;
+    }
+    image.resize((block - 1) * IMAGE_ALIGNMENT + 100, 0);
+    fillBlock(image, (block - 1) * IMAGE_ALIGNMENT, 100, 0);
+
+    initOptions(options, NULL);
+    options[CCO_Sparse].argn = 1;
+    setenv(SDMUX_FLASH_DIRECT_ENV, "0", 1);
+    ret = flashToFile(image, target, options, &stats, written);
+    unsetenv(SDMUX_FLASH_DIRECT_ENV);
+    CHECK(ret == EXIT_SUCCESS);
+    CHECK(!stats.direct);
+    CHECK(written == image);
+    CHECK(stats.skippedBytes > 0 && stats.writtenBytes + stats.skippedBytes == image.size());
+
+    return EXIT_SUCCESS;
+}
+
+static size_t countCachedImages(const std::string &dir) {
+    struct dirent *de;
+    size_t count = 0, len;
+    DIR *d;
+
+    d = opendir(dir.c_str());
+    if (d == NULL)
+        return 0;
+
+    while ((de = readdir(d)) != NULL) {
+        len = strlen(de->d_name);
+        count += len > 4 && strcmp(de->d_name + len - 4, ".img") == 0;
+    }
+    closedir(d);
+
+    return count;
+}
+
+/*
+ * Images are cached on their first write and mapped from the cache on the following ones, also under another name of
+ * the same contents. Cache holding two of the images keeps the one used most recently when a third one is stored.
+ */
+int testImageCache() {
+    std::vector<unsigned char> images[3], written;
+    std::string dir = getTestPath("cache"), target = getTestPath("card.img"), paths[4];
+    CCOptionValue options[CCO_MAX];
+    CCFlashStats stats;
+
+    for (int i = 0; i < 3; i++) {
+        images[i].resize(2 * IMAGE_BUFFER_SIZE + IMAGE_ALIGNMENT + 1234);
+        fillBlock(images[i], 0, images[i].size(), i);
+        paths[i] = getTestPath(("image" + std::to_string(i) + ".img").c_str());
+        CHECK(writeTestFile(paths[i].c_str(), &images[i][0], images[i].size()) == EXIT_SUCCESS);
+    }
+    paths[3] = getTestPath("copy.img");
+    CHECK(writeTestFile(paths[3].c_str(), &images[0][0], images[0].size()) == EXIT_SUCCESS);
+
+    initOptions(options, NULL);
+    options[CCO_ImageCache].args = (char *)dir.c_str();
+    options[CCO_ImageCacheSize].argn = 20;
+    CHECK(writeTestFile(target.c_str(), "", 0) == EXIT_SUCCESS);
+    CHECK(flashFile(paths[0], target, options, &stats, written) == EXIT_SUCCESS);
+    CHECK(!stats.cached && written == images[0]);
+    CHECK(countCachedImages(dir) == 1);
+
+    CHECK(writeTestFile(target.c_str(), "", 0) == EXIT_SUCCESS);
+    CHECK(flashFile(paths[0], target, options, &stats, written) == EXIT_SUCCESS);
+    CHECK(stats.cached && written == images[0]);
+
+    // Manifest hashes stand in for hashes of the image, the one of the last chunk covers the partial block
+    options[CCO_Delta].argn = 1;
+    options[CCO_Verify].argn = 1;
+    CHECK(flashFile(paths[0], target, options, &stats, written) == EXIT_SUCCESS);
+    CHECK(stats.cached && written == images[0]);
+    CHECK(stats.unchangedBytes == 2 * IMAGE_BUFFER_SIZE && stats.writtenBytes == IMAGE_ALIGNMENT + 1234);
+    options[CCO_Delta].argn = 0;
+    options[CCO_Verify].argn = 0;
+
+    // Copy is stored under the key of the same contents, then found by its own index entry
+    CHECK(flashFile(paths[3], target, options, &stats, written) == EXIT_SUCCESS);
+    CHECK(!stats.cached && written == images[0]);
+    CHECK(countCachedImages(dir) == 1);
+    CHECK(flashFile(paths[3], target, options, &stats, written) == EXIT_SUCCESS);
+    CHECK(stats.cached);
+
+    CHECK(flashFile(paths[1], target, options, &stats, written) == EXIT_SUCCESS);
+    CHECK(!stats.cached && written == images[1]);
+    CHECK(flashFile(paths[0], target, options, &stats, written) == EXIT_SUCCESS);
+    CHECK(stats.cached);
+    CHECK(flashFile(paths[2], target, options, &stats, written) == EXIT_SUCCESS);
+    CHECK(!stats.cached && written == images[2]);
+    CHECK(countCachedImages(dir) == 2);
+
+    CHECK(flashFile(paths[0], target, options, &stats, written) == EXIT_SUCCESS);
+    CHECK(stats.cached && written == images[0]);
+    CHECK(flashFile(paths[1], target, options, &stats, written) == EXIT_SUCCESS);
+    CHECK(!stats.cached && written == images[1]);
+
+    return EXIT_SUCCESS;
+}
+
+// Splits a card manifest into its lines, the first four of which are the header
+static std::vector<std::string> readManifest(const std::string &path) {
+    std::vector<unsigned char> data;
+    std::vector<std::string> lines;
+
+    if (readTestFile(path.c_str(), data) != EXIT_SUCCESS)
+        return lines;
+    std::string text(data.begin(), data.end());
+    for (size_t start = 0, end; start < text.size(); start = end + 1) {
+        end = text.find('\n', start);
+        if (end == std::string::npos)
+            end = text.size();
+        lines.push_back(text.substr(start, end - start));
+    }
+    return lines;
+}
+
+int testCardManifest() {
+    std::vector<unsigned char> image(2 * IMAGE_BUFFER_SIZE + IMAGE_ALIGNMENT + 1234), written;
+    std::string dir = getTestPath("manifests"), target = getTestPath("card.img");
+    std::string manifest = dir + "/sdw-1.manifest";
+    CCOptionValue options[CCO_MAX];
+    CCFlashStats stats;
+
+    fillBlock(image, 0, image.size(), 3);
+    memset(&image[2 * CARD_MANIFEST_CHUNK], 0, CARD_MANIFEST_CHUNK);
+
+    initOptions(options, NULL);
+    options[CCO_CardManifest].args = (char *)dir.c_str();
+    options[CCO_DeviceSerial].args = (char *)"sdw-1";
+    options[CCO_Sparse].argn = 1;
+    CHECK(flashToFile(image, target, options, &stats, written) == EXIT_SUCCESS);
+    CHECK(!stats.lastWritten && written == image);
+    CHECK(stats.skippedBytes == CARD_MANIFEST_CHUNK);
+
+    // Skipped chunk is left as it was on the card, so its contents are unknown
+    std::vector<std::string> lines = readManifest(manifest);
+    CHECK(lines.size() == 4 + (image.size() + CARD_MANIFEST_CHUNK - 1) / CARD_MANIFEST_CHUNK);
+    CHECK(lines[0] == "sd-mux-ctrl-card 1" && lines[3] == "chunk " + std::to_string(CARD_MANIFEST_CHUNK));
+    CHECK(lines[4 + 2] == "-" && lines[4 + 1] != "-");
+
+    // Unchanged chunks without --delta are only known from the manifest, the card is not read for them, the last
+    // chunk is rewritten along with the partial block
+    CHECK(flashOverFile(image, target, options, &stats, written) == EXIT_SUCCESS);
+    CHECK(stats.lastWritten && written == image);
+    CHECK(stats.unchangedBytes == 2 * IMAGE_BUFFER_SIZE - CARD_MANIFEST_CHUNK);
+    CHECK(stats.writtenBytes == IMAGE_ALIGNMENT + 1234);
+    CHECK(readManifest(manifest)[4 + 2] == "-");
+
+    // Unknown chunk is written once it is no longer skipped, after which the whole card is known
+    options[CCO_Sparse].argn = 0;
+    CHECK(flashOverFile(image, target, options, &stats, written) == EXIT_SUCCESS);
+    CHECK(stats.lastWritten && written == image);
+    CHECK(stats.writtenBytes == CARD_MANIFEST_CHUNK + IMAGE_ALIGNMENT + 1234);
+    CHECK(readManifest(manifest)[4 + 2] != "-");
+    CHECK(flashOverFile(image, target, options, &stats, written) == EXIT_SUCCESS);
+    CHECK(stats.lastWritten && written == image);
+    CHECK(stats.unchangedBytes == 2 * IMAGE_BUFFER_SIZE && stats.writtenBytes == IMAGE_ALIGNMENT + 1234);
+
+    // Card modified behind the manifest's back is written in full
+    FILE *file = fopen(target.c_str(), "r+b");
+    CHECK(file != NULL);
+    CHECK(fwrite("modified", 1, 8, file) == 8);
+    fclose(file);
+    CHECK(flashOverFile(image, target, options, &stats, written) == EXIT_SUCCESS);
+    CHECK(!stats.lastWritten && written == image);
+    CHECK(stats.unchangedBytes == 0 && stats.writtenBytes == image.size());
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,83 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        tests/hashtest.cpp
+ * @brief       Known answer tests of SHA-256 and XXH64
+ */
+
+#include <string.h>
+
+#include <string>
+
+#include "sha256.h"
+#include "test.h"
+#include "xxhash.h"
+
+static std::string getSha256Hex(const void *data, size_t len, size_t step) {
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    char hex[SHA256_HEX_SIZE];
+    CCSha256 ctx;
+
+    // Fed in pieces of the given size to cover buffering of partial blocks
+    sha256Init(&ctx);
+    for (size_t done = 0; done < len; done += step)
+        sha256Update(&ctx, (const unsigned char *)data + done, len - done < step ? len - done : step);
+    sha256Final(&ctx, digest);
+    sha256ToHex(digest, hex);
+
+    return hex;
+}
+
+int testSha256() {
+    const char *two = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    std::string million(1000000, 'a');
+
+    // FIPS 180-2 examples
+    CHECK(getSha256Hex("", 0, 1) == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    CHECK(getSha256Hex("abc", 3, 3) == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    CHECK(getSha256Hex(two, strlen(two), strlen(two))
+          == "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+    CHECK(getSha256Hex(two, strlen(two), 7) == "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+    CHECK(getSha256Hex(million.data(), million.size(), 4099)
+          == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+
+    CHECK(sha256FromHex("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", digest) == EXIT_SUCCESS);
+    CHECK(digest[0] == 0xba && digest[SHA256_DIGEST_SIZE - 1] == 0xad);
+    CHECK(sha256FromHex("ba7816bf", digest) != EXIT_SUCCESS);
+    CHECK(sha256FromHex("zz7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", digest) != EXIT_SUCCESS);
+
+    return EXIT_SUCCESS;
+}
+
+int testXxh64() {
+    const char *text = "Nobody inspects the spammish repetition";
+    unsigned char bytes[1024];
+
+    for (size_t i = 0; i < sizeof(bytes); i++)
+        bytes[i] = i;
+
+    // Inputs shorter than a stripe, shorter than a word and long enough for all four lanes
+    CHECK(xxh64("", 0, 0) == 0xef46db3751d8e999ULL);
+    CHECK(xxh64("a", 1, 0) == 0xd24ec4f1a98c6e5bULL);
+    CHECK(xxh64("abc", 3, 0) == 0x44bc2cf5ad770999ULL);
+    CHECK(xxh64("abc", 3, 0x9e3779b185ebca87ULL) == 0xa7cb2aac405e36c7ULL);
+    CHECK(xxh64(text, strlen(text), 0) == 0xfbcea83c8a378bf1ULL);
+    CHECK(xxh64(bytes, 100, 12345) == 0x028ba1ae2de4de27ULL);
+    CHECK(xxh64(bytes, sizeof(bytes), 0) == 0x6f3914f18fe4df57ULL);
+
+    return EXIT_SUCCESS;
+}
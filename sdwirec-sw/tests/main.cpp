@@ -0,0 +1,117 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        tests/main.cpp
+ * @brief       Runner of sd-mux-ctrl unit tests
+ *
+ * Runs the test given as the only argument, or all of them. Every run gets a scratch directory of its own.
+ */
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "test.h"
+
+static const CCTest tests[] = {
+    { "sha256", testSha256 },
+    { "xxh64", testXxh64 },
+    { "bmap", testBmap },
+    { "partition", testPartition },
+    { "cache", testCache },
+    { "flash", testFlash },
+    { "flash-runs", testFlashRuns },
+    { "image-cache", testImageCache },
+    { "card-manifest", testCardManifest },
+};
+
+static char scratchDir[PATH_MAX];
+
+const char *getTestPath(const char *name) {
+    static std::string path;
+
+    path = std::string(scratchDir) + "/" + name;
+
+    return path.c_str();
+}
+
+int writeTestFile(const char *path, const void *data, size_t len) {
+    ssize_t n;
+    int fd;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return EXIT_FAILURE;
+    n = write(fd, data, len);
+    close(fd);
+
+    return n == (ssize_t)len ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int createScratchDir() {
+    const char *tmp = getenv("TMPDIR");
+
+    snprintf(scratchDir, sizeof(scratchDir), "%s/sd-mux-ctrl-tests.XXXXXX", tmp != NULL ? tmp : "/tmp");
+    if (mkdtemp(scratchDir) == NULL) {
+        perror("Unable to create scratch directory");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int removeEntry(const char *path, const struct stat *, int, struct FTW *) {
+    return remove(path);
+}
+
+static void removeScratchDir() {
+    if (nftw(scratchDir, removeEntry, 16, FTW_DEPTH | FTW_PHYS) != 0)
+        fprintf(stderr, "Unable to remove %s\n", scratchDir);
+}
+
+int main(int argc, char **argv) {
+    int ret = EXIT_SUCCESS, found = 0;
+
+    if (createScratchDir() != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        if (argc > 1 && strcmp(argv[1], tests[i].name) != 0)
+            continue;
+
+        found++;
+        if (tests[i].run() != EXIT_SUCCESS) {
+            fprintf(stderr, "%s: FAILED\n", tests[i].name);
+            ret = EXIT_FAILURE;
+        } else {
+            printf("%s: OK\n", tests[i].name);
+        }
+    }
+    removeScratchDir();
+
+    if (found == 0) {
+        fprintf(stderr, "Unknown test %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    return ret;
+}
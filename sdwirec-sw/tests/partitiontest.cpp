@@ -0,0 +1,105 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        tests/partitiontest.cpp
+ * @brief       Parsing of MBR and GPT partition tables
+ */
+
+#include <string.h>
+
+#include <vector>
+
+#include "partition.h"
+#include "test.h"
+
+static void putLe32(unsigned char *p, uint32_t value) {
+    for (int i = 0; i < 4; i++)
+        p[i] = value >> (8 * i);
+}
+
+static void putLe64(unsigned char *p, uint64_t value) {
+    putLe32(p, (uint32_t)value);
+    putLe32(p + 4, (uint32_t)(value >> 32));
+}
+
+static void putMbrEntry(unsigned char *table, int index, unsigned char type, uint32_t first, uint32_t sectors) {
+    unsigned char *entry = table + 446 + index * 16;
+
+    entry[4] = type;
+    putLe32(entry + 8, first);
+    putLe32(entry + 12, sectors);
+}
+
+static void putGptEntry(unsigned char *table, int index, uint64_t first, uint64_t last, const char *name) {
+    unsigned char *entry = table + 2 * PARTITION_SECTOR_SIZE + index * 128;
+
+    memset(entry, 0xa5, 16);
+    putLe64(entry + 32, first);
+    putLe64(entry + 40, last);
+    for (size_t i = 0; name[i] != '\0'; i++)
+        entry[56 + 2 * i] = name[i];
+}
+
+int testPartition() {
+    std::vector<unsigned char> table(PARTITION_TABLE_SIZE, 0);
+    std::vector<CCPartition> mbr, gpt;
+    unsigned char *header = &table[PARTITION_SECTOR_SIZE];
+
+    CHECK(parsePartitionTable(&table[0], table.size(), mbr) != EXIT_SUCCESS);
+
+    // Two primary partitions with an empty slot between them
+    table[510] = 0x55;
+    table[511] = 0xaa;
+    putMbrEntry(&table[0], 0, 0x0c, 2048, 4096);
+    putMbrEntry(&table[0], 2, 0x83, 10240, 20480);
+    CHECK(parsePartitionTable(&table[0], table.size(), mbr) == EXIT_SUCCESS);
+    CHECK(mbr.size() == 2);
+    CHECK(mbr[0].number == 1 && mbr[0].start == 2048 * 512ULL && mbr[0].size == 4096 * 512ULL);
+    CHECK(mbr[1].number == 3 && mbr[1].start == 10240 * 512ULL && mbr[1].size == 20480 * 512ULL);
+    CHECK(mbr[1].label[0] == '\0');
+    CHECK(findPartition(mbr, "3") == &mbr[1]);
+    CHECK(findPartition(mbr, "2") == NULL);
+
+    // Protective MBR followed by GPT with its entries right after the header
+    memset(&table[446], 0, 64);
+    putMbrEntry(&table[0], 0, 0xee, 1, 0xffffffff);
+    memcpy(header, "EFI PART", 8);
+    putLe64(header + 72, 2);
+    putLe32(header + 80, 128);
+    putLe32(header + 84, 128);
+    putGptEntry(&table[0], 0, 2048, 10239, "boot");
+    putGptEntry(&table[0], 1, 10240, 30719, "rootfs");
+    CHECK(parsePartitionTable(&table[0], table.size(), gpt) == EXIT_SUCCESS);
+    CHECK(gpt.size() == 2);
+    CHECK(gpt[0].number == 1 && strcmp(gpt[0].label, "boot") == 0);
+    CHECK(gpt[1].number == 2 && strcmp(gpt[1].label, "rootfs") == 0);
+    CHECK(gpt[1].start == 10240 * 512ULL && gpt[1].size == 20480 * 512ULL);
+    CHECK(findPartition(gpt, "rootfs") == &gpt[1]);
+    CHECK(findPartition(gpt, "1") == &gpt[0]);
+    CHECK(findPartition(gpt, "home") == NULL);
+
+    CHECK(!isSameLayout(mbr, gpt));
+    mbr[1].number = 2;
+    CHECK(!isSameLayout(mbr, gpt));
+    mbr[0].size = gpt[0].size;
+    CHECK(isSameLayout(mbr, gpt));
+
+    // Entries must fit into the data given
+    putLe32(header + 80, 256);
+    CHECK(parsePartitionTable(&table[0], table.size(), gpt) != EXIT_SUCCESS);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,56 @@
+/*
+ *  Copyright (c) 2016 -2018 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ */
+/**
+ * @file        tests/test.h
+ * @brief       Checks shared by sd-mux-ctrl unit tests
+ */
+
+#ifndef SDMUXCTRL_TEST_H
+#define SDMUXCTRL_TEST_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Fails the test the check is called from
+#define CHECK(cond)                                                                         \
+    do {                                                                                    \
+        if (!(cond)) {                                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);        \
+            return EXIT_FAILURE;                                                            \
+        }                                                                                   \
+    } while (0)
+
+struct CCTest {
+    const char *name;
+    int (*run)();
+};
+
+// Path of a file in the scratch directory of the test run, which is removed on exit
+const char *getTestPath(const char *name);
+int writeTestFile(const char *path, const void *data, size_t len);
+
+int testSha256();
+int testXxh64();
+int testBmap();
+int testPartition();
+int testCache();
+int testFlash();
+int testFlashRuns();
+int testImageCache();
+int testCardManifest();
+
+#endif // SDMUXCTRL_TEST_H